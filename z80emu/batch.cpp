@@ -0,0 +1,212 @@
+#include "batch.h"
+#include "lockstep.h"
+#include "mappedfile.h"
+#include "snapshot.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Work stealing: every worker starts with an even share of the jobs in its own queue and takes from the back of it,
+// a worker that runs out takes from the front of the others, so the jobs that are stolen are the ones furthest from
+// what the owner is working on. Jobs are never added once the workers run, an empty round means the batch is done
+struct WorkQueue
+{
+	std::mutex lock;
+	std::deque<size_t> jobs;
+};
+
+static bool takeJob(std::vector<WorkQueue>& queues, const unsigned int self, size_t& job)
+{
+	{
+		WorkQueue& own = queues[self];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.jobs.empty())
+		{
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+	for (unsigned int i = 1; i < queues.size(); i++)
+	{
+		WorkQueue& victim = queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+// every job starts from the same snapshot, restoring it only copies back the pages the last job wrote
+static void runWorker(const std::string& rom, const std::vector<BatchJob>& jobs, std::vector<BatchResult>& results,
+	std::vector<WorkQueue>& queues, const unsigned int self, const CPU::Dispatch engine)
+{
+	CPU cpu;
+	cpu.loadROMImage(rom);
+	Snapshot powerOn;
+	cpu.snapshot(powerOn);
+
+	size_t job;
+	while (takeJob(queues, self, job))
+	{
+		cpu.restore(powerOn);
+		cpu.writeMemory(jobs[job].address, jobs[job].input);
+		const CPU::RunResult run = cpu.run(jobs[job].instructions, engine);
+
+		BatchResult& result = results[job];
+		result.reason = run.reason;
+		result.instructions = run.instructions;
+		result.cycles = run.cycles;
+		result.registers = cpu.getRegisters();
+		result.ramHash = cpu.hashRAM();
+	}
+}
+
+CPU::LoadResult runBatch(const std::string& rom, const std::vector<BatchJob>& jobs, std::vector<BatchResult>& results,
+	unsigned int threads, CPU::Dispatch engine)
+{
+	// the workers load the ROM themselves, this one only checks that it fits
+	{
+		CPU probe;
+		const CPU::LoadResult loaded = probe.loadROMImage(rom);
+		if (loaded != CPU::LOAD_OK)
+		{
+			return loaded;
+		}
+	}
+
+	results.resize(jobs.size());
+	if (threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads > jobs.size())
+	{
+		threads = (unsigned int)jobs.size();
+	}
+	if (threads == 0)
+	{
+		return CPU::LOAD_OK;
+	}
+
+	std::vector<WorkQueue> queues(threads);
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		for (size_t job = jobs.size() * i / threads; job < jobs.size() * (i + 1) / threads; job++)
+		{
+			queues[i].jobs.push_back(job);
+		}
+	}
+
+	// the calling thread is worker 0
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		workers.push_back(std::thread(runWorker, std::cref(rom), std::cref(jobs), std::ref(results), std::ref(queues), i, engine));
+	}
+	runWorker(rom, jobs, results, queues, 0, engine);
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	return CPU::LOAD_OK;
+}
+
+CPU::LoadResult runLockstepBatch(const std::string& rom, const std::vector<BatchJob>& jobs, std::vector<BatchResult>& results)
+{
+	Lockstep lockstep((unsigned int)jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		CPU& cpu = lockstep.lane((unsigned int)i);
+		const CPU::LoadResult loaded = cpu.loadROMImage(rom);
+		if (loaded != CPU::LOAD_OK)
+		{
+			return loaded;
+		}
+		cpu.writeMemory(jobs[i].address, jobs[i].input);
+	}
+
+	std::vector<CPU::RunResult> runs;
+	lockstep.run(jobs.empty() ? 0 : jobs[0].instructions, runs);
+	results.resize(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		CPU& cpu = lockstep.lane((unsigned int)i);
+		BatchResult& result = results[i];
+		result.reason = runs[i].reason;
+		result.instructions = runs[i].instructions;
+		result.cycles = runs[i].cycles;
+		result.registers = cpu.getRegisters();
+		result.ramHash = cpu.hashRAM();
+	}
+	return CPU::LOAD_OK;
+}
+
+static bool readFile(const std::string& fileName, std::string& contents)
+{
+	MappedFile file;
+	if (!file.open(fileName))
+	{
+		return false;
+	}
+	contents.assign(file.data(), file.size());
+	return true;
+}
+
+bool runBatchFiles(const std::string& romFile, unsigned long long instructions, unsigned int threads, const std::vector<std::string>& inputFiles,
+	bool lockstep)
+{
+	static const char* reasons[] = { "none", "budget", "halt", "breakpoint", "invalid opcode" };
+
+	std::string rom;
+	if (!readFile(romFile, rom))
+	{
+		std::cerr << "Unable to load ROM: " << romFile << std::endl;
+		return false;
+	}
+	std::vector<BatchJob> jobs(inputFiles.size());
+	for (size_t i = 0; i < inputFiles.size(); i++)
+	{
+		if (!readFile(inputFiles[i], jobs[i].input))
+		{
+			std::cerr << "Unable to read input: " << inputFiles[i] << std::endl;
+			return false;
+		}
+		jobs[i].address = BATCH_INPUT_START;
+		jobs[i].instructions = instructions;
+	}
+
+	std::vector<BatchResult> results;
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	const CPU::LoadResult loaded = lockstep ? runLockstepBatch(rom, jobs, results) : runBatch(rom, jobs, results, threads);
+	const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	if (loaded != CPU::LOAD_OK)
+	{
+		std::cerr << "Unable to load ROM: " << romFile << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+		return false;
+	}
+
+	unsigned long long total = 0;
+	std::cout << "input\tstop\tinstructions\tcycles\tPC\tSP\tAF\tBC\tDE\tHL\tIX\tIY\tram" << std::endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BatchResult& result = results[i];
+		const CPU::Registers& regs = result.registers;
+		const unsigned short words[] = { regs.PC, regs.SP, regs.AF, regs.BC, regs.DE, regs.HL, regs.IX, regs.IY };
+		std::cout << inputFiles[i] << "\t" << reasons[result.reason] << "\t" << std::dec << result.instructions << "\t" << result.cycles << std::hex << std::setfill('0');
+		for (unsigned int j = 0; j < sizeof(words) / sizeof(words[0]); j++)
+		{
+			std::cout << "\t" << std::setw(4) << words[j];
+		}
+		std::cout << "\t" << std::setw(16) << result.ramHash << std::dec << std::setfill(' ') << std::endl;
+		total += result.instructions;
+	}
+	std::cerr << results.size() << " runs, " << total << " instructions in " << elapsed.count() << " s" << std::endl;
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef Z80_BATCH_H
+#define Z80_BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+
+// address the CLI copies each input file to
+#define BATCH_INPUT_START 0x8000
+
+// one independent run of the batch ROM
+struct BatchJob
+{
+	std::string input;		// copied to [address] before the run
+	unsigned short address;
+	unsigned long long instructions;	// budget
+};
+
+struct BatchResult
+{
+	CPU::StopReason reason;
+	unsigned long long instructions;
+	unsigned long long cycles;
+	CPU::Registers registers;	// when the run ended
+	unsigned long long ramHash;	// CPU::hashRAM
+};
+
+// Runs every job from the power on state with [rom] loaded (see CPU::loadROMImage), results[i] is the result of jobs[i]
+// The jobs are spread over [threads] threads (0: one per core) that steal from each other once their own jobs run out
+// Each thread keeps one CPU and restores it to a snapshot of the power on state between jobs, so cached code survives
+CPU::LoadResult runBatch(const std::string& rom, const std::vector<BatchJob>& jobs, std::vector<BatchResult>& results,
+	unsigned int threads = 0, CPU::Dispatch engine = CPU::DISPATCH_THREADED);
+
+// Same as runBatch on one thread, but every job is a lane of a Lockstep, so the jobs run side by side
+// All jobs run for the budget of the first one
+CPU::LoadResult runLockstepBatch(const std::string& rom, const std::vector<BatchJob>& jobs, std::vector<BatchResult>& results);
+
+// Runs [romFile] once per input file and prints one line per run, then the total time to std::cerr
+// threads 0 is one per core, lockstep runs them through runLockstepBatch instead
+bool runBatchFiles(const std::string& romFile, unsigned long long instructions, unsigned int threads, const std::vector<std::string>& inputFiles,
+	bool lockstep = false);
+
+#endif
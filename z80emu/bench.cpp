@@ -0,0 +1,237 @@
+#include "bench.h"
+#include "cpu.h"
+
+#include <chrono>
+
+// ld a, 1 / ld b, 2 / loop: add a, b / ld c, a / inc d / dec e / and c / or b / xor d / cp e / jp loop
+static const char builtinROM[] =
+{
+	0x3E, 0x01, 0x06, 0x02,
+	(char)0x80, 0x4F, 0x14, 0x1D, (char)0xA1, (char)0xB0, (char)0xAA, (char)0xBB,
+	(char)0xC3, 0x04, 0x01,
+};
+
+#define NUM_ENGINES 5
+static const char* names[NUM_ENGINES] = { "switch", "table", "threaded", "blocks", "jit" };
+static const CPU::Dispatch engines[NUM_ENGINES] = { CPU::DISPATCH_SWITCH, CPU::DISPATCH_TABLE, CPU::DISPATCH_THREADED, CPU::DISPATCH_BLOCKS, CPU::DISPATCH_JIT };
+
+static CPU::LoadResult loadBenchROM(CPU& cpu, const std::string& romFile)
+{
+	if (romFile.empty())
+	{
+		return cpu.loadROMImage(std::string(builtinROM, sizeof(builtinROM)));
+	}
+	return cpu.loadROM(romFile);
+}
+
+bool benchmarkDispatch(const std::string& romFile, unsigned long instructions)
+{
+	CPU reference;
+	const CPU::LoadResult loaded = loadBenchROM(reference, romFile);
+	if (loaded != CPU::LOAD_OK)
+	{
+		std::cerr << "Unable to load ROM: " << romFile << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+		return false;
+	}
+
+	bool identical = true;
+	std::cout << "engine\tinstructions/s" << std::endl;
+	for (int i = 0; i < NUM_ENGINES; i++)
+	{
+		CPU cpu;
+		loadBenchROM(cpu, romFile);
+
+		const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		const CPU::RunResult result = cpu.run(instructions, engines[i]);
+		const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		std::cout << names[i] << "\t" << std::fixed << std::setprecision(0) << result.instructions / elapsed.count() << std::endl;
+
+		// the switch is the reference implementation, every other engine must end in the exact same state
+		if (i == 0)
+		{
+			reference.run(instructions, CPU::DISPATCH_SWITCH);
+		}
+		else if (!cpu.sameState(reference))
+		{
+			std::cout << names[i] << " does not match the switch engine" << std::endl;
+			identical = false;
+		}
+	}
+	return identical;
+}
+
+// Opcode families, each one a generated stream of the same few instructions repeated up to BENCH_STREAM_SIZE bytes,
+// then a jp back to the start of the repeats. Every family starts from the same setup:
+// ld hl, 0x8000 / ld de, 0x9000 / ld bc, 0x0110 / ld ix, 0x8100 / ld iy, 0x8200 / ld a, 0x5A
+static const char benchSetup[] =
+{
+	0x21, 0x00, (char)0x80, 0x11, 0x00, (char)0x90, 0x01, 0x10, 0x01,
+	(char)0xDD, 0x21, 0x00, (char)0x81, (char)0xFD, 0x21, 0x00, (char)0x82, 0x3E, 0x5A,
+};
+#define BENCH_ORIGIN 0x100		// where loadROMImage puts the program, PC gets there through the nops below it
+#define BENCH_STREAM_SIZE 0x1000
+#define BENCH_REPEATS 3			// runs per family and engine, the fastest one counts
+
+static void put(std::string& code, const int b0, const int b1 = -1, const int b2 = -1, const int b3 = -1)
+{
+	const int bytes[] = { b0, b1, b2, b3 };
+	for (unsigned int i = 0; i < 4 && bytes[i] >= 0; i++)
+	{
+		code += (char)bytes[i];
+	}
+}
+
+static unsigned short here(const std::string& code)
+{
+	return (unsigned short)(BENCH_ORIGIN + code.size());
+}
+
+// ld r, r' / ld r, * / ld a, (hl) / ld (hl), a / ld a, (**) / ld (**), a, hl stays on 0x8000
+static void emitLoads(std::string& code)
+{
+	put(code, 0x41); put(code, 0x4A); put(code, 0x53); put(code, 0x5F); put(code, 0x78);
+	put(code, 0x06, 0x12); put(code, 0x0E, 0x34);
+	put(code, 0x7E); put(code, 0x77);
+	put(code, 0x3A, 0x10, 0x80); put(code, 0x32, 0x11, 0x80);
+}
+
+// add adc sub sbc and xor or cp on registers, (hl) and immediates, inc / dec r
+static void emitALU(std::string& code)
+{
+	put(code, 0x80); put(code, 0x89); put(code, 0x92); put(code, 0x9B);
+	put(code, 0xA0); put(code, 0xA9); put(code, 0xB2); put(code, 0xBB);
+	put(code, 0xC6, 0x11); put(code, 0xD6, 0x22); put(code, 0xE6, 0xF7); put(code, 0xFE, 0x40);
+	put(code, 0x86); put(code, 0x3C); put(code, 0x05);
+}
+
+// add hl, rr / adc hl, rr / sbc hl, rr / inc / dec rr
+static void emitALU16(std::string& code)
+{
+	put(code, 0x09); put(code, 0x19); put(code, 0x29);
+	put(code, 0xED, 0x4A); put(code, 0xED, 0x52);
+	put(code, 0x03); put(code, 0x1B); put(code, 0x23); put(code, 0x2B);
+}
+
+// jp / jr / djnz / jp cc / jr cc to the next instruction, call to a ret that is jumped over on the way back
+static void emitJumps(std::string& code)
+{
+	put(code, 0xC3, (here(code) + 3) & 0xFF, (here(code) + 3) >> 8);
+	put(code, 0x18, 0x00);
+	put(code, 0x10, 0x00);
+	put(code, 0xC2, (here(code) + 3) & 0xFF, (here(code) + 3) >> 8);
+	put(code, 0x28, 0x00);
+	put(code, 0xCD, (here(code) + 5) & 0xFF, (here(code) + 5) >> 8);
+	put(code, 0x18, 0x01);
+	put(code, 0xC9);
+}
+
+// rotates, shifts, bit / set / res on registers and (hl)
+static void emitBits(std::string& code)
+{
+	put(code, 0xCB, 0x00); put(code, 0xCB, 0x09); put(code, 0xCB, 0x12); put(code, 0xCB, 0x1B);
+	put(code, 0xCB, 0x27); put(code, 0xCB, 0x28); put(code, 0xCB, 0x3F);
+	put(code, 0xCB, 0x47); put(code, 0xCB, 0x7E); put(code, 0xCB, 0xC6); put(code, 0xCB, 0x86);
+}
+
+// ldir and cpir over 16 bytes, ldi, ldd, each repeat of ldir / cpir counts as an instruction
+static void emitBlocks(std::string& code)
+{
+	put(code, 0x21, 0x00, 0x80); put(code, 0x11, 0x00, 0x90); put(code, 0x01, 0x10, 0x00);
+	put(code, 0xED, 0xB0);
+	put(code, 0x21, 0x00, 0x80); put(code, 0x01, 0x10, 0x00);
+	put(code, 0xED, 0xB1);
+	put(code, 0xED, 0xA0); put(code, 0xED, 0xA8);
+}
+
+// ld / alu / inc on (ix + d) and (iy + d), inc / dec ix, bit / set on (ix + d) / (iy + d)
+static void emitIndexed(std::string& code)
+{
+	put(code, 0xDD, 0x7E, 0x04); put(code, 0xFD, 0x77, 0x08);
+	put(code, 0xDD, 0x86, 0x10); put(code, 0xFD, 0x34, 0x20);
+	put(code, 0xDD, 0x23); put(code, 0xDD, 0x2B);
+	put(code, 0xDD, 0xCB, 0x02); put(code, 0x46);
+	put(code, 0xFD, 0xCB, 0x03); put(code, 0xC6);
+}
+
+struct OpcodeFamily
+{
+	const char* name;
+	void (*emit)(std::string& code);	// appends one repeat
+};
+
+static const OpcodeFamily families[] =
+{
+	{ "load8", emitLoads },
+	{ "alu8", emitALU },
+	{ "alu16", emitALU16 },
+	{ "jump", emitJumps },
+	{ "cb", emitBits },
+	{ "block", emitBlocks },
+	{ "indexed", emitIndexed },
+};
+
+static std::string buildStream(const OpcodeFamily& family)
+{
+	std::string code(benchSetup, sizeof(benchSetup));
+	const unsigned short start = here(code);
+	while (code.size() < BENCH_STREAM_SIZE)
+	{
+		family.emit(code);
+	}
+	put(code, 0xC3, start & 0xFF, start >> 8);
+	return code;
+}
+
+bool benchmarkOpcodes(unsigned long instructions)
+{
+	bool identical = true;
+	bool first = true;
+	std::cout << "{" << std::endl << "\t\"instructions\": " << instructions << "," << std::endl << "\t\"results\": [" << std::endl;
+	for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++)
+	{
+		const std::string stream = buildStream(families[f]);
+		CPU reference;
+		reference.loadROMImage(stream);
+		reference.run((unsigned long long)instructions * BENCH_REPEATS, CPU::DISPATCH_SWITCH);
+
+		for (int i = 0; i < NUM_ENGINES; i++)
+		{
+			CPU cpu;
+			cpu.loadROMImage(stream);
+			double best = 0;
+			unsigned long long executed = 0;
+			for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+			{
+				const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				const CPU::RunResult result = cpu.run(instructions, engines[i]);
+				const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+				if (result.reason != CPU::STOP_BUDGET)
+				{
+					std::cerr << families[f].name << " stopped early on " << names[i] << std::endl;
+					identical = false;
+				}
+				if (repeat == 0 || elapsed.count() < best)
+				{
+					best = elapsed.count();
+					executed = result.instructions;
+				}
+			}
+			// same as benchmarkDispatch, the switch is the reference
+			if (!cpu.sameState(reference))
+			{
+				std::cerr << families[f].name << " on " << names[i] << " does not match the switch engine" << std::endl;
+				identical = false;
+			}
+
+			std::cout << (first ? "" : ",\n") << "\t\t{ \"family\": \"" << families[f].name << "\", \"engine\": \"" << names[i]
+				<< "\", \"instructions\": " << executed << std::fixed << std::setprecision(6) << ", \"seconds\": " << best
+				<< std::setprecision(3) << ", \"ns_per_instruction\": " << best * 1e9 / executed
+				<< ", \"mips\": " << executed / best / 1e6 << " }";
+			std::cout.unsetf(std::ios::floatfield);
+			first = false;
+		}
+	}
+	std::cout << std::endl << "\t]" << std::endl << "}" << std::endl;
+	return identical;
+}
@@ -0,0 +1,17 @@
+#ifndef Z80_BENCH_H
+#define Z80_BENCH_H
+
+#include <string>
+
+// Runs [instructions] instructions of [romFile] through every dispatch engine and prints instructions per second
+// An empty [romFile] runs a small built-in load/ALU loop instead
+// Returns false if the ROM could not be loaded or the engines did not end in the same state
+bool benchmarkDispatch(const std::string& romFile, unsigned long instructions);
+
+// Runs a generated instruction stream per opcode family (8 bit loads, 8 bit ALU, 16 bit arithmetic, jumps and calls,
+// CB, ED block instructions, IX / IY) for [instructions] instructions through every engine, the fastest of a few runs
+// counts. Prints ns per instruction and emulated MIPS per family and engine as JSON
+// Returns false if a stream stopped before the budget or an engine did not end in the same state as the switch
+bool benchmarkOpcodes(unsigned long instructions);
+
+#endif
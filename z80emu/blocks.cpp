@@ -0,0 +1,518 @@
+#include "cpu.h"
+#include "cycles.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Basic block cache: the instructions from an entry PC up to the first one that can jump (or stop the run) are decoded once
+// into handlers and executed back to back with the cycle, R and instruction accounting done once per block
+// The opcode bodies still read their immediates from memory, any store into a block drops it (see invalidateCode)
+// Every page holding a block has its bit set in codePages, so stores elsewhere only pay for one bit test
+// (RAM shared with a snapshot is marked too, see snapshot.cpp)
+
+// instruction length in bytes of the unprefixed opcodes, 0xCB counts its opcode byte
+static const unsigned char lengthMain[256] =
+{
+//	 0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+	 1,  3,  1,  1,  1,  1,  2,  1,  1,  1,  1,  1,  1,  1,  2,  1, // 0
+	 2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1, // 1
+	 2,  3,  3,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1, // 2
+	 2,  3,  3,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1, // 3
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 4
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 5
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 6
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 7
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 8
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 9
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // A
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // B
+	 1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1, // C
+	 1,  1,  3,  2,  3,  1,  2,  1,  1,  1,  3,  2,  3,  1,  2,  1, // D
+	 1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1, // E
+	 1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1  // F
+};
+
+// djnz, jr, halt, jp, call, ret, rst, and ei which may let an interrupt in after the next instruction
+static bool mainEndsBlock(const unsigned char opcode)
+{
+	if (opcode < 0x40)
+	{
+		return opcode >= 0x10 && (opcode & 7) == 0;
+	}
+	if (opcode < 0xC0)
+	{
+		return opcode == 0x76;
+	}
+	const unsigned char z = opcode & 7;
+	return z == 0 || z == 2 || z == 4 || z == 7 || opcode == 0xC3 || opcode == 0xC9 || opcode == 0xCD || opcode == 0xE9 || opcode == 0xFB;
+}
+
+// retn / reti, ld r, a and ld a, r (R is only added up at the end of a block), the repeating block instructions
+static bool extendedEndsBlock(const unsigned char opcode)
+{
+	if (opcode >= 0x40 && opcode < 0x80)
+	{
+		return (opcode & 7) == 5 || opcode == 0x4F || opcode == 0x5F;
+	}
+	return opcode >= 0xB0 && opcode < 0xC0 && (opcode & 7) < 4;
+}
+
+static unsigned int extendedLength(const unsigned char opcode)
+{
+	return (opcode >= 0x40 && opcode < 0x80 && (opcode & 7) == 3) ? 4 : 2;
+}
+
+// the opcodes that turn (hl) into (ix + d) / (iy + d) and get a displacement byte
+static bool usesDisplacement(const unsigned char opcode)
+{
+	if (opcode == 0x34 || opcode == 0x35 || opcode == 0x36)
+	{
+		return true;
+	}
+	if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76)
+	{
+		return (opcode & 7) == 6 || (opcode & 0x38) == 0x30;
+	}
+	return opcode >= 0x80 && opcode < 0xC0 && (opcode & 7) == 6;
+}
+
+// instructions that only change registers and flags, what a loop polling memory or a port is made of
+// stores, the stack, ports writes, exchanges with the other register set, R, interrupts and index registers are left out
+static bool pollingOpcode(const unsigned char opcode, const unsigned char next)
+{
+	switch (opcode)
+	{
+		case 0xCB:
+		{
+			return (next & 0xC0) == 0x40 || (next & 7) != 6; // bit n, (hl) or anything on a register
+		}
+		case 0xED:
+		{
+			return (next & 0xC7) == 0x40; // in r, (c)
+		}
+		case 0xDB: // in a, (n)
+		case 0x0A: // ld a, (bc)
+		case 0x1A: // ld a, (de)
+		case 0x2A: // ld hl, (nn)
+		case 0x3A: // ld a, (nn)
+		case 0x00:
+		case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+		{
+			return true;
+		}
+	}
+	if (opcode >= 0x40 && opcode < 0x80)
+	{
+		return opcode < 0x70 || opcode > 0x77; // ld r, r / ld r, (hl), not ld (hl), r or halt
+	}
+	if (opcode >= 0x80 && opcode < 0xC0)
+	{
+		return true; // alu a, r / alu a, (hl)
+	}
+	if (opcode < 0x40 && opcode != 0x34 && opcode != 0x35 && opcode != 0x36)
+	{
+		const unsigned char z = opcode & 7;
+		return z == 3 || z == 4 || z == 5 || z == 6 || (opcode & 0xCF) == 0x01; // inc / dec, ld r, n, ld rr, nn
+	}
+	return (opcode & 0xC7) == 0xC6; // alu a, n
+}
+
+// whether [block] ends in a jump to its own entry and holds nothing but pollingOpcode()s before that
+bool CPU::isIdleLoop(const Block& block) const
+{
+	for (unsigned int i = 0; i + 1 < block.count; i++)
+	{
+		const unsigned short address = block.ops[i].address;
+		if (!pollingOpcode(read8(address), read8(address + 1)))
+		{
+			return false;
+		}
+	}
+
+	const unsigned short address = block.ops[block.count - 1].address;
+	const unsigned char opcode = read8(address);
+	if (opcode == 0x18 || opcode == 0x20 || opcode == 0x28 || opcode == 0x30 || opcode == 0x38)
+	{
+		return (unsigned short)(address + 2 + read8(address + 1)) == block.entry; // jr, jr cc
+	}
+	if (opcode == 0xC3 || (opcode & 0xC7) == 0xC2)
+	{
+		return (unsigned int)(((unsigned char)read8(address + 2) << 8) | (unsigned char)read8(address + 1)) == block.entry; // jp, jp cc
+	}
+	return false;
+}
+
+// The block to run at PC, NULL when the next instruction has to go through stepSwitch() instead:
+// tracing, profiling, breakpoints, a pending stop or a budget that ends inside the block
+CPU::Block* CPU::nextBlock()
+{
+	if (slowFetch)
+	{
+		return NULL;
+	}
+	if (blocks == NULL)
+	{
+		blocks = new Block[BLOCK_CACHE_SIZE];
+		flushBlocks();
+	}
+
+	Block& block = blocks[PC & (BLOCK_CACHE_SIZE - 1)];
+	if (block.entry != PC)
+	{
+		translateBlock(block);
+	}
+	// the other engines check the budget before every instruction, here only the last one of a block may go over it
+	if (block.count == 0 || remaining < block.count || cycles + block.cyclesBeforeLast >= cycleLimit)
+	{
+		return NULL;
+	}
+	return &block;
+}
+
+// cycles, R and the instruction budget are charged for the whole block up front
+const CPU::MicroOp* CPU::beginBlock(Block& block)
+{
+	remaining -= block.count - 1;
+	cycles += block.cycles;
+	R += block.refresh;
+	currentBlock = &block;
+	blockEnd = block.ops + block.count;
+	return block.ops;
+}
+
+// [op] is the first op that did not run
+void CPU::endBlock(Block& block, const MicroOp* op)
+{
+	currentBlock = NULL;
+	remaining--;
+
+	// the block overwrote one of its own instructions, give back what the ops after the store were charged
+	for (const MicroOp* end = block.ops + block.count; op < end; op++)
+	{
+		remaining++;
+		cycles -= op->cycles;
+		R -= op->refresh;
+	}
+}
+
+// runs a block through the handlers, runBlocks jumps between the opcode bodies instead when it can
+void CPU::executeBlock(Block& block)
+{
+	const MicroOp* op = beginBlock(block);
+	do
+	{
+		PC += op->skip;
+		(this->*op->handler)();
+	}
+	while (++op < blockEnd);
+	endBlock(block, op);
+}
+
+// Runs one iteration of an idle block. When it came back to the entry with every register as it found it, the iterations
+// after it are the same as long as memory and the ports stay the same, which only events can change, so they are passed
+// over in one go: as many as the engine would have started before the next deadline or the end of the budget
+// A loop that keeps changing registers (a delay or copy loop) runs as an ordinary block after IDLE_LOOP_TRIES of them
+void CPU::runIdleLoop(Block& block)
+{
+	const Registers before = getRegisters();
+	const unsigned long long startCycles = cycles;
+	const char startR = R;
+	executeBlock(block);
+	if (PC != block.entry)
+	{
+		return;
+	}
+	const Registers after = getRegisters();
+	if (after.AF != before.AF || after.BC != before.BC || after.DE != before.DE || after.HL != before.HL ||
+		after.IX != before.IX || after.IY != before.IY || after.SP != before.SP)
+	{
+		block.idleTries--;
+		return;
+	}
+	block.idleTries = IDLE_LOOP_TRIES;
+
+	const unsigned long long perIteration = cycles - startCycles;
+	if (cycles + block.cyclesBeforeLast >= cycleLimit)
+	{
+		return;
+	}
+	unsigned long long iterations = std::min(remaining / block.count, (cycleLimit - cycles - block.cyclesBeforeLast + perIteration - 1) / perIteration);
+	iterations = std::min(iterations, (~0ULL - cycles) / perIteration);
+	cycles += iterations * perIteration;
+	R += (char)(iterations * (unsigned char)(R - startR));
+	remaining -= iterations * block.count;
+	idleInstructions += iterations * block.count;
+}
+
+void CPU::translateBlock(Block& block)
+{
+	if (block.entry != NO_BLOCK)
+	{
+		dropBlock(block);
+	}
+
+	block.entry = PC;
+	block.count = 0;
+	block.cycles = 0;
+	block.refresh = 0;
+	block.cyclesBeforeLast = 0;
+	block.idleTries = 0;
+#ifdef Z80_JIT
+	block.hits = 0;
+	block.native = NULL;
+#endif
+
+	unsigned int address = PC;
+	unsigned int total = 0;
+	// stop short of the end of memory so no instruction reads past it
+	while (block.count < BLOCK_MAX_OPS && address <= 0xFFFF - 4)
+	{
+		const unsigned char opcode = read8(address);
+		MicroOp& op = block.ops[block.count];
+		op.address = address;
+		unsigned int length;
+		unsigned int cost;
+		bool ends;
+		switch (opcode)
+		{
+			case 0xCB:
+			{
+				const unsigned char next = read8(address + 1);
+				op.handler = cbTable[next];
+#ifdef Z80_THREADED_DISPATCH
+				op.label = blockLabels[0x100];
+#endif
+				op.skip = 2;
+				op.cycles = cyclesCB[next];
+				op.refresh = 2;
+				length = 2;
+				cost = op.cycles;
+				ends = false;
+				break;
+			}
+			case 0xED:
+			{
+				const unsigned char next = read8(address + 1);
+				op.handler = edTable[next];
+#ifdef Z80_THREADED_DISPATCH
+				op.label = blockLabels[0x100];
+#endif
+				op.skip = 2;
+				op.cycles = cyclesED[next];
+				op.refresh = 2;
+				length = extendedLength(next);
+				cost = op.cycles;
+				ends = extendedEndsBlock(next);
+				break;
+			}
+			case 0xDD:
+			case 0xFD:
+			{
+				// the prefix decoder adds its own cycles and R at run time
+				const unsigned char next = read8(address + 1);
+				op.handler = opTable[opcode];
+#ifdef Z80_THREADED_DISPATCH
+				op.label = blockLabels[opcode];
+#endif
+				op.skip = 0;
+				op.cycles = cyclesMain[opcode];
+				op.refresh = 1;
+				if (next == 0xCB)
+				{
+					length = 4;
+					cost = cyclesXYCB[(unsigned char)read8(address + 3)];
+					ends = false;
+				}
+				else
+				{
+					length = 1 + lengthMain[next] + (usesDisplacement(next) ? 1 : 0);
+					cost = cyclesXY[next];
+					ends = next == 0xDD || next == 0xED || next == 0xFD || mainEndsBlock(next);
+				}
+				break;
+			}
+			default:
+			{
+				op.handler = opTable[opcode];
+#ifdef Z80_THREADED_DISPATCH
+				op.label = blockLabels[opcode];
+#endif
+				op.skip = 0;
+				op.cycles = cyclesMain[opcode];
+				op.refresh = 1;
+				length = lengthMain[opcode];
+				cost = op.cycles;
+				ends = mainEndsBlock(opcode);
+				break;
+			}
+		}
+
+		block.cycles += op.cycles;
+		block.refresh += op.refresh;
+		block.cyclesBeforeLast = total;
+		total += cost;
+		block.count++;
+		address += length;
+		if (ends)
+		{
+			break;
+		}
+	}
+
+	if (block.count == 0)
+	{
+		block.entry = NO_BLOCK;
+		return;
+	}
+	block.end = address;
+	block.idleTries = isIdleLoop(block) ? IDLE_LOOP_TRIES : 0;
+	const unsigned short index = (unsigned short)(&block - blocks);
+	for (unsigned int page = block.entry >> CODE_PAGE_SHIFT; page <= (block.end - 1) >> CODE_PAGE_SHIFT; page++)
+	{
+		pageBlocks[page].push_back(index);
+		markCodePage(page);
+	}
+}
+
+// sets the bit of [page], and of the same page in every bank that maps the same memory
+void CPU::markCodePage(const unsigned int page)
+{
+	codePages[page >> 3] |= 1 << (page & 7);
+	if (banksAliased)
+	{
+		const unsigned int pagesPerBank = BANK_SIZE >> CODE_PAGE_SHIFT;
+		const unsigned int bank = page / pagesPerBank;
+		for (unsigned int other = 0; other < NUM_BANKS; other++)
+		{
+			if (other != bank && readBanks[other] == readBanks[bank])
+			{
+				const unsigned int mirror = other * pagesPerBank + page % pagesPerBank;
+				codePages[mirror >> 3] |= 1 << (mirror & 7);
+			}
+		}
+	}
+}
+
+// rebuilds the bits from the block lists and the shared pages after the mapping changed
+void CPU::updateCodePages()
+{
+	memset(codePages, 0, sizeof(codePages));
+	for (unsigned int page = 0; page < (0x10000 >> CODE_PAGE_SHIFT); page++)
+	{
+		if (!pageBlocks[page].empty() || isSharedPage(page))
+		{
+			markCodePage(page);
+		}
+	}
+}
+
+// Frees the entry of [block] and takes it off the lists of its pages, a page without blocks left stops being marked
+void CPU::dropBlock(Block& block)
+{
+	const unsigned short index = (unsigned short)(&block - blocks);
+	for (unsigned int page = block.entry >> CODE_PAGE_SHIFT; page <= (block.end - 1) >> CODE_PAGE_SHIFT; page++)
+	{
+		std::vector<unsigned short>& list = pageBlocks[page];
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			if (list[i] == index)
+			{
+				list[i] = list.back();
+				list.pop_back();
+				break;
+			}
+		}
+		// with aliased banks the bit may stand for a mirror too, updateCodePages clears it later
+		if (list.empty() && !banksAliased && !isSharedPage(page))
+		{
+			codePages[page >> 3] &= ~(1 << (page & 7));
+		}
+	}
+
+#ifdef Z80_JIT
+	if (block.native != NULL)
+	{
+		dropNative(block);
+	}
+#endif
+	block.entry = NO_BLOCK;
+	if (&block == currentBlock)
+	{
+		blockEnd = block.ops;
+	}
+}
+
+// Called by the store paths when [size] bytes from [address] were written to a marked page, wrapping at the end of memory
+// a bank that maps the same memory as another one gets the same bytes dropped at its own addresses
+void CPU::invalidateCode(const unsigned short address, const unsigned int size)
+{
+	unsharePages(address, size);
+	dropBlocks(address, size);
+	if (!banksAliased)
+	{
+		return;
+	}
+
+	unsigned int done = 0;
+	while (done < size)
+	{
+		const unsigned short start = address + done;
+		const unsigned int bank = start >> BANK_SHIFT;
+		const unsigned int length = std::min(size - done, (unsigned int)BANK_SIZE - (start & (BANK_SIZE - 1)));
+		for (unsigned int other = 0; other < NUM_BANKS; other++)
+		{
+			if (other != bank && readBanks[other] == readBanks[bank])
+			{
+				dropBlocks((other << BANK_SHIFT) | (start & (BANK_SIZE - 1)), length);
+			}
+		}
+		done += length;
+	}
+}
+
+// only the blocks on the lists of the written pages are looked at, those holding one of the bytes are dropped
+void CPU::dropBlocks(const unsigned short address, const unsigned int size)
+{
+	const unsigned int last = address + size - 1;
+	for (unsigned int wrapped = address >> CODE_PAGE_SHIFT; wrapped <= last >> CODE_PAGE_SHIFT; wrapped++)
+	{
+		const unsigned int page = wrapped & ((0x10000 >> CODE_PAGE_SHIFT) - 1);
+		std::vector<unsigned short>& list = pageBlocks[page];
+		for (size_t i = 0; i < list.size();)
+		{
+			Block& block = blocks[list[i]];
+			// a store that wraps around is checked as its two halves
+			const bool hit = (block.entry <= last && block.end > address) || (last > 0xFFFF && block.entry <= last - 0x10000);
+			if (hit)
+			{
+				// takes the block off this list too, the entry that moves into slot i is looked at next
+				dropBlock(block);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+}
+
+// for everything that writes memory outside of an instruction, like loading a ROM
+void CPU::flushBlocks()
+{
+	for (unsigned int page = 0; page < (0x10000 >> CODE_PAGE_SHIFT); page++)
+	{
+		pageBlocks[page].clear();
+	}
+	updateCodePages();
+	if (blocks != NULL)
+	{
+		for (unsigned int i = 0; i < BLOCK_CACHE_SIZE; i++)
+		{
+			blocks[i].entry = NO_BLOCK;
+		}
+	}
+	currentBlock = NULL;
+#ifdef Z80_JIT
+	flushJit();
+#endif
+}
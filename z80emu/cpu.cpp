@@ -1,4 +1,13 @@
 #include "cpu.h"
+#include "cycles.h"
+#include "flags.h"
+#include "hle.h"
+#include "mappedfile.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstring>
 
 // (~!GB) = not supported by GameBoy
 // ^^^ = check this
@@ -12,206 +21,459 @@ have a separate branch
 // change these to fit the system being emulated
 #define ROM_START 0x100
 #define MAX_ROM_SIZE 0x7FFF
-#define MEM_SIZE 65535
 #define PROGRAM_START 0
 #define SP_START 0xFFFE
 
-#define ADD true
-#define SUB false
-
 const std::string toHex(int);
 
 CPU::CPU()
 {
 	A = B = C = D = E = H = L = 0;
-	R = 0;
+	F = 0;
+	flagKind = FLAGS_NONE;
+	I = R = R7 = 0;
+	IXH = IXL = IYH = IYL = 0;
+	IFF1 = IFF2 = false;
+	interruptMode = 0;
+	halted = false;
+	interruptPending = nmiPending = false;
+	interruptBus = 0xFF;
+	eiCycles = ~0ULL;
+	idleInstructions = 0;
 	SP = SP_START;
-	PC = PROGRAM_START; 
-	mem = new char[MEM_SIZE];
+	PC = PROGRAM_START;
+	memset(ports, 0, NUM_PORTS);
+	trace = NULL;
+	profiler = NULL;
+	scheduler = NULL;
+	hleMode = HLE_OFF;
+	memset(&hleStats, 0, sizeof(hleStats));
+	bcallCheck = NULL;
+	blocks = NULL;
+	memset(codePages, 0, sizeof(codePages));
+	currentBlock = NULL;
+	blockEnd = NULL;
+
+	ram = new char[RAM_PAGES * BANK_SIZE](); // zeroed so that every run of the same ROM is reproducible
+	flash = NULL;
+	ownedFlash = NULL;
+	flashFile = NULL;
+	writeSink = new char[BANK_SIZE];
+	ramPages = RAM_PAGES;
+	flashPages = 0;
+	banksAliased = false;
+	unsharedPages = 0;
+	// without flash the banks are a flat 64 KB of RAM, set up front as well since mapBank looks at the other banks
+	for (unsigned char bank = 0; bank < NUM_BANKS; bank++)
+	{
+		bankPages[bank] = PAGE_RAM | bank;
+		bankReadOnly[bank] = false;
+		readBanks[bank] = writeBanks[bank] = ram + bank * BANK_SIZE;
+	}
+	for (unsigned char bank = 0; bank < NUM_BANKS; bank++)
+	{
+		mapBank(bank, PAGE_RAM | bank);
+	}
+#ifdef Z80_JIT
+	jitArena = NULL;
+	jitStart = jitUsed = 0;
+	jitUnavailable = false;
+	jitFlushed = false;
+	jitEnter = jitLeave = jitReturn = NULL;
+#endif
+	cycles = 0;
+	remaining = 0;
+	cycleLimit = 0;
+	stopReason = STOP_NONE;
+	ignoreBreakpoint = false;
+	clearBreakpoints();
 }
 
 CPU::~CPU()
 {
-	delete[] mem;
+	releaseFlash();
+	delete[] ram;
+	delete[] writeSink;
+	delete[] blocks;
+	dropBCallCheck();
+#ifdef Z80_JIT
+	freeJit();
+#endif
 }
 
-void CPU::updateCarry(short reg)
+// The prefix decoders are responsible for moving PC past the whole prefixed instruction
+// DD / FD only move PC to the opcode after the prefix, the hl opcode bodies instantiated for IX / IY do the rest
+void CPU::decodeIXInstruction(char opcode)
 {
-	F |= (reg > 0xFF || reg < 0x00) ? 0x1 : F;
+	const unsigned char op = opcode;
+	R++;
+	cycles += cyclesXY[op];
+	PC++;
+	executeIndexed<INDEX_IX>(op);
 }
 
-void CPU::resetCarry()
+void CPU::decodeIYInstruction(char opcode)
 {
-	F &= 0xFE;
+	const unsigned char op = opcode;
+	R++;
+	cycles += cyclesXY[op];
+	PC++;
+	executeIndexed<INDEX_IY>(op);
 }
 
-void CPU::setCarry()
+// 8 bit ALU
+// These only record what the operation was, F is built from the record when something reads it (see computeFlags)
+void CPU::lazyFlags(unsigned char kind, unsigned char op1, unsigned char op2, unsigned short result)
 {
-	F |= 0x1;
+	flagKind = kind;
+	flagOp1 = op1;
+	flagOp2 = op2;
+	flagResult = result;
 }
 
-// ^^^
-void CPU::updateHC(short reg)
+void CPU::add8(const unsigned char val)
 {
-	F |= (reg > 0xF) ? 0x10 : F;
+	const unsigned short result = (unsigned char)A + val;
+	lazyFlags(FLAGS_ADD, A, val, result);
+	A = (char)result;
 }
 
-void CPU::resetHC()
+void CPU::adc8(const unsigned char val)
 {
-	F &= 0xEF;
+	const unsigned short result = (unsigned char)A + val + carry();
+	lazyFlags(FLAGS_ADD, A, val, result);
+	A = (char)result;
 }
 
-void CPU::setHC()
+void CPU::sub8(const unsigned char val)
 {
-	F |= 0x10;
+	const unsigned short result = ((unsigned char)A - val) & 0x1FF; // a borrow sets bit 8
+	lazyFlags(FLAGS_SUB, A, val, result);
+	A = (char)result;
 }
 
-void CPU::updateN(bool add)
+void CPU::sbc8(const unsigned char val)
 {
-	if (add) { F |= 0x2; }
-	else { F &= 0xFD; }
+	const unsigned short result = ((unsigned char)A - val - carry()) & 0x1FF;
+	lazyFlags(FLAGS_SUB, A, val, result);
+	A = (char)result;
 }
 
-void CPU::resetN()
+void CPU::and8(const unsigned char val)
 {
-	F &= 0xFD;
+	A &= val;
+	lazyFlags(FLAGS_AND, 0, 0, (unsigned char)A);
 }
 
-void CPU::setN()
+void CPU::xor8(const unsigned char val)
 {
-	F |= 0x2;
+	A ^= val;
+	lazyFlags(FLAGS_LOGIC, 0, 0, (unsigned char)A);
 }
 
-void CPU::updateOverflow(short reg)
+void CPU::or8(const unsigned char val)
 {
-	F |= (reg & 0x80) ? 0x4 : F;
+	A |= val;
+	lazyFlags(FLAGS_LOGIC, 0, 0, (unsigned char)A);
 }
 
-void CPU::resetOverflow()
-{	
-	F &= 0xFB;
+void CPU::cmp(const unsigned char val)
+{
+	lazyFlags(FLAGS_SUB, A, val, ((unsigned char)A - val) & 0x1FF);
 }
 
-void CPU::setOverflow()
+// inc and dec leave the carry alone, it is kept in bit 8 of the result like for the other operations
+unsigned char CPU::inc8(const unsigned char val)
 {
-	F |= 0x4;
+	const unsigned char result = val + 1;
+	lazyFlags(FLAGS_INC, val, 0, result | (carry() << 8));
+	return result;
 }
 
-void CPU::updateParity(char reg)
+unsigned char CPU::dec8(const unsigned char val)
 {
-	bool parity =
-		(((reg * 0x0101010101010101ULL) & 0x8040201008040201ULL) % 0x1FF) & 1; // https://graphics.stanford.edu/~seander/bithacks.html#ParityNaive 
-																				// (uses Compute parity of a byte using 64-bit multiply and modulus division)
-	F |= (!parity) ? 0x4 : F;
+	const unsigned char result = val - 1;
+	lazyFlags(FLAGS_DEC, val, 0, result | (carry() << 8));
+	return result;
 }
 
-void CPU::resetParity()
+// All of F is one table load, the carry into adc / sbc is recovered from the recorded result
+unsigned char CPU::computeFlags() const
 {
-	F &= 0xFB;
+	switch (flagKind)
+	{
+		case FLAGS_ADD:
+		{
+			return flagTables.add[(flagResult - flagOp1 - flagOp2) & 1][flagOp1][flagOp2];
+		}
+		case FLAGS_SUB:
+		{
+			return flagTables.sub[(flagOp1 - flagOp2 - flagResult) & 1][flagOp1][flagOp2];
+		}
+		case FLAGS_INC:
+		{
+			return flagTables.inc[flagOp1] | ((flagResult >> 8) & FLAG_C);
+		}
+		case FLAGS_DEC:
+		{
+			return flagTables.dec[flagOp1] | ((flagResult >> 8) & FLAG_C);
+		}
+		case FLAGS_AND:
+		{
+			return flagTables.szp[flagResult & 0xFF] | FLAG_H;
+		}
+		case FLAGS_LOGIC:
+		{
+			return flagTables.szp[flagResult & 0xFF] | ((flagResult >> 8) & FLAG_C);
+		}
+	}
+	return F;
 }
 
-void CPU::setParity()
+// add hl, rr: sign, zero and parity are left alone, the half carry comes out of bit 11
+template<unsigned char index> void CPU::add16(const unsigned short val)
 {
-	F |= 0x4;
+	const unsigned int hl = (unsigned short)regHL<index>();
+	const unsigned int result = hl + val;
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | (((hl ^ val ^ result) >> 8) & FLAG_H) | (result >> 16));
+	regHL<index>(result);
 }
 
-void CPU::updateSign(short reg)
+template<unsigned char index> signed char& CPU::regH()
 {
-	F |= reg & 0x80;
+	switch (index)
+	{
+		case INDEX_HL: return H;
+		case INDEX_IX: return IXH;
+		default: return IYH;
+	}
 }
 
-void CPU::resetSign()
+template<unsigned char index> signed char& CPU::regL()
 {
-	F &= 0x7F;
+	switch (index)
+	{
+		case INDEX_HL: return L;
+		case INDEX_IX: return IXL;
+		default: return IYL;
+	}
 }
 
-void CPU::setSign()
+template<unsigned char index> short CPU::regHL()
 {
-	F |= 0x80;
+	return ((regH<index>() << 8) | (regL<index>() & 0xFF));
 }
 
-void CPU::updateZero(short reg)
+template<unsigned char index> void CPU::regHL(const signed short val)
 {
-	F |= (!reg) ? 0x40 : F;
+	regH<index>() = ((val >> 8) & 0xFF);
+	regL<index>() = (char)val;
 }
 
-void CPU::resetZero()
+template<unsigned char index> unsigned short CPU::addrHL()
 {
-	F &= 0xBF;
+	if (index == INDEX_HL)
+	{
+		return regHL<index>();
+	}
+	return regHL<index>() + (signed char)read8(PC + 1);
 }
 
-void CPU::setZero()
+void CPU::daa()
 {
-	F |= 0x40;
+	const unsigned char a = A;
+	const unsigned char f = getF();
+	unsigned char correction = 0;
+	unsigned char carryOut = f & FLAG_C;
+	if ((f & FLAG_H) || (a & 0xF) > 9)
+	{
+		correction |= 0x06;
+	}
+	if (carryOut || a > 0x99)
+	{
+		correction |= 0x60;
+		carryOut = FLAG_C;
+	}
+
+	unsigned char halfCarry;
+	if (f & FLAG_N)
+	{
+		halfCarry = ((f & FLAG_H) && (a & 0xF) < 6) ? FLAG_H : 0;
+		A = a - correction;
+	}
+	else
+	{
+		halfCarry = ((a & 0xF) > 9) ? FLAG_H : 0;
+		A = a + correction;
+	}
+	setF(flagTables.szp[(unsigned char)A] | halfCarry | (f & FLAG_N) | carryOut);
 }
 
-void CPU::decodeIXInstruction(char opcode)
+void CPU::syncFlags()
 {
+	if (flagKind != FLAGS_NONE)
+	{
+		F = computeFlags();
+		flagKind = FLAGS_NONE;
+	}
+}
 
+unsigned char CPU::getF()
+{
+	syncFlags();
+	return F;
 }
 
-void CPU::decodeIYInstruction(char opcode)
+void CPU::setF(const unsigned char val)
 {
+	F = val;
+	flagKind = FLAGS_NONE;
+}
 
+const short CPU::load16()
+{
+	return ((read8(PC + 2) << 8) | (read8(PC + 1) & 0xFF));
 }
 
-void CPU::decodeExtendedInstruction(char opcode)
+const short CPU::get16()
 {
+	return ((read8(PC + 2) << 8) | (read8(PC + 1) & 0xFF));
+}
 
+const short CPU::get16(const short where)
+{
+	return ((read8(where + 2) << 8) | (read8(where + 1) & 0xFF));
 }
 
-void CPU::decodeBitInstruction(char opcode)
+void CPU::set16(unsigned short& dst, const short val)
 {
+	dst = (val << 8) | (val & 0xFF);
+}
 
+// waits for an interrupt when one can come, run() idles until then, and ends the run otherwise
+void CPU::halt()
+{
+	if ((IFF1 && interruptPending) || (scheduler && scheduler->next() != NO_DEADLINE))
+	{
+		halted = true;
+		cycleLimit = cycles;
+	}
+	else
+	{
+		stop(STOP_HALT);
+	}
 }
 
-void CPU::cmp(const char val)
+// ei, the interrupt waiting for it is taken once the next instruction is done
+void CPU::enableInterrupts()
 {
-	updateCarry(A - val);
-	updateN(SUB);
-	updateOverflow(A - val);
-	updateHC(A - val);
-	updateZero(A - val);
-	updateSign(A - val);
+	IFF1 = IFF2 = true;
+	eiCycles = cycles;
+	if (interruptPending)
+	{
+		cycleLimit = std::min(cycleLimit, cycles + 1);
+	}
 }
 
-const short CPU::load16()
+void CPU::requestInterrupt(unsigned char bus)
 {
-	return ((mem[PC + 2] << 8) | (mem[PC + 1] & 0xFF));
+	interruptPending = true;
+	interruptBus = bus;
 }
 
-const short CPU::get16()
+void CPU::cancelInterrupt()
 {
-	return ((mem[PC + 2] << 8) | (mem[PC + 1] & 0xFF));
+	interruptPending = false;
 }
 
-const short CPU::get16(const short where)
+void CPU::requestNMI()
 {
-	return ((mem[where + 2] << 8) | (mem[where + 1] & 0xFF));
+	nmiPending = true;
 }
 
-void CPU::set16(unsigned short& dst, const short val)
+// called by run() between two instructions with an interrupt pending
+void CPU::interrupt()
 {
-	dst = (val << 8) | (val & 0xFF);
+	if (nmiPending)
+	{
+		nmiPending = false;
+		IFF1 = false;
+		enterInterrupt(0x66, CYCLES_NMI);
+		return;
+	}
+	if (!IFF1)
+	{
+		return;
+	}
+	if (cycles == eiCycles)
+	{
+		// the instruction after ei first
+		cycleLimit = std::min(cycleLimit, cycles + 1);
+		return;
+	}
+
+	interruptPending = false;
+	IFF1 = IFF2 = false;
+	switch (interruptMode)
+	{
+		case 0:
+		{
+			enterInterrupt(((interruptBus & 0xC7) == 0xC7) ? (interruptBus & 0x38) : 0x38, CYCLES_IM0);
+			break;
+		}
+		case 2:
+		{
+			enterInterrupt(read16((unsigned short)(((unsigned char)I << 8) | interruptBus)), CYCLES_IM2);
+			break;
+		}
+		default:
+		{
+			enterInterrupt(0x38, CYCLES_IM1);
+			break;
+		}
+	}
 }
 
-void CPU::halt()
+// pushes PC and jumps to the handler, the acknowledge cycle is an opcode fetch that counts in R
+void CPU::enterInterrupt(const unsigned short address, const unsigned char cyclesTaken)
 {
+	if (profiler)
+	{
+		profiler->interrupt(PC, SP, address, cycles);
+	}
+	halted = false;
+	R++;
+	cycles += cyclesTaken;
+	SP -= 2;
+	write16(SP, PC);
+	PC = address;
+}
 
+// a halted CPU runs NOPs until the next deadline, all of them at once
+void CPU::idle()
+{
+	if (cycles >= cycleLimit)
+	{
+		return;
+	}
+	const unsigned long long nops = std::min(remaining, (cycleLimit - cycles + CYCLES_HALTED - 1) / CYCLES_HALTED);
+	cycles += nops * CYCLES_HALTED;
+	R += (char)nops;
+	remaining -= nops;
+	idleInstructions += nops;
 }
 
 void CPU::ret(bool cond)
 {
 	if (cond)
 	{
-		PC = mem[SP] << 8;
-		SP++;
-		PC |= mem[SP] & 0xFF;
-		SP++;
+		cycles += CYCLES_RET_TAKEN;
+		PC = read16(SP);
+		SP += 2;
 	}
 	else
 	{
-		PC += 3;
+		PC++;
 	}
 }
 /*
@@ -227,10 +489,12 @@ void CPU::call(bool cond)
 {
 	if (cond)
 	{
+		cycles += CYCLES_CALL_TAKEN;
+		// + 3 is for jumping past the 3 bytes for the opcode and dest, pushed high byte first like push
 		SP--;
-		mem[SP] = (PC + 3) & 0xFF; // + 3 is for jumping past the 3 bytes for the opcode and dest
+		write8(SP, ((PC + 3) >> 8));
 		SP--;
-		mem[SP] = (((PC + 3) >> 8));
+		write8(SP, (PC + 3) & 0xFF);
 		PC = get16();
 	}
 	else
@@ -241,7 +505,15 @@ void CPU::call(bool cond)
 
 void CPU::rst(unsigned char mode)
 {
-	mem[SP] = PC + 1;
+	// B_CALL, the routine address follows the rst
+	if (mode == 0x28 && hleMode != HLE_OFF && nativeBCall())
+	{
+		return;
+	}
+	SP--;
+	write8(SP, (PC + 1) >> 8);
+	SP--;
+	write8(SP, (PC + 1) & 0xFF);
 	PC = mode;
 }
 
@@ -250,6 +522,7 @@ void CPU::rst(unsigned char mode)
 void CPU::jr(bool cond, signed char to, unsigned char opsize)
 {
 	PC += (cond) ? to + 2 : opsize; // the + 2 is to jump past the initial instruction
+	cycles += cond * CYCLES_JR_TAKEN;
 }
 
 void CPU::jp(bool cond, signed short to, unsigned char opsize)
@@ -267,18 +540,19 @@ void CPU::jp(bool cond, signed short to, unsigned char opsize)
 void CPU::test()
 {
 	std::string testROM = "test.bin";
-	loadROM(testROM);
-	for (int i = 0; i < 100; i++)
+	const LoadResult loaded = loadROM(testROM);
+	if (loaded != LOAD_OK)
 	{
-		//std::cout << PC << std::endl;
-		emulateCycle();
+		std::cout << "Unable to load " << testROM << ": " << loadResultText(loaded) << std::endl;
+		return;
 	}
+	run(100);
 	// 8198 = 0x2006
 	std::cout << std::endl;
 	/*
 	for (int i = 0; i < testROM.size(); i++)
 	{
-		char opcode = mem[i];
+		char opcode = read8(i);
 		std::cout << toHex((int)opcode) << std::endl;
 	}
 	*/
@@ -287,2087 +561,1036 @@ void CPU::test()
 	std::cout << "C: " << (int)C << std::endl;
 	std::cout << "D: " << (int)D << std::endl;
 	std::cout << "E: " << (int)E << std::endl;
-	std::cout << "F: " << toHex(F) << std::endl;
+	std::cout << "F: " << toHex(getF()) << std::endl;
 	std::cout << "AF: " << AF() << std::endl;
 	std::cout << "BC: " << BC() << std::endl;
 	std::cout << "DE: " << DE() << std::endl;
 	std::cout << "HL: " << HL() << std::endl;
 }
 
-void CPU::emulateCycle()
+// Every engine below is generated from opcodes.inl so they always execute the exact same opcode bodies
+// OPCODE_TABLE(X) expands X over every opcode in order: X(0x00), X(0x01), ..., X(0xFF)
+#define OPCODE_ROW(X, r) \
+	X(0x##r##0), X(0x##r##1), X(0x##r##2), X(0x##r##3), X(0x##r##4), X(0x##r##5), X(0x##r##6), X(0x##r##7), \
+	X(0x##r##8), X(0x##r##9), X(0x##r##A), X(0x##r##B), X(0x##r##C), X(0x##r##D), X(0x##r##E), X(0x##r##F)
+#define OPCODE_TABLE(X) \
+	OPCODE_ROW(X, 0), OPCODE_ROW(X, 1), OPCODE_ROW(X, 2), OPCODE_ROW(X, 3), \
+	OPCODE_ROW(X, 4), OPCODE_ROW(X, 5), OPCODE_ROW(X, 6), OPCODE_ROW(X, 7), \
+	OPCODE_ROW(X, 8), OPCODE_ROW(X, 9), OPCODE_ROW(X, A), OPCODE_ROW(X, B), \
+	OPCODE_ROW(X, C), OPCODE_ROW(X, D), OPCODE_ROW(X, E), OPCODE_ROW(X, F)
+
+// one handler per opcode for the table engine
+#define OPCODE(n) template<> void CPU::executeOpcode<n>()
+#define END_OPCODE
+#define INDEX_REG INDEX_HL
+#include "opcodes.inl"
+#undef OPCODE
+#undef END_OPCODE
+#undef INDEX_REG
+
+#define OPCODE_HANDLER(n) &CPU::executeOpcode<n>
+const CPU::OpHandler CPU::opTable[256] = { OPCODE_TABLE(OPCODE_HANDLER) };
+#undef OPCODE_HANDLER
+
+// CB prefix: every opcode is xxyyyzzz with x = operation group, y = operation or bit, z = register
+// Each handler is the same template instantiated for its opcode so all of the decoding happens at compile time
+// DD CB / FD CB put the displacement before the opcode and always work on (ix + d) / (iy + d)
+template<unsigned char index> void CPU::decodeBitInstruction()
+{
+	if (index == INDEX_HL)
+	{
+		const unsigned char op = read8(PC + 1);
+		R++;
+		cycles += cyclesCB[op];
+		(this->*cbTable[op])();
+		PC += 2;
+	}
+	else
+	{
+		const unsigned char op = read8(PC + 2);
+		cycles += cyclesXYCB[op];
+		(this->*indexedCBTable[op])(addrHL<index>());
+		PC += 3;
+	}
+}
+
+// 8 bit register operands in opcode order: b, c, d, e, h, l, (hl), a
+template<unsigned char reg> unsigned char CPU::getReg()
+{
+	switch (reg)
+	{
+		case 0: return B;
+		case 1: return C;
+		case 2: return D;
+		case 3: return E;
+		case 4: return H;
+		case 5: return L;
+		case 6: return read8(addrHL<INDEX_HL>());
+		default: return A;
+	}
+}
+
+template<unsigned char reg> void CPU::setReg(const unsigned char val)
+{
+	switch (reg)
+	{
+		case 0: B = val; break;
+		case 1: C = val; break;
+		case 2: D = val; break;
+		case 3: E = val; break;
+		case 4: H = val; break;
+		case 5: L = val; break;
+		case 6: write8(addrHL<INDEX_HL>(), val); break;
+		default: A = val; break;
+	}
+}
+
+// rlc, rrc, rl, rr, sla, sra, sll (undocumented), srl
+// the bit shifted out goes to the carry, everything else is the same as for a logical operation
+template<unsigned char operation> unsigned char CPU::shift(const unsigned char val)
+{
+	unsigned char result;
+	unsigned char carryOut;
+	switch (operation)
+	{
+		case 0: result = (val << 1) | (val >> 7); carryOut = val >> 7; break;
+		case 1: result = (val >> 1) | (val << 7); carryOut = val & 1; break;
+		case 2: result = (val << 1) | carry(); carryOut = val >> 7; break;
+		case 3: result = (val >> 1) | (carry() << 7); carryOut = val & 1; break;
+		case 4: result = val << 1; carryOut = val >> 7; break;
+		case 5: result = (val >> 1) | (val & 0x80); carryOut = val & 1; break;
+		case 6: result = (val << 1) | 1; carryOut = val >> 7; break;
+		default: result = val >> 1; carryOut = val & 1; break;
+	}
+	lazyFlags(FLAGS_LOGIC, 0, 0, result | (carryOut << 8));
+	return result;
+}
+
+// bit n: zero (and parity, undocumented) when the bit is clear, sign only for a set bit 7, the carry is kept
+template<unsigned char bit> void CPU::testBit(const unsigned char val)
+{
+	const unsigned char flags = (val & (1 << bit)) ? (val & (1 << bit) & FLAG_S) : (FLAG_Z | FLAG_PV);
+	setF(flags | FLAG_H | carry());
+}
+
+template<unsigned char opcode> void CPU::executeCB()
+{
+	const unsigned char group = opcode >> 6;
+	const unsigned char y = (opcode >> 3) & 7;
+	const unsigned char reg = opcode & 7;
+	switch (group)
+	{
+		case 0: setReg<reg>(shift<y>(getReg<reg>())); break;
+		case 1: testBit<y>(getReg<reg>()); break;
+		case 2: setReg<reg>(getReg<reg>() & ~(1 << y)); break;
+		default: setReg<reg>(getReg<reg>() | (1 << y)); break;
+	}
+}
+
+#define CB_HANDLER(n) &CPU::executeCB<n>
+const CPU::OpHandler CPU::cbTable[256] = { OPCODE_TABLE(CB_HANDLER) };
+#undef CB_HANDLER
+
+// the result of a DD CB / FD CB shift or res / set is also copied to the register in the opcode (undocumented),
+// except for (hl) which only writes memory
+template<unsigned char opcode> void CPU::executeIndexedCB(const unsigned short address)
+{
+	const unsigned char group = opcode >> 6;
+	const unsigned char y = (opcode >> 3) & 7;
+	const unsigned char reg = opcode & 7;
+	const unsigned char val = read8(address);
+	unsigned char result;
+	switch (group)
+	{
+		case 0: result = shift<y>(val); break;
+		case 1: testBit<y>(val); return;
+		case 2: result = val & ~(1 << y); break;
+		default: result = val | (1 << y); break;
+	}
+	write8(address, result);
+	if (reg != 6)
+	{
+		setReg<reg>(result);
+	}
+}
+
+#define INDEXED_CB_HANDLER(n) &CPU::executeIndexedCB<n>
+const CPU::IndexedCBHandler CPU::indexedCBTable[256] = { OPCODE_TABLE(INDEXED_CB_HANDLER) };
+#undef INDEXED_CB_HANDLER
+
+// DD / FD prefix: the same opcode bodies as the unprefixed instructions, instantiated for IX / IY
+template<unsigned char index> void CPU::executeIndexed(unsigned char opcode)
 {
-	unsigned char opcode = mem[PC];
-	R++; // I think this is what R does
-	std::cout << toHex((int)opcode) << "\tat " << toHex((int)PC) << std::endl;
-	//std::cout << toHex(PC) << std::endl;
 	switch (opcode)
 	{
-		// increment PC by size (in bytes) of opcode
+#define OPCODE(n) case n:
+#define END_OPCODE break;
+#define INDEX_REG index
+#include "opcodes.inl"
+#undef OPCODE
+#undef END_OPCODE
+#undef INDEX_REG
+	}
+}
 
-		case 0x00: // NOP
-		{
-			PC++;
-			break;
-		}
-		case 0x01: // ld BC, **
-		{
-			//const short val = (mem[PC] << 8) | (mem[PC + 1] & 0xFF);
-			BC(load16());
-			PC += 3;
-			break;
-		}
-		case 0x02: // ld (BC), a
-		{
-			mem[BC()] = A;
-			PC++;
-			break;
-		}
-		case 0x03: // inc BC
-		{
-			char bc = BC();
-			BC(bc + 1);
-			PC++;
-			break;
-		}
-		case 0x04: // inc b
+// ED prefix
+// PC is moved past the two opcode bytes before the handler runs so that handlers with an immediate read it at PC,
+// jumps (retn / reti) can just set PC and the repeating block instructions step back with PC -= 2
+void CPU::decodeExtendedInstruction(char opcode)
+{
+	const unsigned char op = opcode;
+	R++;
+	cycles += cyclesED[op];
+	PC += 2;
+	(this->*edTable[op])();
+}
+
+// 16 bit register pairs in opcode order: bc, de, hl, sp
+template<unsigned char pair> unsigned short CPU::getPair()
+{
+	switch (pair)
+	{
+		case 0: return BC();
+		case 1: return DE();
+		case 2: return HL();
+		default: return SP;
+	}
+}
+
+template<unsigned char pair> void CPU::setPair(const unsigned short val)
+{
+	switch (pair)
+	{
+		case 0: BC(val); break;
+		case 1: DE(val); break;
+		case 2: HL(val); break;
+		default: SP = val; break;
+	}
+}
+
+unsigned short CPU::read16(const unsigned short where)
+{
+	return ((unsigned char)read8((unsigned short)(where + 1)) << 8) | (unsigned char)read8(where);
+}
+
+void CPU::write16(const unsigned short where, const unsigned short val)
+{
+	write8(where, (unsigned char)val);
+	write8(where + 1, val >> 8);
+}
+
+// [count] bytes from [address] through [banks] as one pointer, NULL when they are not all in the same bank
+char* CPU::bankPointer(char* const* banks, const unsigned short address, const unsigned int count) const
+{
+	if ((address & (BANK_SIZE - 1)) + count > BANK_SIZE)
+	{
+		return NULL;
+	}
+	return banks[address >> BANK_SHIFT] + (address & (BANK_SIZE - 1));
+}
+
+// Points [bank] at [page], PAGE_RAM selects RAM instead of flash (always RAM until there is flash)
+// only the page-pointer tables change, the code cached for the old page is dropped
+void CPU::mapBank(const unsigned char bank, const unsigned char page)
+{
+	const bool isRAM = flash == NULL || (page & PAGE_RAM) != 0;
+	const unsigned int pages = isRAM ? ((flash == NULL) ? RAM_PAGES : ramPages) : flashPages;
+	char* const memory = (isRAM ? ram : flash) + ((page & ~PAGE_RAM) % pages) * BANK_SIZE;
+	dropBlocks(bank << BANK_SHIFT, BANK_SIZE);
+
+	bankPages[bank] = page;
+	bankReadOnly[bank] = !isRAM;
+	readBanks[bank] = memory;
+	writeBanks[bank] = isRAM ? memory : writeSink;
+
+	const bool wasAliased = banksAliased;
+	banksAliased = false;
+	for (unsigned int i = 0; i < NUM_BANKS; i++)
+	{
+		for (unsigned int j = i + 1; j < NUM_BANKS; j++)
 		{
-			B++;
-			updateN(ADD);
-			updateOverflow(B);
-			updateHC(B);
-			updateZero(B);
-			updateSign(B);
-			PC++;
-			break;
+			banksAliased |= readBanks[i] == readBanks[j];
 		}
-		case 0x05: // dec b
+	}
+	if (banksAliased || wasAliased)
+	{
+		updateCodePages();
+		return;
+	}
+	// the blocks of the bank are gone, the bits that are left belong to pages shared with a snapshot
+	const unsigned int pagesPerBank = BANK_SIZE >> CODE_PAGE_SHIFT;
+	for (unsigned int page = bank * pagesPerBank; page < (bank + 1) * pagesPerBank; page++)
+	{
+		if (isSharedPage(page))
 		{
-			B--;
-			updateN(SUB);
-			updateOverflow(B);
-			updateHC(B);
-			updateZero(B);
-			updateSign(B);
-			PC++;
-			break;
+			codePages[page >> 3] |= 1 << (page & 7);
 		}
-		case 0x06: // ld b, *
+		else
 		{
-			B = mem[PC + 1];
-			PC += 2;
-			break;
+			codePages[page >> 3] &= ~(1 << (page & 7));
 		}
-		case 0x07: // rlca
+	}
+}
+
+unsigned char CPU::readPort(const unsigned char port)
+{
+	return ports[port];
+}
+
+void CPU::writePort(const unsigned char port, const unsigned char val)
+{
+	ports[port] = val;
+	// TI-83 Plus paging, only once there is flash to page in
+	if (flash != NULL && (port == PORT_BANK_A || port == PORT_BANK_B))
+	{
+		mapBank(1 + port - PORT_BANK_A, val);
+	}
+}
+
+void CPU::adc16(const unsigned short val)
+{
+	const unsigned int hl = (unsigned short)HL();
+	const unsigned int result = hl + val + carry();
+	setF(((result >> 8) & FLAG_S) | ((result & 0xFFFF) ? 0 : FLAG_Z) | (((hl ^ val ^ result) >> 8) & FLAG_H) |
+		((((hl ^ result) & (val ^ result)) >> 13) & FLAG_PV) | (result >> 16));
+	HL(result);
+}
+
+void CPU::sbc16(const unsigned short val)
+{
+	const unsigned int hl = (unsigned short)HL();
+	const unsigned int result = (hl - val - carry()) & 0x1FFFF;
+	setF(((result >> 8) & FLAG_S) | ((result & 0xFFFF) ? 0 : FLAG_Z) | (((hl ^ val ^ result) >> 8) & FLAG_H) |
+		((((hl ^ val) & (hl ^ result)) >> 13) & FLAG_PV) | FLAG_N | (result >> 16));
+	HL(result);
+}
+
+// How many iterations of a repeating block instruction can run natively right now
+// Tracing, breakpoints and pending stops need to see every iteration, otherwise the iterations are only limited
+// by the instruction and cycle budget of the run, every iteration counts as one instruction
+unsigned int CPU::blockIterations(unsigned int count, const unsigned int cyclesPerIteration)
+{
+	if (slowFetch)
+	{
+		return 1;
+	}
+	if (count > remaining)
+	{
+		count = (unsigned int)remaining;
+	}
+	// the run ends after the first iteration that reaches the cycle limit, cycles already holds the first iteration
+	const unsigned long long start = cycles + CYCLES_BLOCK_REPEAT - cyclesPerIteration;
+	if (cycleLimit != ~0ULL)
+	{
+		const unsigned long long fit = (cycleLimit - start + cyclesPerIteration - 1) / cyclesPerIteration;
+		if (fit < count)
 		{
-			A <<= 1;
-			updateCarry(A);
-			resetN();
-			resetHC();
-			PC++;
-			break;
+			count = (fit > 0) ? (unsigned int)fit : 1;
 		}
-		case 0x08: // ex af, af' (~!GB)
+	}
+	return count;
+}
+
+// Cuts [count] iterations that store from [dst] by [step] after the first one that overwrites the instruction itself,
+// the iteration after it has to fetch the new bytes
+unsigned int CPU::beforeOwnBytes(unsigned int count, const unsigned short dst, const int step) const
+{
+	for (unsigned short at = PC - 2; at != PC; at++)
+	{
+		const unsigned int reach = (unsigned short)((step > 0) ? at - dst : dst - at);
+		if (reach < count)
 		{
-			PC++;
-			break;
+			count = reach + 1;
 		}
-		case 0x09: // add hl, bc
+	}
+	return count;
+}
+
+// Accounts for [count] iterations of a block instruction, the dispatcher has only counted the first one
+void CPU::finishBlock(const unsigned int count, const unsigned char baseCycles, const bool repeating)
+{
+	remaining -= count - 1;
+	R += 2 * (count - 1);
+	cycles += (unsigned long long)(count - 1) * baseCycles + (repeating ? count : count - 1) * CYCLES_BLOCK_REPEAT;
+	if (repeating)
+	{
+		PC -= 2;
+	}
+}
+
+// ldi, ldd, ldir, lddr
+template<int step, bool repeat> void CPU::blockLoad()
+{
+	const unsigned short bc = BC();
+	const unsigned short src = HL();
+	const unsigned short dst = DE();
+	const unsigned int count = repeat ? beforeOwnBytes(blockIterations(bc ? bc : 0x10000, 16 + CYCLES_BLOCK_REPEAT), dst, step) : 1;
+
+	// a byte by byte copy is only the same as memmove when the destination does not run into bytes that are still to be read,
+	// ldir with de = hl + 1 is the usual way to fill memory and needs the byte by byte copy
+	const unsigned short srcLow = (step > 0) ? src : src - (count - 1);
+	const unsigned short dstLow = (step > 0) ? dst : dst - (count - 1);
+	const bool wraps = (unsigned int)srcLow + count > 0x10000 || (unsigned int)dstLow + count > 0x10000;
+	const unsigned short ahead = (step > 0) ? (unsigned short)(dst - src) : (unsigned short)(src - dst);
+	// memmove needs each side inside one bank, and two banks that map the same page overlap in ways ahead does not see
+	char* const from = bankPointer(readBanks, srcLow, count);
+	char* const to = bankPointer(writeBanks, dstLow, count);
+	const bool aliased = (srcLow >> BANK_SHIFT) != (dstLow >> BANK_SHIFT) && readBanks[srcLow >> BANK_SHIFT] == readBanks[dstLow >> BANK_SHIFT];
+	if (count > 1 && !wraps && from != NULL && to != NULL && !aliased && (ahead == 0 || ahead >= count))
+	{
+		memmove(to, from, count);
+	}
+	else
+	{
+		for (unsigned int i = 0; i < count; i++)
 		{
-			const short hl = HL();
-			HL(BC() + hl);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(HL());
-			PC++;
-			break;
+			store8(dst + i * step, read8(src + i * step));
 		}
-		case 0x0A: // ld a, (BC)
+	}
+	invalidateCode(dstLow, count);
+
+	HL(src + count * step);
+	DE(dst + count * step);
+	BC(bc - count);
+	const bool more = BC() != 0;
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_C)) | (more ? FLAG_PV : 0));
+	finishBlock(count, 16, repeat && more);
+}
+
+// cpi, cpd, cpir, cpdr
+template<int step, bool repeat> void CPU::blockCompare()
+{
+	const unsigned short bc = BC();
+	const unsigned int count = repeat ? blockIterations(bc ? bc : 0x10000, 16 + CYCLES_BLOCK_REPEAT) : 1;
+	const unsigned short src = HL();
+	const unsigned char a = A;
+
+	// iterations until a match (including the matching one) or count
+	unsigned int done = count;
+	const char* const from = bankPointer(readBanks, src, count);
+	if (step > 0 && from != NULL)
+	{
+		const void* match = memchr(from, a, count);
+		if (match)
 		{
-			A = mem[BC()];
-			PC++;
-			break;
+			done = (unsigned int)((const char*)match - from) + 1;
 		}
-		case 0x0B: // dec BC
+	}
+	else
+	{
+		for (unsigned int i = 0; i < count; i++)
 		{
-			char bc = BC();
-			BC(bc - 1);
-			PC++;
-			break;
+			if ((unsigned char)read8((unsigned short)(src + i * step)) == a)
+			{
+				done = i + 1;
+				break;
+			}
 		}
-		case 0x0C: // inc C
-		{
-			C++;
-			updateN(ADD);
-			updateOverflow(C);
-			updateHC(C);
-			updateZero(C);
-			updateSign(C);
-			PC++;
-			break;
-		}
-		case 0x0D: // dec C
-		{
-			C--;
-			updateN(SUB);
-			updateOverflow(C);
-			updateHC(C);
-			updateZero(C);
-			updateSign(C);
-			PC++;
-			break;
-		}
-		case 0x0E: // ld c, *
-		{
-			C = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x0F: // rrca
-		{
-			A >>= 1;
-			updateCarry(A);
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x10: // djnz *
-		{
-			B--;
-			if (B != 0)
-			{
-				PC += mem[PC + 1];
-			}
-			else
-			{ 
-				PC += 2;
-			}
-			break;
-		}
-		case 0x11: // ld de, **
-		{
-			//const short val = (mem[PC] << 8) | (mem[PC + 1] & 0xFF);
-			DE(load16());
-			PC += 3;
-			break;
-		}
-		case 0x12: // ld (de), a
-		{
-			mem[DE()] = A;
-			PC++;
-			break;
-		}
-		case 0x13: // inc de
-		{
-			const short de = DE();
-			DE(de + 1);
-			PC++;
-			break;
-		}
-		case 0x14: // inc d
-		{
-			D++;
-			updateN(ADD);
-			updateOverflow(D);
-			updateHC(D);
-			updateZero(D);
-			updateSign(D);
-			PC++;
-			break;
-		}
-		case 0x15: // dec d
-		{
-			D--;
-			updateN(SUB);
-			updateOverflow(D);
-			updateHC(D);
-			updateZero(D);
-			updateSign(D);
-			PC++;
-			break;
-		}
-		case 0x16: // ld d, *
-		{
-			D = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x17: // rla
-		{
-			A <<= 1;
-			updateCarry(A);
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x18: // jr *
-		{
-			jr(true, mem[PC + 1], 2);
-			break;
-		}
-		case 0x19: // add hl, de
-		{
-			const short hl = HL();
-			HL(hl + DE());
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(HL());
-			PC++;
-			break;
-		}
-		case 0x1A: // ld a, (de)
-		{
-			A = mem[DE()];
-			PC++;
-			break;
-		}
-		case 0x1B: // dec de
-		{
-			const short de = DE();
-			DE(de - 1);
-			PC++;
-			break;
-		}
-		case 0x1C: // inc e
-		{
-			E++;
-			updateCarry(E);
-			updateN(ADD);
-			updateOverflow(E);
-			updateHC(E);
-			updateSign(E);
-			PC++;
-			break;
-		}
-		case 0x1D: // dec e
-		{
-			E--;
-			updateCarry(E);
-			updateN(SUB);
-			updateOverflow(E);
-			updateHC(E);
-			updateSign(E);
-			PC++;
-			break;
-		}
-		case 0x1E: // ld e, *
-		{
-			E = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x1F: // rra
-		{
-			A >>= 1;
-			updateCarry(A);
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x20: // jr nz, *
-		{
-			jr(!zero(), mem[PC + 1], 2);
-			break;
-		}
-		case 0x21: // ld hl, **
-		{
-			HL(load16());
-			PC += 3;
-			break;
-		}
-		case 0x22: // load (**), hl
-		{
-			mem[get16()] = HL();
-			PC += 3;
-			break;
-		}
-		case 0x23: // inc hl
-		{
-			const short hl = HL();
-			HL(hl + 1);
-			PC++;
-			break;
-		}
-		case 0x24: // inc h
-		{
-			H++;
-			updateN(ADD);
-			updateOverflow(H);
-			updateHC(H);
-			updateZero(H);
-			updateZero(H);
-			updateSign(H);
-			PC++;
-			break;
-		}
-		case 0x25: // dec h
-		{
-			H--;
-			updateN(SUB);
-			updateOverflow(H);
-			updateHC(H);
-			updateZero(H);
-			updateZero(H);
-			updateSign(H);
-			PC++;
-			break;
-		}
-		case 0x26: // ld h, *
-		{
-			H = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x27: // daa ^^^Probably doesnt work ^^^^
-		{
-			short uiResult = 0;
-			while (A > 0) 
-			{
-				uiResult <<= 4;
-				uiResult |= A % 10;
-				A /= 10;
-			}
-			updateOverflow(A);
-			updateCarry(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x28: // jr z, *
-		{
-			jr(zero(), mem[PC + 1], 2);
-			break;
-		}
-		case 0x29: // add hl, hl
-		{
-			const short hl = HL();
-			HL(hl + hl);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(HL());
-			PC++;
-			break;
-		}
-		case 0x2A: // ld hl, (**) 
-		{
-			HL(mem[get16()]);
-			PC += 3;
-			break;
-		}
-		case 0x2B: // dec hl
-		{
-			const short hl = HL();
-			HL(hl - 1);
-			PC++;
-			break;
-		}
-		case 0x2C: // inc l
-		{
-			L++;
-			updateOverflow(L);
-			updateHC(L);
-			updateN(ADD);
-			updateZero(L);
-			updateSign(L);
-			PC++;
-			break;
-		}
-		case 0x2D: // dec l
-		{
-			L--;
-			updateOverflow(L);
-			updateHC(L);
-			updateN(SUB);
-			updateZero(L);
-			updateSign(L);
-			PC++;
-			break;
-		}
-		case 0x2E: // ld l, *
-		{
-			L = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x2f: // cpl ^^^
-		{
-			A = ~A;
-			PC++;
-			break;
-		}
-		case 0x30: // jr nc, *
-		{
-			jr(!carry(), mem[PC + 1], 2);
-			break;
-		}
-		case 0x31: // ld sp, **
-		{
-			SP = get16();
-			PC += 3;
-			break;
-		}
-		case 0x32: // ld (**), a
-		{
-			mem[get16()] = A;
-			PC += 3;
-			break;
-		}
-		case 0x33: // inc sp
-		{
-			this->SP++;
-			PC++;
-			break;
-		}
-		case 0x34: // inc (hl) ^^^
-		{
-			mem[HL()]++;
-			updateOverflow(HL());
-			updateN(ADD);
-			updateZero(HL());
-			updateHC(HL());
-			updateSign(HL());
-			PC++;
-			break;
-		}
-		case 0x35: // dec (hl) ^^^
-		{
-			mem[HL()]--;
-			updateOverflow(HL());
-			updateN(SUB);
-			updateZero(HL());
-			updateHC(HL());
-			updateSign(HL());
-			PC++;
-			break;
-		}
-		case 0x36: // ld (hl), *
-		{
-			mem[HL()] = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x37: // scf
-		{
-			setCarry();
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x38: // jr c, *
-		{
-			jr(carry(), mem[PC + 1], 2);
-			break;
-		}
-		case 0x39: // add hl, sp
-		{
-			const short hl = HL();
-			HL(hl + hl);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(HL());
-			updateZero(HL());
-			updateSign(HL());
-			PC++;
-			break;
-		}
-		case 0x3A: // ld a, (**)
-		{
-			A = mem[load16()];
-			PC += 3;
-			break;
-		}
-		case 0x3B: // dec sp
-		{
-			SP--;
-			PC++;
-			break;
-		}
-		case 0x3C: // inc a
-		{
-			A++;
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x3D: // dec a
-		{
-			A--;
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x3E: // ld a, *
-		{
-			A = mem[PC + 1];
-			PC += 2;
-			break;
-		}
-		case 0x3F: // ccf
-		{
-			F ^= 0x1;
-			PC++;
-			break;
-		}
-		case 0x40: // ld b, b
-		{
-			PC++;
-			break;
-		}
-		case 0x41: // ld b, c
-		{
-			B = C;
-			PC++;
-			break;
-		}
-		case 0x42: // ld b, d
-		{
-			B = D;
-			PC++;
-			break;
-		}
-		case 0x43: // ld b, e
-		{
-			B = E;
-			PC++;
-			break; 
-		}
-		case 0x44: // ld b, h
-		{
-			B = H;
-			PC++;
-			break;
-		}
-		case 0x45: // ld b, l
-		{
-			B = L;
-			PC++;
-			break;
-		}
-		case 0x46: // ld b, (hl)
-		{
-			B = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x47: // ld b, a
-		{
-			B = A;
-			PC++;
-			break;
-		}
-		case 0x48: // ld c, b
-		{
-			C = B;
-			PC++;
-			break;
-		}
-		case 0x49: // ld c, c
-		{
-			PC++;
-			break;
-		}
-		case 0x4A: // ld c, d
-		{
-			C = D;
-			PC++;
-			break;
-		}
-		case 0x4B: // ld c, e
-		{
-			C = E;
-			PC++;
-			break;
-		}
-		case 0x4C: // ld c, h
-		{
-			C = H;
-			PC++;
-			break;
-		}
-		case 0x4D: // ld c, l
-		{
-			C = L;
-			PC++;
-			break;
-		}
-		case 0x4E: // ld c, (hl)
-		{
-			C = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x4F: // ld c, a
-		{
-			C = A;
-			PC++;
-			break;
-		}
-		case 0x50: // ld d, b
-		{
-			D = B;
-			PC++;
-			break;
-		}
-		case 0x51: // ld d, c
-		{
-			D = C;
-			PC++;
-			break;
-		}
-		case 0x52: // ld d, d
-		{
-			PC++;
-			break;
-		}
-		case 0x53: // ld d, e
-		{
-			D = E;
-			PC++;
-			break;
-		}
-		case 0x54: // ld d, h
-		{
-			D = H;
-			PC++;
-			break;
-		}
-		case 0x55: // ld d, l
-		{
-			D = L;
-			PC++;
-			break;
-		}
-		case 0x56: // ld d, (hl)
-		{
-			D = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x57: // ld d, a
-		{
-			D = A;
-			PC++;
-			break;
-		}
-		case 0x58: // ld e, b
-		{
-			E = B;
-			PC++;
-			break;
-		}
-		case 0x59: // ld e, c
-		{
-			E = C;
-			PC++;
-			break;
-		}
-		case 0x5A: // ld e, d
-		{
-			E = D;
-			PC++;
-			break;
-		}
-		case 0x5B: // ld e, e
-		{
-			PC++;
-			break;
-		}
-		case 0x5C: // ld e, h
-		{
-			E = H;
-			PC++;
-			break;
-		}
-		case 0x5D: // ld e, l
-		{
-			E = L;
-			PC++;
-			break;
-		}
-		case 0x5E: // ld e, (hl)
-		{
-			E = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x5F: // ld e, a
-		{
-			E = A;
-			PC++;
-			break;
-		}
-		case 0x60: // ld h, b
-		{
-			H = B;
-			PC++;
-			break;
-		}
-		case 0x61: // ld h, c
-		{
-			H = C;
-			PC++;
-			break;
-		}
-		case 0x62: // ld h, d
-		{
-			H = D;
-			PC++;
-			break;
-		}
-		case 0x63: // ld h, e
-		{
-			H = E;
-			PC++;
-			break;
-		}
-		case 0x64: // ld h, h &&&
-		{
-			PC++;
-			break;
-		}
-		case 0x65: // ld h, l
-		{
-			H = L;
-			PC++;
-			break;
-		}
-		case 0x66: // ld h, (hl)
-		{
-			H = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x67: // ld h, a
-		{
-			H = A;
-			PC++;
-			break;
-		}
-		case 0x68: // ld l, b
-		{
-			L = B;
-			PC++;
-			break;
-		}
-		case 0x69: // ld l, c
-		{
-			L = C;
-			PC++;
-			break;
-		}
-		case 0x6A: // ld l, d
-		{
-			L = D;
-			PC++;
-			break;
-		}
-		case 0x6B: // ld l, e
-		{
-			L = E;
-			PC++;
-			break;
-		}
-		case 0x6C: // ld l, h
-		{
-			L = H;
-			PC++;
-			break;
-		}
-		case 0x6D: // ld l, l &&&
-		{
-			PC++;
-			break;
-		}
-		case 0x6E: // ld l, (hl)
-		{
-			L = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x6F: // ld l, a
-		{
-			L = A;
-			PC++;
-			break;
-		}
-		case 0x70: // ld (hl), b
-		{
-			mem[HL()] = B;
-			PC++;
-			break;
-		}
-		case 0x71: // ld (hl), c
-		{
-			mem[HL()] = C;
-			PC++;
-			break;
-		}
-		case 0x72: // ld (hl), d
-		{
-			mem[HL()] = D;
-			PC++;
-			break;
-		}
-		case 0x73: // ld (hl), e
-		{
-			mem[HL()] = E;
-			PC++;
-			break;
-		}
-		case 0x74: // ld (hl), h
-		{
-			mem[HL()] = H;
-			PC++;
-			break;
-		}
-		case 0x75: // ld (hl), l
-		{
-			mem[HL()] = L;
-			PC++;
-			break;
-		}
-		case 0x76: // halt ^^^ TODO:Implement
-		{
-			halt();
-			PC++;
-			break;
-		}
-		case 0x77: // ld (hl), a
-		{
-			mem[HL()] = A;
-			PC++;
-			break;
-		}
-		case 0x78: // ld a, b
-		{
-			A = B;
-			PC++;
-			break;
-		}
-		case 0x79: // ld a, c
-		{
-			A = C;
-			PC++;
-			break;
-		}
-		case 0x7A: // ld a, d
-		{
-			A = D;
-			PC++;
-			break;
-		}
-		case 0x7B: // ld a, e
-		{
-			A = E;
-			PC++;
-			break;
-		}
-		case 0x7C: // ld a, h
-		{
-			A = H;
-			PC++;
-			break;
-		}
-		case 0x7D: // ld a, l
-		{
-			A = L;
-			PC++;
-			break;
-		}
-		case 0x7E: // ld a, (hl)
-		{
-			A = mem[HL()];
-			PC++;
-			break;
-		}
-		case 0x7F: // ld a, a &&&
-		{
-			PC++;
-			break;
-		}
-		case 0x80: // add a, b
-		{
-			A += B;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x81: // add a, c
-		{
-			A += C;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x82: // add a,d 
-		{
-			A += D;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x83: // add a, e
-		{
-			A += E;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x84: // add a, h
-		{
-			A += H;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x85: // add a, l
-		{
-			A += L;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x86: // add a, (hl)
-		{
-			A += mem[HL()];
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x87: // add a, a
-		{
-			A += A;
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x88: // adc a, b ^^^ check all adcs
-		{
-			A += B + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x89: // adc a, c
-		{
-			A += B + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8A: // adc a, d
-		{
-			A += D + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8B: // adc a, e
-		{
-			A += E + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8C: // adc a, h
-		{
-			A += H + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8D: // adc a, l
-		{
-			A += L + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8E: // adc a, (hl)
-		{
-			A += mem[HL()] + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x8F: // adc a, a
-		{
-			A += A + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x90: // sub b
-		{
-			A -= B;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x91: // sub c
-		{
-			A -= C;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x92: // sub d
-		{
-			A -= D;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x93: // sub e
-		{
-			A -= E;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x94: // sub h
-		{
-			A -= H;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x95: // sub l
-		{
-			A -= L;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x96: // sub (hl)
-		{
-			A -= mem[HL()];
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x97: // sub a 
-		{
-			A -= A;
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x98: // sbc a, b ^^^ (B - carry() or B + carry())
-		{
-			A -= B - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x99: // sbc a, c
-		{
-			A -= C - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9A: // sbc a, d
-		{
-			A -= D - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9B: // sbc a, e
-		{
-			A -= E - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9C: // sbc a, h
-		{
-			A -= H - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9D: // sbc a, l
-		{
-			A -= L - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9E: // sbc a, (hl)
-		{
-			A -= mem[HL()] - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0x9F: // sbc a, a
-		{
-			A -= A - carry();
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA0: // and b
-		{
-			A &= B;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA1: // and c
-		{
-			A &= C;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA2: // and d
-		{
-			A &= D;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA3: // and e
-		{
-			A &= E;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA4: // and h
-		{
-			A &= H;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA5: // and l
-		{
-			A &= L;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA6: // and (hl)
-		{
-			A &= mem[HL()];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA7: // and a &&&
-		{
-			// A &= A;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA8: // xor b
-		{
-			A ^= B;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xA9: // xor c
-		{
-			A ^= C;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAA: // xor d
-		{
-			A ^= D;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAB: // xor e
-		{
-			A ^= E;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAC: // xor h
-		{
-			A ^= H;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAD: // xor l
-		{
-			A ^= L;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAE: // xor (hl)
-		{
-			A ^= mem[HL()];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xAF: // xor a &&& A = 0
-		{
-			A = 0;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB0: // or b
-		{
-			A |= B;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB1: // or c
-		{
-			A |= C;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB2: // or d
-		{
-			A |= D;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB3: // or e
-		{
-			A |= E;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB4: // or h
-		{
-			A |= H;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB5: // or l
-		{
-			A |= L;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB6: // or (hl)
-		{
-			A |= mem[HL()];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB7: // or a &&&
-		{
-			// A |= A;
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC++;
-			break;
-		}
-		case 0xB8: // cp b
-		{
-			cmp(B);
-			PC++;
-			break;
-		}
-		case 0xB9: // cp c
-		{
-			cmp(C);
-			PC++;
-			break;
-		}
-		case 0xBA: // cp d
-		{
-			cmp(D);
-			PC++;
-			break;
-		}
-		case 0xBB: // cp e
-		{
-			cmp(E);
-			PC++;
-			break;
-		}
-		case 0xBC: // cp h
-		{
-			cmp(H);
-			PC++;
-			break;
-		}
-		case 0xBD: // cp l
-		{
-			cmp(L);
-			PC++;
-			break;
-		}
-		case 0xBE: // cp (hl)
-		{
-			cmp(mem[HL()]);
-			PC++;
-			break;
-		}
-		case 0xBF: // cp a ^^^ = &&& try to optimize this
-		{
-			cmp(A);
-			PC++;
-			break;
-		}
-		case 0xC0: // ret nz
-		{
-			ret(!carry());
-			break;
-		}
-		case 0xC1: // pop bc
-		{
-			C = mem[SP];
-			SP++;
-			B = mem[SP];
-			SP++;
-			PC++;
-			break;
-		}
-		case 0xC2: // jp nz, ** ^^^ check get16
-		{
-			jp(!zero(), get16(), 3);
-			break;
-		}
-		case 0xC3: // jp **
-		{
-			jp(true, get16(), 3);
-			break;
-		}
-		case 0xC4: // call nz, ** ^^^
-		{
-			call(!zero());
-			break;
-		}
-		case 0xC5: // push bc
-		{
-			SP--;
-			mem[SP] = B;
-			SP--;
-			mem[SP] = C;
-			PC++;
-			break;
-		}
-		case 0xC6: // add a, *
-		{
-			A += mem[PC + 1];
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xC7: // rst 0x00
-		{
-			rst(0x00);
-			break;
-		}
-		case 0xC8: // ret z
-		{
-			ret(zero());
-			break;
-		}
-		case 0xC9: // ret
-		{
-			ret(true);
-			break;
-		}
-		case 0xCA: // jp z, **
-		{
-			jp(zero(), get16(), 3);
-			break;
-		}
-		case 0xCB: // BIT INSTRUCTIONS
-		{
-			decodeBitInstruction(opcode);
-			break;
-		}
-		case 0xCC: // call z, **
-		{
-			call(zero());
-			break;
-		}
-		case 0xCD: // call **
-		{
-			call(true);
-			break;
-		}
-		case 0xCE: // adc a, *
-		{
-			A += mem[PC + 1] + carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xCF: // rst 0x08
-		{
-			rst(0x08);
-			break;
-		}
-		case 0xD0: // ret nc
-		{
-			ret(!carry());
-			break;
-		}
-		case 0xD1: // pop de
-		{
-			E = mem[SP];
-			SP++;
-			D = mem[SP];
-			SP++;
-			PC++;
-			break;
-		}
-		case 0xD2: // jp nc, **
-		{
-			jp(!carry(), get16(), 3);
-			break;
-		}
-		case 0xD3: // out (*), a ~!GB
-		{
-			ports[mem[PC + 1]] = A;
-			PC += 2;
-			break;
-		}
-		case 0xD4: // call nc, **
-		{
-			call(!carry());
-			break;
-		}
-		case 0xD5: // push de
-		{
-			SP--;
-			mem[SP] = D;
-			SP--;
-			mem[SP] = E;
-			PC++;
-			break;
-		}
-		case 0xD6: // sub *
-		{
-			A -= mem[PC + 1];
-			updateCarry(A);
-			updateN(SUB);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xD7: // rst 0x10
-		{
-			rst(0x10);
-			break;
-		}
-		case 0xD8: // ret c
-		{
-			ret(carry());
-			break;
-		}
-		case 0xD9: // exx ~!GB
-		{
-			PC++;
-			break;
-		}
-		case 0xDA: // jp c, **
-		{
-			jp(carry(), get16(), 3);
-			break;
-		
-		}
-		case 0xDB: // in a, (*) ~!GB
-		{
-			A = ports[mem[PC + 1]];
-			PC += 2;
-			break;
-		}
-		case 0xDC: // call c, **
-		{
-			call(carry());
-			break;
-		}
-		case 0xDD: // IX INSTRUCTIONS ~!GB
-		{
-			decodeIXInstruction(opcode);
-			PC++;
-			break;
-		}
-		case 0xDE: // sbc a, *
-		{
-			A -= mem[PC + 1] - carry();
-			updateCarry(A);
-			updateN(ADD);
-			updateOverflow(A);
-			updateHC(A);
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xDF: // rst 0x18
-		{
-			rst(0x18);
-			break;
-		}
-		case 0xE0: // ret po
-		{
-			ret(!overflow());
-			break;
-		}
-		case 0xE1: // pop hl
-		{
-			L = mem[SP];
-			SP++;
-			H = mem[SP];
-			SP++;
-			PC++;
-			break;
-		}
-		case 0xE2: // jp po, **
-		{
-			jp(!overflow(), get16(), 3);
-			break;
-		}
-		case 0xE3: // ex (sp), hl ~!GB
-		{
-			const short sp = SP; 
-			SP = ((L >> 8) & 0xFF);
-			SP |= (char)HL();
-
-			L = ((sp >> 8) & 0xFF);
-			H = (char)sp;
-			PC++;
-			break;
-		}
-		case 0xE4: // call po, **
-		{
-			call(!overflow());
-			break;
-		}
-		case 0xE5: // push hl
-		{
-			SP--;
-			mem[SP] = H;
-			SP--;
-			mem[SP] = L;
-			PC++;
-			break;
-		}
-		case 0xE6: // and *
-		{
-			A &= mem[PC + 1];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			setHC();
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xE7: // rst 0x20
-		{
-			rst(0x20);
-			break;
-		}
-		case 0xE8: // ret pe
-		{
-			ret(overflow());
-			break;
-		}
-		case 0xE9: // jp (hl)
-		{
-			jp(true, HL(), 1);
-			break;
-		}
-		case 0xEA: // jp pe, **
-		{
-			jp(overflow(), get16(), 3);
-			break;
-		}
-		case 0xEB: // ex de, hl ~!GB
-		{
-			const short de = DE();
-			DE(HL()); // swap de = hl
-			HL(de); // hl = de
-			PC++;
-			break;
-		}
-		case 0xEC: // call pe, **
-		{
-			call(overflow());
-			break;
-		}
-		case 0xED: // EXTENDED INSTRUCTIONS ~!GB
-		{
-			decodeExtendedInstruction(opcode);
-			PC++;
-			break;
-		}
-		case 0xEE: // xor *
-		{
-			A ^= mem[PC + 1];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
-		}
-		case 0xEF: // rst 0x28
-		{
-			rst(0x28);
-			break;
-		}
-		case 0xF0: // ret p !~GB
-		{
-			ret(overflow());
-			break;
-		}
-		case 0xF1: // pop af
-		{
-			F = mem[SP];
-			SP++;
-			A = mem[SP];
-			SP++;
-			PC++;
-			break;
-		}
-		case 0xF2: // jp p, **
-		{
-			jp(overflow(), get16(), 3);
-			break;
-		}
-		case 0xF3: // di ^^^
+	}
+
+	const unsigned char val = read8((unsigned short)(src + (done - 1) * step));
+	HL(src + done * step);
+	BC(bc - done);
+	const bool more = BC() != 0;
+	const unsigned char flags = flagTables.sub[0][a][val] & (FLAG_S | FLAG_Z | FLAG_H);
+	setF(flags | FLAG_N | (more ? FLAG_PV : 0) | carry());
+	finishBlock(done, 16, repeat && more && !(flags & FLAG_Z));
+}
+
+// ini, ind, inir, indr
+// ports have no side effects on reads, so a repeated read from the same port is a fill
+template<int step, bool repeat> void CPU::blockIn()
+{
+	const unsigned char b = B;
+	const unsigned short dst = HL();
+	const unsigned int count = repeat ? beforeOwnBytes(blockIterations(b ? b : 0x100, 16 + CYCLES_BLOCK_REPEAT), dst, step) : 1;
+	const unsigned char val = readPort(C);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		store8(dst + i * step, val);
+	}
+	invalidateCode((step > 0) ? dst : dst - (count - 1), count);
+
+	HL(dst + count * step);
+	B = b - count;
+	setF((flagTables.szp[(unsigned char)B] & (FLAG_S | FLAG_Z)) | FLAG_N | carry());
+	finishBlock(count, 16, repeat && B != 0);
+}
+
+// outi, outd, otir, otdr
+// a plain port only keeps the last byte written, so a repeat writes that one byte for all its iterations, but a bank port
+// remaps memory on each write and the next byte may come from the page it mapped in, one iteration at a time there
+template<int step, bool repeat> void CPU::blockOut()
+{
+	const unsigned char b = B;
+	const bool paging = flash != NULL && (C == PORT_BANK_A || C == PORT_BANK_B);
+	const unsigned int count = (repeat && !paging) ? blockIterations(b ? b : 0x100, 16 + CYCLES_BLOCK_REPEAT) : 1;
+	const unsigned short src = HL();
+	writePort(C, read8((unsigned short)(src + (count - 1) * step)));
+
+	HL(src + count * step);
+	B = b - count;
+	setF((flagTables.szp[(unsigned char)B] & (FLAG_S | FLAG_Z)) | FLAG_N | carry());
+	finishBlock(count, 16, repeat && B != 0);
+}
+
+template<unsigned char opcode> void CPU::executeED()
+{
+	const unsigned char y = (opcode >> 3) & 7;
+	const unsigned char pair = y >> 1;
+	if (opcode >= 0x40 && opcode < 0x80)
+	{
+		switch (opcode & 7)
 		{
-			PC++;
-			break;
+			case 0: // in r, (c) / in (c) for y = 6 which only sets the flags
+			{
+				const unsigned char val = readPort(C);
+				if (y != 6)
+				{
+					setReg<y>(val);
+				}
+				setF(flagTables.szp[val] | carry());
+				break;
+			}
+			case 1: // out (c), r / out (c), 0 for y = 6
+			{
+				writePort(C, (y == 6) ? 0 : getReg<y>());
+				break;
+			}
+			case 2: // sbc hl, rr / adc hl, rr
+			{
+				if (y & 1)
+				{
+					adc16(getPair<pair>());
+				}
+				else
+				{
+					sbc16(getPair<pair>());
+				}
+				break;
+			}
+			case 3: // ld (**), rr / ld rr, (**)
+			{
+				const unsigned short where = read16(PC);
+				if (y & 1)
+				{
+					setPair<pair>(read16(where));
+				}
+				else
+				{
+					write16(where, getPair<pair>());
+				}
+				PC += 2;
+				break;
+			}
+			case 4: // neg
+			{
+				const unsigned char a = A;
+				A = 0;
+				sub8(a);
+				break;
+			}
+			case 5: // retn / reti
+			{
+				PC = read16(SP);
+				SP += 2;
+				IFF1 = IFF2;
+				if (IFF1 && interruptPending)
+				{
+					cycleLimit = std::min(cycleLimit, cycles);
+				}
+				break;
+			}
+			case 6: // im 0 / 1 / 2
+			{
+				static const unsigned char modes[] = { 0, 0, 1, 2, 0, 0, 1, 2 };
+				interruptMode = modes[y];
+				break;
+			}
+			default:
+			{
+				switch (y)
+				{
+					case 0: I = A; break; // ld i, a
+					case 1: R = A; R7 = A & 0x80; break; // ld r, a
+					case 2: // ld a, i
+					case 3: // ld a, r
+					{
+						A = (y == 2) ? I : refresh();
+						setF((flagTables.szp[(unsigned char)A] & (FLAG_S | FLAG_Z)) | (IFF2 ? FLAG_PV : 0) | carry());
+						break;
+					}
+					case 4: // rrd
+					case 5: // rld
+					{
+						const unsigned char a = A;
+						const unsigned short hl = HL();
+						const unsigned char m = read8(hl);
+						if (y == 4)
+						{
+							write8(hl, (a << 4) | (m >> 4));
+							A = (a & 0xF0) | (m & 0xF);
+						}
+						else
+						{
+							write8(hl, (m << 4) | (a & 0xF));
+							A = (a & 0xF0) | (m >> 4);
+						}
+						setF(flagTables.szp[(unsigned char)A] | carry());
+						break;
+					}
+					default: break; // nop
+				}
+				break;
+			}
 		}
-		case 0xF4: // call p, **
+	}
+	else if (opcode >= 0xA0 && opcode < 0xC0 && (opcode & 7) < 4 && y >= 4)
+	{
+		// ldi cpi ini outi, ldd cpd ind outd, ldir cpir inir otir, lddr cpdr indr otdr
+		const int step = (y & 1) ? -1 : 1;
+		const bool repeat = y >= 6;
+		switch (opcode & 3)
 		{
-			call(overflow());
-			break;
+			case 0: blockLoad<step, repeat>(); break;
+			case 1: blockCompare<step, repeat>(); break;
+			case 2: blockIn<step, repeat>(); break;
+			default: blockOut<step, repeat>(); break;
 		}
-		case 0xF5: // push af
+	}
+	// everything else is a two byte nop
+}
+
+#define ED_HANDLER(n) &CPU::executeED<n>
+const CPU::OpHandler CPU::edTable[256] = { OPCODE_TABLE(ED_HANDLER) };
+#undef ED_HANDLER
+
+void CPU::dispatchSwitch(unsigned char opcode)
+{
+	switch (opcode)
+	{
+#define OPCODE(n) case n:
+#define END_OPCODE break;
+#define INDEX_REG INDEX_HL
+#include "opcodes.inl"
+#undef OPCODE
+#undef END_OPCODE
+#undef INDEX_REG
+		default: // just in case the definition of a char changes
 		{
-			SP--;
-			A = mem[SP];
-			SP--;
-			F = mem[SP];
-			PC++;
+			stop(STOP_INVALID_OPCODE);
 			break;
 		}
-		case 0xF6: // or *
+	}
+}
+
+unsigned int CPU::fetch()
+{
+	if (slowFetch)
+	{
+		return fetchSlow();
+	}
+	const unsigned char opcode = read8(PC);
+	R++; // I think this is what R does
+	cycles += cyclesMain[opcode];
+	return opcode;
+}
+
+// Everything that is off in a plain run lives here so the fast path is a single flag test:
+// stop requests, breakpoints, tracing, profiling and B_CALL checks
+unsigned int CPU::fetchSlow()
+{
+	if (stopReason != STOP_NONE)
+	{
+		return STOP_OPCODE;
+	}
+	if (bcallCheck)
+	{
+		checkBCallReturn();
+	}
+	if (breakpointCount != 0)
+	{
+		// the first instruction of a run is never stopped at, so running again resumes from a breakpoint
+		const bool resuming = ignoreBreakpoint;
+		ignoreBreakpoint = false;
+		if (!resuming && isBreakpoint(PC))
 		{
-			A |= mem[PC + 1];
-			resetCarry();
-			resetN();
-			updateParity(A);
-			resetHC();
-			updateZero(A);
-			updateSign(A);
-			PC += 2;
-			break;
+			stopReason = STOP_BREAKPOINT;
+			return STOP_OPCODE;
 		}
-		case 0xF7: // rst 0x30
+	}
+
+	const unsigned char opcode = read8(PC);
+	if (profiler)
+	{
+		profiler->instruction(PC >> BANK_SHIFT, bankPages[PC >> BANK_SHIFT], PC, SP, opcode, read8(PC + 1), cycles);
+	}
+	// the record holds the state before the instruction, as the profiler sees it
+	if (trace)
+	{
+		traceInstruction(opcode);
+	}
+	R++;
+	cycles += cyclesMain[opcode];
+	return opcode;
+}
+
+void CPU::updateSlowFetch()
+{
+	slowFetch = (trace != NULL) || (profiler != NULL) || (bcallCheck != NULL) || (breakpointCount != 0) || (stopReason != STOP_NONE);
+}
+
+// ends the current run once the executing instruction is finished
+void CPU::stop(StopReason reason)
+{
+	stopReason = reason;
+	slowFetch = true;
+}
+
+void CPU::traceInstruction(unsigned char opcode)
+{
+	TraceRecord& record = trace->next();
+	record.cycles = cycles;
+	record.PC = PC;
+	record.SP = SP;
+	record.AF = AF();
+	record.BC = BC();
+	record.DE = DE();
+	record.HL = HL();
+	record.IX = IX();
+	record.IY = IY();
+	record.opcode = opcode;
+	record.R = refresh();
+}
+
+void CPU::setTrace(TraceBuffer* buffer)
+{
+	trace = buffer;
+	updateSlowFetch();
+}
+
+void CPU::setProfiler(Profiler* profile)
+{
+	profiler = profile;
+	updateSlowFetch();
+}
+
+void CPU::setScheduler(Scheduler* events)
+{
+	scheduler = events;
+}
+
+bool CPU::isBreakpoint(unsigned short address) const
+{
+	return (breakpoints[address >> 3] >> (address & 7)) & 1;
+}
+
+void CPU::setBreakpoint(unsigned short address)
+{
+	if (!isBreakpoint(address))
+	{
+		breakpoints[address >> 3] |= 1 << (address & 7);
+		breakpointCount++;
+	}
+	updateSlowFetch();
+}
+
+void CPU::clearBreakpoint(unsigned short address)
+{
+	if (isBreakpoint(address))
+	{
+		breakpoints[address >> 3] &= ~(1 << (address & 7));
+		breakpointCount--;
+	}
+	updateSlowFetch();
+}
+
+void CPU::clearBreakpoints()
+{
+	memset(breakpoints, 0, sizeof(breakpoints));
+	breakpointCount = 0;
+	updateSlowFetch();
+}
+
+unsigned long long CPU::getCycles() const
+{
+	return cycles;
+}
+
+void CPU::emulateCycle()
+{
+	run(1, DISPATCH_SWITCH);
+}
+
+// The engines below execute until [remaining] reaches zero, the cycle counter reaches [cycleLimit]
+// or fetch() returns STOP_OPCODE
+void CPU::runSwitch()
+{
+	while (remaining != 0 && cycles < cycleLimit)
+	{
+		const unsigned int opcode = fetch();
+		if (opcode == STOP_OPCODE)
 		{
-			rst(0x30);
-			break;
+			return;
 		}
-		case 0xF8: // ret m
+		dispatchSwitch(opcode);
+		remaining--;
+	}
+}
+
+// one instruction through the switch, for engines that cannot run the next instruction themselves
+// false when fetch() stopped the run instead
+bool CPU::stepSwitch()
+{
+	const unsigned int opcode = fetch();
+	if (opcode == STOP_OPCODE)
+	{
+		return false;
+	}
+	dispatchSwitch(opcode);
+	remaining--;
+	return true;
+}
+
+void CPU::runTable()
+{
+	while (remaining != 0 && cycles < cycleLimit)
+	{
+		const unsigned int opcode = fetch();
+		if (opcode == STOP_OPCODE)
 		{
-			ret(sign());
-			break;
+			return;
 		}
-		case 0xF9: // ld sp, hl
+		(this->*opTable[opcode])();
+		remaining--;
+	}
+}
+
+// Threaded code: every opcode body ends with its own indirect jump to the next one
+// so the branch predictor gets a separate history per opcode instead of one shared switch jump
+// STOP_OPCODE gets its own label, so stopping costs nothing on the fast path
+void CPU::runThreaded()
+{
+#ifdef Z80_THREADED_DISPATCH
+#define OPCODE_LABEL(n) &&L##n
+	static void* const labels[STOP_OPCODE + 1] = { OPCODE_TABLE(OPCODE_LABEL), &&stopped };
+#undef OPCODE_LABEL
+#define NEXT_OPCODE goto *labels[fetch()]
+
+	if (remaining == 0 || cycles >= cycleLimit)
+	{
+		return;
+	}
+	NEXT_OPCODE;
+
+#define OPCODE(n) L##n:
+#define END_OPCODE if (--remaining == 0 || cycles >= cycleLimit) { return; } NEXT_OPCODE;
+#define INDEX_REG INDEX_HL
+#include "opcodes.inl"
+#undef OPCODE
+#undef END_OPCODE
+#undef INDEX_REG
+#undef NEXT_OPCODE
+
+stopped:
+	return;
+#else
+	runTable();
+#endif
+}
+
+#ifdef Z80_THREADED_DISPATCH
+std::atomic<void* const*> CPU::blockLabels(NULL);
+#endif
+
+// Basic block cache (blocks.cpp): with computed goto every op of a block jumps straight to the body of the next one,
+// CB and ED ops go through their handler
+void CPU::runBlocks(const bool compile)
+{
+#ifdef Z80_THREADED_DISPATCH
+#define OPCODE_LABEL(n) &&B##n
+	static void* const labels[0x100 + 1] = { OPCODE_TABLE(OPCODE_LABEL), &&handler };
+#undef OPCODE_LABEL
+	blockLabels = labels;
+#endif
+
+	while (remaining != 0 && cycles < cycleLimit)
+	{
+		Block* block = nextBlock();
+		if (block == NULL)
 		{
-			SP = ((L >> 8) & 0xFF);
-			SP |= (char)HL();
-			PC++;
-			break;
+			if (!stepSwitch())
+			{
+				return;
+			}
+			continue;
 		}
-		case 0xFA: // jp m, **
+		if (block->idleTries != 0)
 		{
-			jp(sign(), get16(), 3);
-			break;
+			runIdleLoop(*block);
+			continue;
 		}
-		case 0xFB: // ei ^^^
+#ifdef Z80_JIT
+		if (compile && block->hits != JIT_DECLINED && runCompiled(*block))
 		{
-			PC++;
-			break;
+			continue;
 		}
-		case 0xFC: // call m, **
+#endif
+
+#ifdef Z80_THREADED_DISPATCH
+		const MicroOp* op = beginBlock(*block);
+		goto *op->label;
+
+#define OPCODE(n) B##n:
+#define END_OPCODE if (++op < blockEnd) { goto *op->label; } goto done;
+#define INDEX_REG INDEX_HL
+#include "opcodes.inl"
+#undef OPCODE
+#undef END_OPCODE
+#undef INDEX_REG
+
+	handler:
+		PC += op->skip;
+		(this->*op->handler)();
+		if (++op < blockEnd)
+		{
+			goto *op->label;
+		}
+	done:
+		endBlock(*block, op);
+#else
+		executeBlock(*block);
+#endif
+	}
+}
+
+CPU::RunResult CPU::run(unsigned long long budget, Dispatch engine)
+{
+	return run(budget, ~0ULL, engine);
+}
+
+CPU::RunResult CPU::runCycles(unsigned long long budget, Dispatch engine)
+{
+	return run(~0ULL, budget, engine);
+}
+
+CPU::RunResult CPU::run(unsigned long long instructionBudget, unsigned long long cycleBudget, Dispatch engine)
+{
+	const unsigned long long startCycles = cycles;
+	const unsigned long long runLimit = (cycleBudget > ~0ULL - cycles) ? ~0ULL : cycles + cycleBudget;
+	remaining = instructionBudget;
+	stopReason = STOP_NONE;
+	ignoreBreakpoint = true;
+	updateSlowFetch();
+
+	// the engines run to the next deadline as if it were the end of the run, the events there fire between two instructions
+	// and an interrupt they requested is taken right after them
+	for (;;)
+	{
+		if (scheduler)
 		{
-			call(sign());
-			break;
+			scheduler->fire(cycles);
 		}
-		case 0xFD: // IY INSTRUCTIONS ~!GB
+		cycleLimit = scheduler ? std::min(runLimit, scheduler->next()) : runLimit;
+		if ((interruptPending || nmiPending) && stopReason == STOP_NONE)
 		{
-			decodeIYInstruction(opcode);
-			PC++;
-			break;
+			interrupt();
 		}
-		case 0xFE: // cp *
+		if (remaining == 0 || cycles >= runLimit || stopReason != STOP_NONE)
 		{
-			cmp(mem[PC + 1]);
-			PC += 2;
 			break;
 		}
-		case 0xFF: // rst 0x38
+		if (halted)
 		{
-			rst(0x38);
-			PC++;
-			break;
+			idle();
+			continue;
 		}
-		default: // just in case the definition of a char changes
+		switch (engine)
 		{
-			std::cout << "You should never ever see this" << std::endl;
-			PC++;
-			break;
+			case DISPATCH_SWITCH:
+			{
+				runSwitch();
+				break;
+			}
+			case DISPATCH_TABLE:
+			{
+				runTable();
+				break;
+			}
+			case DISPATCH_THREADED:
+			{
+				runThreaded();
+				break;
+			}
+			case DISPATCH_BLOCKS:
+			{
+				runBlocks(false);
+				break;
+			}
+			case DISPATCH_JIT:
+			{
+				runJit();
+				break;
+			}
 		}
 	}
+
+	RunResult result;
+	result.reason = (stopReason == STOP_NONE) ? STOP_BUDGET : stopReason;
+	result.instructions = instructionBudget - remaining;
+	result.cycles = cycles - startCycles;
+	stopReason = STOP_NONE;
+	if (profiler)
+	{
+		profiler->finish(cycles);
+	}
+	updateSlowFetch();
+	return result;
+}
+
+bool CPU::sameState(const CPU& other) const
+{
+	return A == other.A && B == other.B && C == other.C && D == other.D && E == other.E &&
+		H == other.H && L == other.L && computeFlags() == other.computeFlags() && I == other.I && IXH == other.IXH && IXL == other.IXL && IYH == other.IYH && IYL == other.IYL &&
+		PC == other.PC && refresh() == other.refresh() && SP == other.SP && IFF1 == other.IFF1 && IFF2 == other.IFF2 &&
+		interruptMode == other.interruptMode && halted == other.halted && cycles == other.cycles &&
+		memcmp(ram, other.ram, RAM_PAGES * BANK_SIZE) == 0 && memcmp(bankPages, other.bankPages, NUM_BANKS) == 0 &&
+		flashPages == other.flashPages && (flash == NULL || memcmp(flash, other.flash, flashPages * BANK_SIZE) == 0) &&
+		memcmp(ports, other.ports, NUM_PORTS) == 0;
 }
 
-const std::string loadFile(const std::string& fileName)
+CPU::Registers CPU::getRegisters()
 {
-	std::ifstream file;
-	std::string line;
-	std::string ret;
-	file.open(fileName);
+	Registers registers;
+	registers.AF = AF();
+	registers.BC = BC();
+	registers.DE = DE();
+	registers.HL = HL();
+	registers.IX = IX();
+	registers.IY = IY();
+	registers.SP = SP;
+	registers.PC = PC;
+	registers.I = I;
+	registers.R = refresh();
+	return registers;
+}
 
-	if (file.is_open())
+unsigned long long CPU::hashRAM() const
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < RAM_PAGES * BANK_SIZE; i++)
 	{
-		while (file.good())
-		{
-			std::getline(file, line);
-			ret.append(line + "\n");
-		}
+		hash = (hash ^ (unsigned char)ram[i]) * 1099511628211ULL;
 	}
-	else
+	return hash;
+}
+
+void CPU::writeMemory(const unsigned short address, const std::string& bytes)
+{
+	for (size_t i = 0; i < bytes.size(); i++)
 	{
-		std::cerr << "Unable to open file: " << fileName << std::endl;
+		write8((unsigned short)(address + i), bytes[i]);
 	}
-
-	return ret;
 }
 
 const std::string toHex(const int val)
@@ -2378,20 +1601,143 @@ const std::string toHex(const int val)
 	return "0x" + result;
 }
 
-bool CPU::loadROM(const std::string& fileName)
+const char* CPU::loadResultText(const LoadResult result)
 {
-	// ^^^
-	const std::string rom = loadFile(fileName);
-	//const std::string rom = fileName;
-	if (rom.size() > MAX_ROM_SIZE)
+	switch (result)
 	{
-		return false;
+		case LOAD_OK: return "ok";
+		case LOAD_OPEN_FAILED: return "the file could not be opened";
+		case LOAD_BAD_SIZE: return "the image does not fit the memory it is loaded into";
+		case LOAD_READ_ONLY: return "the memory it is loaded into is read-only";
 	}
+	return "unknown error";
+}
 
-	// load the rom into memory
-	for (unsigned int i = 0; i < rom.size(); i++)
+CPU::LoadResult CPU::loadROM(const std::string& fileName)
+{
+	MappedFile file;
+	if (!file.open(fileName))
 	{
-		mem[ROM_START + i] = rom[i];
+		return LOAD_OPEN_FAILED;
 	}
-	return true;
+	return loadROMData(file.data(), file.size());
+}
+
+CPU::LoadResult CPU::loadROMImage(const std::string& rom)
+{
+	return loadROMData(rom.data(), rom.size());
+}
+
+// copies the program to ROM_START through the write pointers, flash is never written
+CPU::LoadResult CPU::loadROMData(const char* rom, const size_t size)
+{
+	if (size > MAX_ROM_SIZE)
+	{
+		return LOAD_BAD_SIZE;
+	}
+	// a read-only bank writes to writeSink, the program would be dropped without a word
+	for (size_t bank = ROM_START >> BANK_SHIFT; size != 0 && bank <= ((ROM_START + size - 1) >> BANK_SHIFT); bank++)
+	{
+		if (bankReadOnly[bank])
+		{
+			return LOAD_READ_ONLY;
+		}
+	}
+
+	// ROM_START + MAX_ROM_SIZE stays below the end of memory, at most one bank boundary to split at
+	size_t done = 0;
+	while (done < size)
+	{
+		const unsigned short where = (unsigned short)(ROM_START + done);
+		const size_t length = std::min(size - done, (size_t)(BANK_SIZE - (where & (BANK_SIZE - 1))));
+		memcpy(bankPointer(writeBanks, where, (unsigned int)length), rom + done, length);
+		done += length;
+	}
+	dropSharedPages();
+	flushBlocks();
+	return LOAD_OK;
+}
+
+// Maps the file as flash without copying it, the OS reads pages in as the program touches them
+CPU::LoadResult CPU::loadFlash(const std::string& fileName)
+{
+	MappedFile* file = new MappedFile();
+	if (!file->open(fileName))
+	{
+		delete file;
+		return LOAD_OPEN_FAILED;
+	}
+	// the banks point straight into the file, so it has to be whole pages
+	if (file->size() % BANK_SIZE != 0 || file->size() > (size_t)FLASH_PAGES * BANK_SIZE)
+	{
+		delete file;
+		return LOAD_BAD_SIZE;
+	}
+
+	releaseFlash();
+	flashFile = file;
+	mapFlash((char*)file->data(), (unsigned int)(file->size() / BANK_SIZE));
+	return LOAD_OK;
+}
+
+CPU::LoadResult CPU::loadFlashImage(const std::string& image)
+{
+	if (image.empty() || image.size() > (size_t)FLASH_PAGES * BANK_SIZE)
+	{
+		return LOAD_BAD_SIZE;
+	}
+
+	releaseFlash();
+	const unsigned int pages = (unsigned int)((image.size() + BANK_SIZE - 1) / BANK_SIZE);
+	ownedFlash = new char[pages * BANK_SIZE];
+	memset(ownedFlash, 0xFF, pages * BANK_SIZE); // erased flash
+	memcpy(ownedFlash, image.data(), image.size());
+	mapFlash(ownedFlash, pages);
+	return LOAD_OK;
+}
+
+// power on mapping of a TI-83 Plus, nothing in [pages] is ever written
+void CPU::mapFlash(char* pages, const unsigned int count)
+{
+	flash = pages;
+	flashPages = count;
+	ports[PORT_BANK_A] = 0;
+	ports[PORT_BANK_B] = PAGE_RAM | 1;
+	mapBank(0, 0);
+	mapBank(1, ports[PORT_BANK_A]);
+	mapBank(2, ports[PORT_BANK_B]);
+	mapBank(3, PAGE_RAM);
+	flushBlocks();
+}
+
+// the banks must be remapped before the CPU runs again
+void CPU::releaseFlash()
+{
+	delete flashFile;
+	delete[] ownedFlash;
+	flashFile = NULL;
+	ownedFlash = NULL;
+	flash = NULL;
+	flashPages = 0;
+}
+
+CPU::LoadResult CPU::loadRAMImage(const std::string& image)
+{
+	if (image.size() > (size_t)RAM_PAGES * BANK_SIZE)
+	{
+		return LOAD_BAD_SIZE;
+	}
+
+	memcpy(ram, image.data(), image.size());
+	dropSharedPages();
+	if (image.size() >= (size_t)BANK_SIZE && image.size() % BANK_SIZE == 0)
+	{
+		ramPages = (unsigned int)(image.size() / BANK_SIZE);
+		for (unsigned char bank = 0; bank < NUM_BANKS; bank++)
+		{
+			mapBank(bank, bankPages[bank]);
+		}
+	}
+	flushBlocks();
+	return LOAD_OK;
 }
\ No newline at end of file
@@ -6,8 +6,59 @@
 #include <sstream>
 #include <string>
 #include <iomanip>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
 
-#define NUM_PORTS 16 
+#include "flags.h"
+#include "trace.h"
+
+#define NUM_PORTS 256
+
+class MappedFile;
+class Profiler;
+class Scheduler;
+struct BCallCheck;
+class Snapshot;
+struct SnapshotPage;
+
+// memory: four 16 KB banks, each mapped to a page of RAM or flash (TI-83 Plus layout)
+#define BANK_SHIFT 14
+#define BANK_SIZE (1 << BANK_SHIFT)
+#define NUM_BANKS 4
+#define RAM_PAGES 4			// 64 KB, a flat machine maps all of them, a TI-83 Plus pages through 2 (32 KB) or 3 (48 KB)
+#define FLASH_PAGES 32		// 512 KB
+#define PAGE_RAM 0x40		// set in a page number for RAM, clear for flash
+#define PORT_BANK_A 6		// page of bank 1 (0x4000 - 0x7FFF)
+#define PORT_BANK_B 7		// page of bank 2 (0x8000 - 0xBFFF)
+
+// basic block cache (blocks.cpp)
+#define BLOCK_CACHE_SIZE 4096	// direct mapped on the entry PC, must be a power of two
+#define BLOCK_MAX_OPS 32
+#define CODE_PAGE_SHIFT 8		// translated code is tracked per 256 byte page
+#define IDLE_LOOP_TRIES 2		// iterations of a loop that change registers before it is no longer taken for a polling loop
+
+// snapshots (snapshot.cpp), RAM is saved and shared in the same 256 byte pages that stores are checked in
+#define SNAPSHOT_PAGES ((RAM_PAGES * BANK_SIZE) >> CODE_PAGE_SHIFT)
+
+// x86-64 recompiler for hot blocks (jit.cpp)
+#if defined(__x86_64__) || defined(_M_X64)
+#define Z80_JIT
+#endif
+#define JIT_THRESHOLD 16			// runs of a block before it gets compiled
+#define JIT_DECLINED (~0U)			// Block::hits of a block that is mostly handler calls, it is never compiled
+#define JIT_ARENA_SIZE (4 << 20)	// bytes of executable memory per CPU, flushed as a whole when full
+
+// register that the hl opcodes work on, selected by the DD / FD prefix
+#define INDEX_HL 0
+#define INDEX_IX 1
+#define INDEX_IY 2
+
+// computed goto (labels as values) is a GCC/Clang extension, other compilers use the handler table instead
+#if defined(__GNUC__) || defined(__clang__)
+#define Z80_THREADED_DISPATCH
+#endif
 
 /*
 Resources:
@@ -20,6 +71,8 @@ http://www.zophar.net/fileuploads/2/10807fvllz/z80-1.txt
 
 class CPU
 {
+	friend class Lockstep;	// runs the registers of many CPUs side by side
+
 public:
 	CPU();
 	~CPU();
@@ -27,9 +80,129 @@ public:
 	void test();
 	void emulateCycle();
 
+	// instruction dispatch engines, all of them execute the same opcode bodies (opcodes.inl)
+	enum Dispatch
+	{
+		DISPATCH_SWITCH,	// one big switch
+		DISPATCH_TABLE,		// table of handler member functions
+		DISPATCH_THREADED,	// computed goto threaded code (falls back to DISPATCH_TABLE if unsupported)
+		DISPATCH_BLOCKS,	// basic blocks decoded once into a cache of handlers
+		DISPATCH_JIT,		// hot basic blocks compiled to x86-64 (falls back to DISPATCH_BLOCKS if unsupported)
+	};
+
+	enum StopReason
+	{
+		STOP_NONE,
+		STOP_BUDGET,			// used up the instruction or cycle budget
+		STOP_HALT,				// executed a halt
+		STOP_BREAKPOINT,		// PC reached a breakpoint, the instruction there has not been executed
+		STOP_INVALID_OPCODE,	// PC is at an opcode that is not implemented
+	};
+
+	struct RunResult
+	{
+		StopReason reason;
+		unsigned long long instructions; // instructions executed
+		unsigned long long cycles; // T-states used
+	};
+
+	struct Registers
+	{
+		unsigned short AF, BC, DE, HL, IX, IY, SP, PC;
+		unsigned char I, R;
+	};
+
+	// executes up to [budget] instructions in one tight loop
+	RunResult run(unsigned long long budget, Dispatch engine = DISPATCH_THREADED);
+	// executes until at least [budget] T-states are used, the last instruction may go over the budget
+	RunResult runCycles(unsigned long long budget, Dispatch engine = DISPATCH_THREADED);
+	// T-states executed since power on
+	unsigned long long getCycles() const;
+	bool sameState(const CPU& other) const;
+	Registers getRegisters();
+	// FNV-1a of all of RAM, for comparing the memory of two runs
+	unsigned long long hashRAM() const;
+	// copies [bytes] to [address] through the store path, as if a program wrote them
+	void writeMemory(const unsigned short address, const std::string& bytes);
+
+	void setBreakpoint(unsigned short address);
+	void clearBreakpoint(unsigned short address);
+	void clearBreakpoints();
+
+	// records every executed instruction into [buffer], NULL turns tracing off
+	// the buffer is not owned by the CPU
+	void setTrace(TraceBuffer* buffer);
+	// counts executions and T-states per PC and call stack into [profile], NULL turns profiling off
+	// the profiler is not owned by the CPU
+	void setProfiler(Profiler* profile);
+	// fires the events of [events] at their deadlines during runs, NULL for none
+	// the scheduler is not owned by the CPU, and its events are not part of snapshots
+	void setScheduler(Scheduler* events);
+
+	// Interrupts are taken between two instructions, when run() reaches a scheduler deadline or the program enables them
+	// the engines never poll for them
+	// requests the maskable interrupt, pending until it is taken or cancelled. [bus] is what the device puts on the data bus:
+	// the instruction in im 0 (rst n only, anything else runs rst 38h) or the low byte of the vector address in im 2
+	void requestInterrupt(unsigned char bus = 0xFF);
+	void cancelInterrupt();
+	// a non-maskable interrupt, taken at the next instruction boundary whatever IFF1 is
+	void requestNMI();
+	// a halt waits for an interrupt whenever one can come: IFF1 is set and one is pending or the scheduler has events,
+	// it ends the run with STOP_HALT otherwise
+	bool isHalted() const { return halted; }
+	// instructions a halt or a polling loop passed over without running them, counted in RunResult::instructions as well
+	unsigned long long getIdleInstructions() const { return idleInstructions; }
+
+	enum HleMode
+	{
+		HLE_OFF,	// rst 28h always runs the ROM
+		HLE_NATIVE,	// B_CALLs (rst 28h followed by the routine address) with a native implementation skip the ROM
+		HLE_CHECK,	// B_CALLs run the ROM and the native result is compared with it when the routine returns
+	};
+	struct HleStats
+	{
+		unsigned long long native;		// B_CALLs run natively
+		unsigned long long rom;			// B_CALLs that ran the ROM routine
+		unsigned long long checked;		// ROM routines compared with the native result
+		unsigned long long mismatches;
+		unsigned short lastMismatch;	// address of the last B_CALL that did not match
+	};
+	// TI-83 Plus OS routines in C++, see hle.cpp for the ones there are. They take no T-states beyond the rst
+	void setHle(HleMode mode);
+	const HleStats& getHleStats() const { return hleStats; }
+	// the text native B_CALLs displayed, rows end in '\n'
+	const std::string& getHleOutput() const { return hleOutput; }
+
+	// Saves the registers, ports, mapping and RAM into [out], only the pages written since the last snapshot are copied
+	// breakpoints, the trace buffer, the profiler and the HLE state are not part of the state
+	void snapshot(Snapshot& out);
+	// false (and nothing changed) when [in] is empty or was taken with a different amount of flash
+	// only the pages that differ from [in] are copied back, cached code elsewhere is kept
+	bool restore(const Snapshot& in);
+
 // non-CPU specific functions
-private:
-	bool loadROM(const std::string& fileName);
+public:
+	enum LoadResult
+	{
+		LOAD_OK,
+		LOAD_OPEN_FAILED,	// the file does not exist or could not be mapped
+		LOAD_BAD_SIZE,		// too big for where it goes, or a flash file that is not whole pages
+		LOAD_READ_ONLY,		// a bank the program goes to is mapped read-only (flash)
+	};
+	static const char* loadResultText(LoadResult result);
+
+	// a program of up to MAX_ROM_SIZE bytes, copied to ROM_START
+	LoadResult loadROM(const std::string& fileName);
+	LoadResult loadROMImage(const std::string& rom);
+	// up to FLASH_PAGES pages of a TI-83 Plus flash, from then on ports 6 and 7 page it in
+	// bank 0 is flash page 0, bank 3 RAM page 0 and banks 1 and 2 start as flash page 0 and RAM page 1
+	// loadFlash maps the file into the banks as is, it stays open as long as the CPU uses it
+	LoadResult loadFlash(const std::string& fileName);
+	LoadResult loadFlashImage(const std::string& image);
+	// [image] is copied to the start of RAM, a whole number of pages (32 KB or 48 KB) also sets how many pages the ports select from
+	LoadResult loadRAMImage(const std::string& image);
+	// a load through the current mapping
+	inline char read8(const unsigned short where) const { return readBanks[where >> BANK_SHIFT][where & (BANK_SIZE - 1)]; }
 
 // registers
 private:
@@ -42,72 +215,130 @@ private:
 	signed char H;
 	signed char L;
 
-	unsigned char F;		// flag register
+	unsigned char F;		// flag register, only up to date when flagKind is FLAGS_NONE
+
+	// Lazy flags: the 8 bit ALU records its operation here instead of updating F
+	// F is built from the record the first time something needs more than sign, zero or carry
+	enum FlagKind
+	{
+		FLAGS_NONE,		// F is up to date
+		FLAGS_ADD,		// add, adc
+		FLAGS_SUB,		// sub, sbc, cp
+		FLAGS_INC,
+		FLAGS_DEC,
+		FLAGS_AND,
+		FLAGS_LOGIC,	// or, xor, rotates and shifts (carry in bit 8 of the result)
+	};
+	unsigned char flagKind;
+	unsigned char flagOp1;		// operands of the recorded operation
+	unsigned char flagOp2;
+	unsigned short flagResult;	// 8 bit result in the low byte, carry out in bit 8
+
+	unsigned char computeFlags() const;
+	void syncFlags();
+	unsigned char getF();
+	void setF(const unsigned char val);
 
 	// decode flag register bits
-	inline bool sign() { return F & 0x80; }
-	inline bool zero() { return F & 0x40; }
-	inline bool half_carry() { return F & 0x10; }
-	inline bool parity() { return F & 0x4; }
+	inline bool sign() { return (flagKind == FLAGS_NONE) ? (F & FLAG_S) != 0 : (flagResult & 0x80) != 0; }
+	inline bool zero() { return (flagKind == FLAGS_NONE) ? (F & FLAG_Z) != 0 : (flagResult & 0xFF) == 0; }
+	inline bool half_carry() { return (getF() & FLAG_H) != 0; }
+	inline bool parity() { return (getF() & FLAG_PV) != 0; }
 #define overflow() parity()
-	inline bool N() { return F & 0x2; } // add or subtract
-	inline bool carry() { return F & 0x1; }
+	inline bool N() { return (getF() & FLAG_N) != 0; } // add or subtract
+	inline bool carry() { return (flagKind == FLAGS_NONE) ? (F & FLAG_C) != 0 : (flagResult & 0x100) != 0; }
 
 	// 16 bit registers
-	inline short AF() { return ((A << 8) | (F & 0xFF)); }
+	inline short AF() { return ((A << 8) | getF()); }
 	inline short BC() { return ((B << 8) | (C & 0xFF)); }
 	inline short DE() { return ((D << 8) | (E & 0xFF)); }
 	inline short HL() { return ((H << 8) | (L & 0xFF)); }
+	inline short IX() { return ((IXH << 8) | (IXL & 0xFF)); }
+	inline short IY() { return ((IYH << 8) | (IYL & 0xFF)); }
 
-	inline void AF(signed short val) { A = ((val >> 8) & 0xFF); F = (char)val; } // For Hb: shift the value up and mask off lower bits
+	inline void AF(signed short val) { A = ((val >> 8) & 0xFF); setF((char)val); } // For Hb: shift the value up and mask off lower bits
 	inline void BC(signed short val) { B = ((val >> 8) & 0xFF); C = (char)val; } // For Lb: cast to char which automatically masks upper bits
 	inline void DE(signed short val) { D = ((val >> 8) & 0xFF); E = (char)val; }
 	inline void HL(signed short val) { H = ((val >> 8) & 0xFF); L = (char)val; }
+	inline void IX(signed short val) { IXH = ((val >> 8) & 0xFF); IXL = (char)val; }
+	inline void IY(signed short val) { IYH = ((val >> 8) & 0xFF); IYL = (char)val; }
 
 	char I;		// interrupt page address register
-	short IX, IY;	// 16 bit index registers ~!GB
+	signed char IXH, IXL, IYH, IYL;	// 16 bit index registers ~!GB
 	unsigned short PC;		// program counter register
-	char R;		// memory refresh register TODO: implement this
+	char R;		// memory refresh register, counts every opcode fetch in all 8 bits, only the low 7 are the register's
+	char R7;	// bit 7 of R, which only ld r, a changes
+	bool IFF1, IFF2;		// interrupt enable flip flops
+	unsigned char interruptMode;	// im 0 / 1 / 2
+	bool halted;			// a halt is waiting for an interrupt, PC is past it
+	bool interruptPending;	// requested by a device and not yet taken
+	bool nmiPending;
+	unsigned char interruptBus;		// what the device that requested the interrupt puts on the data bus
+	unsigned long long eiCycles;	// cycles when the last ei finished, the instruction after it runs before any maskable interrupt
+	unsigned long long idleInstructions;
+
+	inline char refresh() const { return (R & 0x7F) | R7; }
 	unsigned short SP;		// stack pointer
 
-	char* mem;
+	// page-pointer tables, switching a bank only swaps its pointers
+	char* readBanks[NUM_BANKS];
+	char* writeBanks[NUM_BANKS];	// a read-only bank points at writeSink, so stores need no check
+	unsigned char codePages[(0x10000 >> CODE_PAGE_SHIFT) / 8];	// one bit per page that holds cached blocks or RAM shared with a snapshot, checked by every store
+	unsigned char bankPages[NUM_BANKS];	// page mapped in each bank, as written to the paging ports
+	bool bankReadOnly[NUM_BANKS];
+	bool banksAliased;		// two banks map the same page, code cached under one address can be written through the other
+
+	char* ram;				// RAM_PAGES pages
+	char* flash;			// flashPages pages, NULL until a flash image is loaded
+	char* ownedFlash;		// flash when it was copied from an image
+	MappedFile* flashFile;	// flash when it is mapped from a file
+	char* writeSink;		// swallows the stores to read-only banks
+	unsigned int ramPages;	// pages the paging ports choose from
+	unsigned int flashPages;
+
 	char ports[NUM_PORTS];
 
-// Flag helper functions
+	TraceBuffer* trace;
+	Profiler* profiler;
+	Scheduler* scheduler;
+
+	HleMode hleMode;
+	HleStats hleStats;
+	std::string hleOutput;
+	BCallCheck* bcallCheck;	// the B_CALL whose ROM routine is running to be compared, NULL when none is
+
+	// the copy of each RAM page held by the last snapshot, NULL once the page was written since
+	std::shared_ptr<const SnapshotPage> savedPages[SNAPSHOT_PAGES];
+	unsigned int unsharedPages;	// savedPages entries dropped by stores so far, only ever counts up
+
+// run state
 private:
-	inline void updateSign(short reg);
-	inline void resetSign();
-	inline void setSign();
-	 
-	inline void updateZero(short reg);
-	inline void resetZero();
-	inline void setZero();
-	 
-	inline void updateHC(short reg);
-	inline void resetHC();
-	inline void setHC();
-	 
-	inline void updateParity(char reg);
-	inline void resetParity();
-	inline void setParity();
-
-	inline void updateOverflow(short reg);
-	inline void resetOverflow();
-	inline void setOverflow();
-
-	inline void updateN(bool add);
-	inline void resetN();
-	inline void setN();
-
-	inline void updateCarry(short reg);
-	inline void resetCarry();
-	inline void setCarry();
+	unsigned long long cycles;		// T-states since power on
+	unsigned long long remaining;	// instructions left in the current run
+	unsigned long long cycleLimit;	// the engines stop once cycles reaches this, the run's limit or the next event
+	StopReason stopReason;			// set by stop() to end the current run early
+	bool slowFetch;					// fetch() has to go through fetchSlow()
+	bool ignoreBreakpoint;			// the first instruction of a run does not stop at a breakpoint
+	unsigned char breakpoints[0x10000 / 8];
+	unsigned int breakpointCount;
 
 // opcode functions
 private:
 	inline void jr(bool cond, signed char to, unsigned char opsize);
 	void jp(bool cond, signed short to, unsigned char opsize);
-	void cmp(const char val);
+	void lazyFlags(unsigned char kind, unsigned char op1, unsigned char op2, unsigned short result);
+	void add8(const unsigned char val);
+	void adc8(const unsigned char val);
+	void sub8(const unsigned char val);
+	void sbc8(const unsigned char val);
+	void and8(const unsigned char val);
+	void xor8(const unsigned char val);
+	void or8(const unsigned char val);
+	void cmp(const unsigned char val);
+	unsigned char inc8(const unsigned char val);
+	unsigned char dec8(const unsigned char val);
+	template<unsigned char index> void add16(const unsigned short val);
+	void daa();
 	void ret(bool cond);
 	void call(bool cond);
 	void rst(const unsigned char mode);
@@ -117,14 +348,181 @@ private:
 	inline const short get16(const short where);
 	inline void set16(unsigned short& dst, const short val);
 
+	typedef void (CPU::*OpHandler)();
+	static const OpHandler opTable[256];
+
+	// returned by fetch() instead of an opcode when the run has to stop
+	static const unsigned int STOP_OPCODE = 0x100;
+
+	RunResult run(unsigned long long instructionBudget, unsigned long long cycleBudget, Dispatch engine);
+	inline unsigned int fetch();
+	unsigned int fetchSlow();
+	void updateSlowFetch();
+	void stop(StopReason reason);
+	void traceInstruction(unsigned char opcode);
+	bool nativeBCall();
+	void checkBCallReturn();
+	void dropBCallCheck();
+	bool isBreakpoint(unsigned short address) const;
+
+	template<unsigned char opcode> void executeOpcode();
+	template<unsigned char opcode> void executeCB();
+	static const OpHandler cbTable[256];
+
+	template<unsigned char reg> inline unsigned char getReg();
+	template<unsigned char reg> inline void setReg(const unsigned char val);
+	template<unsigned char operation> inline unsigned char shift(const unsigned char val);
+	template<unsigned char bit> inline void testBit(const unsigned char val);
+
+	// hl, or the index register that replaces it after a DD / FD prefix
+	template<unsigned char index> inline signed char& regH();
+	template<unsigned char index> inline signed char& regL();
+	template<unsigned char index> inline short regHL();
+	template<unsigned char index> inline void regHL(const signed short val);
+	template<unsigned char index> inline unsigned short addrHL();	// (hl), or (ix + d) / (iy + d) with d at mem[PC + 1]
+	template<unsigned char index> static constexpr unsigned char dispBytes() { return (index == INDEX_HL) ? 0 : 1; }
+
+	template<unsigned char index> void executeIndexed(unsigned char opcode);
+	template<unsigned char opcode> void executeIndexedCB(const unsigned short address);
+	typedef void (CPU::*IndexedCBHandler)(const unsigned short address);
+	static const IndexedCBHandler indexedCBTable[256];
+
+	template<unsigned char opcode> void executeED();
+	static const OpHandler edTable[256];
+
+	template<unsigned char pair> inline unsigned short getPair();
+	template<unsigned char pair> inline void setPair(const unsigned short val);
+	inline unsigned short read16(const unsigned short where);
+	inline void write16(const unsigned short where, const unsigned short val);
+	// every store of an instruction goes through here so that cached blocks see self modifying code
+	inline void write8(const unsigned short where, const unsigned char val) { store8(where, val); if (isCodePage(where)) { invalidateCode(where, 1); } }
+	inline void store8(const unsigned short where, const unsigned char val) { writeBanks[where >> BANK_SHIFT][where & (BANK_SIZE - 1)] = val; }
+	char* bankPointer(char* const* banks, const unsigned short address, const unsigned int count) const;
+	void mapBank(const unsigned char bank, const unsigned char page);
+	LoadResult loadROMData(const char* rom, const size_t size);
+	void mapFlash(char* pages, const unsigned int count);
+	void releaseFlash();
+	inline unsigned char readPort(const unsigned char port);
+	inline void writePort(const unsigned char port, const unsigned char val);
+	void adc16(const unsigned short val);
+	void sbc16(const unsigned short val);
+	unsigned int blockIterations(unsigned int count, const unsigned int cyclesPerIteration);
+	unsigned int beforeOwnBytes(unsigned int count, const unsigned short dst, const int step) const;
+	void finishBlock(const unsigned int count, const unsigned char baseCycles, const bool repeating);
+	template<int step, bool repeat> void blockLoad();
+	template<int step, bool repeat> void blockCompare();
+	template<int step, bool repeat> void blockIn();
+	template<int step, bool repeat> void blockOut();
+	void dispatchSwitch(unsigned char opcode);
+	void runSwitch();
+	bool stepSwitch();
+	void runTable();
+	void runThreaded();
+
+	// one decoded instruction of a cached block
+	// prefixed instructions are resolved to their CB / ED handler, PC is moved past the prefix and opcode first
+	struct MicroOp
+	{
+		OpHandler handler;
+#ifdef Z80_THREADED_DISPATCH
+		void* label;			// opcode body in runBlocks, or the label that calls the handler
+#endif
+		unsigned char skip;		// added to PC before calling the handler
+		unsigned char cycles;	// T-states added up front for the whole block
+		unsigned char refresh;	// R increments added up front for the whole block
+		unsigned short address;	// of the first byte of the instruction, prefix included
+	};
+
+	struct Block
+	{
+		unsigned int entry;			// PC of the first instruction, NO_BLOCK when the entry is free
+		unsigned int end;			// one past the last byte of the last instruction
+		unsigned int count;
+		unsigned int cycles;		// sum of the cycles of every op
+		unsigned int refresh;		// sum of the refresh of every op
+		unsigned int cyclesBeforeLast;	// T-states of every instruction but the last, prefixes included
+		unsigned int idleTries;		// jumps back to its entry and stores nothing, a loop that may be polling (runIdleLoop), 0 if not
+#ifdef Z80_JIT
+		unsigned int hits;			// runs through the handlers, the block is compiled at JIT_THRESHOLD unless JIT_DECLINED
+		unsigned char* native;		// compiled code, NULL until then
+#endif
+		MicroOp ops[BLOCK_MAX_OPS];
+	};
+	static const unsigned int NO_BLOCK = 0x10000;
+
+	Block* blocks;			// allocated by the first run with DISPATCH_BLOCKS
+	std::vector<unsigned short> pageBlocks[0x10000 >> CODE_PAGE_SHIFT];	// cached blocks with bytes on each page
+	Block* currentBlock;		// block being executed by runBlocks
+	const MicroOp* blockEnd;	// end of the ops of currentBlock, cut short when the block overwrites itself
+#ifdef Z80_THREADED_DISPATCH
+	static std::atomic<void* const*> blockLabels;	// opcode bodies of runBlocks followed by the handler call, set by whichever thread runs it first
+#endif
+
+	void runBlocks(const bool compile);	// hot blocks go to runCompiled when [compile]
+	Block* nextBlock();
+	void translateBlock(Block& block);
+	const MicroOp* beginBlock(Block& block);
+	void endBlock(Block& block, const MicroOp* op);
+	void executeBlock(Block& block);
+	void runIdleLoop(Block& block);
+	bool isIdleLoop(const Block& block) const;
+	void dropBlock(Block& block);
+	void dropBlocks(const unsigned short address, const unsigned int size);
+	void markCodePage(const unsigned int page);
+	void updateCodePages();
+	inline bool isCodePage(const unsigned short address) const { return (codePages[address >> (CODE_PAGE_SHIFT + 3)] >> ((address >> CODE_PAGE_SHIFT) & 7)) & 1; }
+	void invalidateCode(const unsigned short address, const unsigned int size);
+	void flushBlocks();
+
+	unsigned int ramPageAt(const unsigned int page) const;
+	bool isSharedPage(const unsigned int page) const;
+	void unsharePages(const unsigned short address, const unsigned int size);
+	void dropSharedPages();
+	void dropRAMBlocks(const unsigned int index);
+
+	void runJit();
+#ifdef Z80_JIT
+	// a static exit of compiled code to another block, it jumps straight into that block's code while there is some
+	struct JitLink
+	{
+		unsigned int offset;	// of the rel32 of the jump in jitArena
+		unsigned int fromCode;	// offset of the code of the block the exit is in, the link is dead once it has other or none
+		unsigned short from;	// cache index of that block
+	};
+
+	unsigned char* jitArena;	// mapped by the first run with DISPATCH_JIT
+	unsigned int jitStart;		// arena bytes taken by the entry and exit code
+	unsigned int jitUsed;
+	bool jitUnavailable;		// the arena could not be mapped, DISPATCH_JIT runs DISPATCH_BLOCKS
+	bool jitFlushed;			// compiled code was dropped while running, checked after every call out of compiled code
+	unsigned char* jitEnter;	// void (*)(CPU* cpu, unsigned char* code)
+	unsigned char* jitLeave;
+	unsigned char* jitReturn;	// jitLeave past the spill, for exits that already spilled the registers
+	std::unordered_map<unsigned short, std::vector<JitLink> > jitLinks;	// by the PC they go to, linked or not
+
+	bool initJit();
+	void freeJit();
+	void flushJit();
+	void dropNative(Block& block);
+	bool isLinkLive(const JitLink& link) const;
+	void compileBlock(Block& block);
+	bool runCompiled(Block& block);
+	static void jitFallback(CPU* cpu, const unsigned int op);
+	static void jitStore(CPU* cpu, const unsigned int address);
+#endif
+
 	void decodeIXInstruction(char opcode);
 	void decodeIYInstruction(char opcode);
 	void decodeExtendedInstruction(char opcode);
-	void decodeBitInstruction(char opcode);
+	template<unsigned char index> void decodeBitInstruction();
 
-// interrupt functions TODO: implement these
+// interrupt functions
 private:
 	void halt();
+	void enableInterrupts();
+	void interrupt();
+	void enterInterrupt(const unsigned short address, const unsigned char cyclesTaken);
+	void idle();
 };
 
 #endif
\ No newline at end of file
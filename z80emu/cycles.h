@@ -0,0 +1,26 @@
+#ifndef Z80_CYCLES_H
+#define Z80_CYCLES_H
+
+// T-states per opcode, indexed by the opcode byte after any prefixes
+extern const unsigned char cyclesMain[256];
+extern const unsigned char cyclesCB[256];
+extern const unsigned char cyclesED[256];
+extern const unsigned char cyclesXY[256];	// 0xDD / 0xFD
+extern const unsigned char cyclesXYCB[256];	// 0xDD 0xCB / 0xFD 0xCB
+
+// extra T-states when a conditional instruction takes its branch
+// (jp cc costs the same either way)
+#define CYCLES_JR_TAKEN 5
+#define CYCLES_DJNZ_TAKEN 5
+#define CYCLES_CALL_TAKEN 7
+#define CYCLES_RET_TAKEN 6
+#define CYCLES_BLOCK_REPEAT 5 // ldir, cpir, inir, otir and their decrementing versions
+
+// taking an interrupt, the push and the jump included
+#define CYCLES_NMI 11
+#define CYCLES_IM0 13 // rst n from the data bus
+#define CYCLES_IM1 13
+#define CYCLES_IM2 19
+#define CYCLES_HALTED 4 // each NOP a halted CPU runs
+
+#endif
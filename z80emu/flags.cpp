@@ -0,0 +1,93 @@
+#include "flags.h"
+
+// Tables are built with the same xor tricks an ALU would use...
+static constexpr unsigned char sz(const unsigned int result)
+{
+	return (result & FLAG_S) | ((result & 0xFF) ? 0 : FLAG_Z);
+}
+
+static constexpr unsigned char szp(const unsigned int result)
+{
+	return sz(result) | ((((0x6996 >> (result & 0xF)) ^ (0x6996 >> ((result >> 4) & 0xF))) & 1) ? 0 : FLAG_PV);
+}
+
+static constexpr FlagTables buildFlagTables()
+{
+	FlagTables tables = {};
+	for (unsigned int a = 0; a < 256; a++)
+	{
+		tables.szp[a] = szp(a);
+		tables.inc[a] = sz(a + 1) | (((a & 0xF) == 0xF) ? FLAG_H : 0) | ((a == 0x7F) ? FLAG_PV : 0);
+		tables.dec[a] = sz(a - 1) | (((a & 0xF) == 0) ? FLAG_H : 0) | ((a == 0x80) ? FLAG_PV : 0) | FLAG_N;
+		for (unsigned int carry = 0; carry < 2; carry++)
+		{
+			for (unsigned int val = 0; val < 256; val++)
+			{
+				const unsigned int sum = a + val + carry;
+				tables.add[carry][a][val] = sz(sum) | ((a ^ val ^ sum) & FLAG_H) |
+					((((a ^ sum) & (val ^ sum)) >> 5) & FLAG_PV) | (sum >> 8);
+
+				const unsigned int diff = (a - val - carry) & 0x1FF;
+				tables.sub[carry][a][val] = sz(diff) | ((a ^ val ^ diff) & FLAG_H) |
+					((((a ^ val) & (a ^ diff)) >> 5) & FLAG_PV) | FLAG_N | (diff >> 8);
+			}
+		}
+	}
+	return tables;
+}
+
+constexpr FlagTables flagTables = buildFlagTables();
+
+// ...and checked entry by entry against a model that follows the Z80 manual one flag at a time
+static constexpr unsigned char referenceParity(const unsigned int val, const unsigned int bit)
+{
+	return (bit == 8) ? FLAG_PV : ((val >> bit) & 1) ? referenceParity(val, bit + 1) ^ FLAG_PV : referenceParity(val, bit + 1);
+}
+
+static constexpr unsigned char referenceSZ(const int result)
+{
+	return ((result & 0xFF) >= 0x80 ? FLAG_S : 0) | ((result & 0xFF) == 0 ? FLAG_Z : 0);
+}
+
+static constexpr unsigned char referenceAdd(const int a, const int val, const int carry)
+{
+	return referenceSZ(a + val + carry) |
+		(((a & 0xF) + (val & 0xF) + carry > 0xF) ? FLAG_H : 0) |
+		(((signed char)a + (signed char)val + carry > 127 || (signed char)a + (signed char)val + carry < -128) ? FLAG_PV : 0) |
+		((a + val + carry > 0xFF) ? FLAG_C : 0);
+}
+
+static constexpr unsigned char referenceSub(const int a, const int val, const int carry)
+{
+	return referenceSZ(a - val - carry) | FLAG_N |
+		(((a & 0xF) - (val & 0xF) - carry < 0) ? FLAG_H : 0) |
+		(((signed char)a - (signed char)val - carry > 127 || (signed char)a - (signed char)val - carry < -128) ? FLAG_PV : 0) |
+		((a - val - carry < 0) ? FLAG_C : 0);
+}
+
+static constexpr bool checkFlagTables()
+{
+	for (int a = 0; a < 256; a++)
+	{
+		if (flagTables.szp[a] != (referenceSZ(a) | referenceParity(a, 0)) ||
+			flagTables.inc[a] != (referenceAdd(a, 1, 0) & ~FLAG_C) ||
+			flagTables.dec[a] != (referenceSub(a, 1, 0) & ~FLAG_C))
+		{
+			return false;
+		}
+		for (int carry = 0; carry < 2; carry++)
+		{
+			for (int val = 0; val < 256; val++)
+			{
+				if (flagTables.add[carry][a][val] != referenceAdd(a, val, carry) ||
+					flagTables.sub[carry][a][val] != referenceSub(a, val, carry))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static_assert(checkFlagTables(), "flag tables do not match the reference model");
@@ -0,0 +1,25 @@
+#ifndef Z80_FLAGS_H
+#define Z80_FLAGS_H
+
+// flag register bits
+#define FLAG_C 0x01		// carry
+#define FLAG_N 0x02		// add (0) or subtract (1)
+#define FLAG_PV 0x04	// parity / overflow
+#define FLAG_H 0x10		// half carry
+#define FLAG_Z 0x40		// zero
+#define FLAG_S 0x80		// sign
+
+// Every flag result of the 8 bit ALU, generated at compile time
+// The undocumented bits 3 and 5 are not emulated and are always 0
+struct FlagTables
+{
+	unsigned char szp[256];				// sign, zero and parity of a result
+	unsigned char add[2][256][256];		// all of F for [carry in][a][value] of add and adc
+	unsigned char sub[2][256][256];		// all of F for [carry in][a][value] of sub, sbc and cp
+	unsigned char inc[256];				// F without the carry for inc of [value]
+	unsigned char dec[256];				// F without the carry for dec of [value]
+};
+
+extern const FlagTables flagTables;
+
+#endif
@@ -0,0 +1,417 @@
+#include "hle.h"
+#include "flags.h"
+
+#include <map>
+
+// TI-83 Plus OS RAM and flags (ti83plus.inc)
+#define TI_CUR_ROW 0x844B
+#define TI_CUR_COL 0x844C
+#define TI_OP1 0x8478
+#define TI_OP2 0x8483
+#define TI_OP3 0x848E
+#define TI_TEXT_SHADOW 0x8508
+#define TI_APP_FLAGS 13			// offset from IY, which the OS keeps at flags
+#define TI_APP_TEXT_SAVE 0x02	// characters also go to textShadow
+#define TI_APP_AUTO_SCROLL 0x04	// text scrolls up from the last row instead of going back to the first
+#define TI_ROWS 8
+#define TI_COLUMNS 16
+#define TI_OP_SIZE 11			// an OP register, the Mov9 routines copy the first 9 bytes
+
+// the B_CALL compared with the ROM routine that runs in its place
+struct BCallCheck
+{
+	const NativeBCallEntry* entry;
+	unsigned short returnPC;	// after the rst and its address
+	unsigned short returnSP;
+	CPU::Registers expected;
+	std::vector<std::pair<unsigned short, unsigned char> > writes;
+};
+
+BCallContext::BCallContext(const CPU& cpu, const CPU::Registers& registers) : registers(registers), cpu(cpu)
+{
+}
+
+unsigned char BCallContext::read8(const unsigned short where) const
+{
+	for (size_t i = writes.size(); i > 0; i--)
+	{
+		if (writes[i - 1].first == where)
+		{
+			return writes[i - 1].second;
+		}
+	}
+	return cpu.read8(where);
+}
+
+unsigned short BCallContext::read16(const unsigned short where) const
+{
+	return (unsigned short)(read8(where) | (read8((unsigned short)(where + 1)) << 8));
+}
+
+void BCallContext::write8(const unsigned short where, const unsigned char val)
+{
+	writes.push_back(std::make_pair(where, val));
+}
+
+void BCallContext::copy(const unsigned short to, const unsigned short from, const unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		write8((unsigned short)(to + i), read8((unsigned short)(from + i)));
+	}
+}
+
+void BCallContext::fill(const unsigned short to, const unsigned char val, const unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		write8((unsigned short)(to + i), val);
+	}
+}
+
+// _CpHLDE: compares HL with DE, Z when equal and C when HL is lower
+static void cpHLDE(BCallContext& call)
+{
+	const unsigned short hl = call.registers.HL;
+	const unsigned short de = call.registers.DE;
+	call.setF((call.getF() & ~(FLAG_Z | FLAG_C)) | ((hl == de) ? FLAG_Z : 0) | ((hl < de) ? FLAG_C : 0));
+}
+
+// _LdHLind: HL = (HL), A is the low byte
+static void ldHLind(BCallContext& call)
+{
+	const unsigned short val = call.read16(call.registers.HL);
+	call.setA(val & 0xFF);
+	call.registers.HL = val;
+}
+
+// _Mov9ToOP1 / _Mov9ToOP2: 9 bytes from (HL), HL and DE end up after the source and destination
+static void mov9To(BCallContext& call, const unsigned short op)
+{
+	call.copy(op, call.registers.HL, 9);
+	call.registers.HL += 9;
+	call.registers.DE = op + 9;
+}
+
+static void mov9ToOP1(BCallContext& call) { mov9To(call, TI_OP1); }
+static void mov9ToOP2(BCallContext& call) { mov9To(call, TI_OP2); }
+
+// _MovFrOP1: 9 bytes of OP1 to (DE)
+static void movFrOP1(BCallContext& call)
+{
+	call.copy(call.registers.DE, TI_OP1, 9);
+	call.registers.DE += 9;
+	call.registers.HL = TI_OP1 + 9;
+}
+
+static void op1ToOP2(BCallContext& call) { call.copy(TI_OP2, TI_OP1, TI_OP_SIZE); }
+static void op1ToOP3(BCallContext& call) { call.copy(TI_OP3, TI_OP1, TI_OP_SIZE); }
+static void op2ToOP1(BCallContext& call) { call.copy(TI_OP1, TI_OP2, TI_OP_SIZE); }
+
+static void op1ExOP2(BCallContext& call)
+{
+	unsigned char op1[TI_OP_SIZE];
+	for (unsigned int i = 0; i < TI_OP_SIZE; i++)
+	{
+		op1[i] = call.read8(TI_OP1 + i);
+	}
+	call.copy(TI_OP1, TI_OP2, TI_OP_SIZE);
+	for (unsigned int i = 0; i < TI_OP_SIZE; i++)
+	{
+		call.write8(TI_OP2 + i, op1[i]);
+	}
+}
+
+static void zeroOP1(BCallContext& call) { call.fill(TI_OP1, 0, TI_OP_SIZE); }
+static void zeroOP2(BCallContext& call) { call.fill(TI_OP2, 0, TI_OP_SIZE); }
+
+// _OP1Set0: real number 0, exponent 80h
+static void op1Set0(BCallContext& call)
+{
+	call.fill(TI_OP1, 0, 9);
+	call.write8(TI_OP1 + 1, 0x80);
+}
+
+static unsigned char appFlags(const BCallContext& call)
+{
+	return call.read8((unsigned short)(call.registers.IY + TI_APP_FLAGS));
+}
+
+// moves the cursor to the start of the next row, scrolling textShadow when it is on the last one
+static void nextRow(BCallContext& call)
+{
+	unsigned char row = call.read8(TI_CUR_ROW);
+	if (row + 1 < TI_ROWS)
+	{
+		row++;
+	}
+	else if (appFlags(call) & TI_APP_AUTO_SCROLL)
+	{
+		if (appFlags(call) & TI_APP_TEXT_SAVE)
+		{
+			call.copy(TI_TEXT_SHADOW, TI_TEXT_SHADOW + TI_COLUMNS, (TI_ROWS - 1) * TI_COLUMNS);
+			call.fill(TI_TEXT_SHADOW + (TI_ROWS - 1) * TI_COLUMNS, ' ', TI_COLUMNS);
+		}
+		row = TI_ROWS - 1;
+	}
+	else
+	{
+		row = 0;
+	}
+	call.write8(TI_CUR_ROW, row);
+	call.write8(TI_CUR_COL, 0);
+	call.output += '\n';
+}
+
+// the character at the cursor, which moves on to the next column or row
+static void putChar(BCallContext& call, const unsigned char ch)
+{
+	const unsigned char row = call.read8(TI_CUR_ROW) % TI_ROWS;
+	const unsigned char col = call.read8(TI_CUR_COL) % TI_COLUMNS;
+	if (appFlags(call) & TI_APP_TEXT_SAVE)
+	{
+		call.write8(TI_TEXT_SHADOW + row * TI_COLUMNS + col, ch);
+	}
+	call.output += (char)ch;
+	if (col + 1 < TI_COLUMNS)
+	{
+		call.write8(TI_CUR_COL, col + 1);
+	}
+	else
+	{
+		nextRow(call);
+	}
+}
+
+// _PutC: the character in A
+static void putC(BCallContext& call)
+{
+	putChar(call, call.getA());
+}
+
+// _PutS: the zero terminated string at HL, HL ends up after the terminator
+static void putS(BCallContext& call)
+{
+	unsigned short at = call.registers.HL;
+	for (unsigned int i = 0; i < 0x10000; i++)
+	{
+		const unsigned char ch = call.read8(at++);
+		if (ch == 0)
+		{
+			break;
+		}
+		putChar(call, ch);
+	}
+	call.registers.HL = at;
+}
+
+// _NewLine
+static void newLine(BCallContext& call)
+{
+	nextRow(call);
+}
+
+// _DispHL: HL in decimal, right aligned in 5 columns
+static void dispHL(BCallContext& call)
+{
+	char digits[5];
+	unsigned int val = call.registers.HL;
+	for (int i = 4; i >= 0; i--)
+	{
+		digits[i] = (i == 4 || val != 0) ? (char)('0' + val % 10) : ' ';
+		val /= 10;
+	}
+	for (unsigned int i = 0; i < 5; i++)
+	{
+		putChar(call, digits[i]);
+	}
+}
+
+// _homeup: cursor to the top left
+static void homeup(BCallContext& call)
+{
+	call.write8(TI_CUR_ROW, 0);
+	call.write8(TI_CUR_COL, 0);
+}
+
+// _ClrLCDFull: there is no LCD to clear
+static void clrLCDFull(BCallContext&)
+{
+}
+
+// _ClrTxtShd
+static void clrTxtShd(BCallContext& call)
+{
+	call.fill(TI_TEXT_SHADOW, ' ', TI_ROWS * TI_COLUMNS);
+}
+
+// _ClrScrnFull: the LCD and textShadow when text is saved
+static void clrScrnFull(BCallContext& call)
+{
+	if (appFlags(call) & TI_APP_TEXT_SAVE)
+	{
+		clrTxtShd(call);
+	}
+}
+
+// _EraseEOL: from the cursor to the end of its row, the cursor stays
+static void eraseEOL(BCallContext& call)
+{
+	if (appFlags(call) & TI_APP_TEXT_SAVE)
+	{
+		const unsigned char row = call.read8(TI_CUR_ROW) % TI_ROWS;
+		const unsigned char col = call.read8(TI_CUR_COL) % TI_COLUMNS;
+		call.fill(TI_TEXT_SHADOW + row * TI_COLUMNS + col, ' ', TI_COLUMNS - col);
+	}
+}
+
+// sorted by address
+static const NativeBCallEntry nativeBCalls[] =
+{
+	{ 0x4009, "_LdHLind", ldHLind, HLE_OUT_A | HLE_OUT_HL, 0 },
+	{ 0x400C, "_CpHLDE", cpHLDE, 0, FLAG_Z | FLAG_C },
+	{ 0x4123, "_OP1ToOP3", op1ToOP3, 0, 0 },
+	{ 0x412F, "_OP1ToOP2", op1ToOP2, 0, 0 },
+	{ 0x4156, "_OP2ToOP1", op2ToOP1, 0, 0 },
+	{ 0x417A, "_Mov9ToOP1", mov9ToOP1, HLE_OUT_DE | HLE_OUT_HL, 0 },
+	{ 0x4180, "_Mov9ToOP2", mov9ToOP2, HLE_OUT_DE | HLE_OUT_HL, 0 },
+	{ 0x4183, "_MovFrOP1", movFrOP1, HLE_OUT_DE | HLE_OUT_HL, 0 },
+	{ 0x41BF, "_OP1Set0", op1Set0, 0, 0 },
+	{ 0x41C5, "_ZeroOP1", zeroOP1, 0, 0 },
+	{ 0x41C8, "_ZeroOP2", zeroOP2, 0, 0 },
+	{ 0x421F, "_OP1ExOP2", op1ExOP2, 0, 0 },
+	{ 0x4504, "_PutC", putC, 0, 0 },
+	{ 0x4507, "_DispHL", dispHL, 0, 0 },
+	{ 0x450A, "_PutS", putS, HLE_OUT_HL, 0 },
+	{ 0x452E, "_NewLine", newLine, 0, 0 },
+	{ 0x4540, "_ClrLCDFull", clrLCDFull, 0, 0 },
+	{ 0x4546, "_ClrScrnFull", clrScrnFull, 0, 0 },
+	{ 0x454C, "_ClrTxtShd", clrTxtShd, 0, 0 },
+	{ 0x4552, "_EraseEOL", eraseEOL, 0, 0 },
+	{ 0x4558, "_homeup", homeup, 0, 0 },
+};
+
+const NativeBCallEntry* findNativeBCall(const unsigned short address)
+{
+	size_t low = 0;
+	size_t high = sizeof(nativeBCalls) / sizeof(nativeBCalls[0]);
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		if (nativeBCalls[middle].address == address)
+		{
+			return &nativeBCalls[middle];
+		}
+		if (nativeBCalls[middle].address < address)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+// Called by rst 28h with PC still at the rst, true when the call was handled natively and PC is past its address
+// In HLE_CHECK the native result is only recorded and the ROM routine runs, checkBCallReturn compares them once it returns
+bool CPU::nativeBCall()
+{
+	const unsigned short address = (unsigned short)((unsigned char)read8(PC + 1) | ((unsigned char)read8(PC + 2) << 8));
+	const NativeBCallEntry* entry = findNativeBCall(address);
+	if (entry == NULL)
+	{
+		hleStats.rom++;
+		return false;
+	}
+
+	BCallContext call(*this, getRegisters());
+	entry->run(call);
+	hleOutput += call.output;
+
+	if (hleMode == HLE_CHECK)
+	{
+		hleStats.rom++;
+		// one at a time, a B_CALL made while the ROM runs another one is not checked
+		if (bcallCheck == NULL)
+		{
+			bcallCheck = new BCallCheck();
+			bcallCheck->entry = entry;
+			bcallCheck->returnPC = PC + 3;
+			bcallCheck->returnSP = SP;
+			bcallCheck->expected = call.registers;
+			bcallCheck->writes = call.getWrites();
+			slowFetch = true;
+		}
+		return false;
+	}
+
+	const std::vector<std::pair<unsigned short, unsigned char> >& writes = call.getWrites();
+	for (size_t i = 0; i < writes.size(); i++)
+	{
+		write8(writes[i].first, writes[i].second);
+	}
+	A = call.getA();
+	setF(call.getF());
+	BC(call.registers.BC);
+	DE(call.registers.DE);
+	HL(call.registers.HL);
+	IX(call.registers.IX);
+	IY(call.registers.IY);
+	PC += 3;
+	hleStats.native++;
+	return true;
+}
+
+// from fetchSlow while a check is pending, compares once the ROM routine is back where the B_CALL returns to
+void CPU::checkBCallReturn()
+{
+	if (PC != bcallCheck->returnPC || SP != bcallCheck->returnSP)
+	{
+		return;
+	}
+
+	const NativeBCallEntry& entry = *bcallCheck->entry;
+	const Registers actual = getRegisters();
+	const Registers& expected = bcallCheck->expected;
+	bool same = ((actual.AF ^ expected.AF) & entry.flags) == 0;
+	same &= !(entry.outputs & HLE_OUT_A) || (actual.AF >> 8) == (expected.AF >> 8);
+	same &= !(entry.outputs & HLE_OUT_BC) || actual.BC == expected.BC;
+	same &= !(entry.outputs & HLE_OUT_DE) || actual.DE == expected.DE;
+	same &= !(entry.outputs & HLE_OUT_HL) || actual.HL == expected.HL;
+
+	std::map<unsigned short, unsigned char> stored;
+	for (size_t i = 0; i < bcallCheck->writes.size(); i++)
+	{
+		stored[bcallCheck->writes[i].first] = bcallCheck->writes[i].second;
+	}
+	for (std::map<unsigned short, unsigned char>::const_iterator i = stored.begin(); i != stored.end(); ++i)
+	{
+		same &= (unsigned char)read8(i->first) == i->second;
+	}
+
+	hleStats.checked++;
+	if (!same)
+	{
+		hleStats.mismatches++;
+		hleStats.lastMismatch = entry.address;
+	}
+	dropBCallCheck();
+	updateSlowFetch();
+}
+
+void CPU::dropBCallCheck()
+{
+	delete bcallCheck;
+	bcallCheck = NULL;
+}
+
+void CPU::setHle(HleMode mode)
+{
+	hleMode = mode;
+	if (mode != HLE_CHECK)
+	{
+		dropBCallCheck();
+	}
+}
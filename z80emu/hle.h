@@ -0,0 +1,61 @@
+#ifndef Z80_HLE_H
+#define Z80_HLE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpu.h"
+
+// Registers a native B_CALL defines, the rest are destroyed (or kept) the same as by the ROM routine but not checked
+#define HLE_OUT_A 0x01
+#define HLE_OUT_BC 0x02
+#define HLE_OUT_DE 0x04
+#define HLE_OUT_HL 0x08
+
+// What a native B_CALL sees of the guest: a copy of the registers and memory through a journal of its stores,
+// so that it can run without changing the CPU (to compare it with the ROM routine) and be applied afterwards
+class BCallContext
+{
+public:
+	BCallContext(const CPU& cpu, const CPU::Registers& registers);
+
+	CPU::Registers registers;	// in and out, PC and SP are left alone
+
+	unsigned char getA() const { return registers.AF >> 8; }
+	unsigned char getF() const { return registers.AF & 0xFF; }
+	void setA(const unsigned char val) { registers.AF = (unsigned short)((val << 8) | (registers.AF & 0xFF)); }
+	void setF(const unsigned char val) { registers.AF = (unsigned short)((registers.AF & 0xFF00) | val); }
+
+	// sees the stores made so far
+	unsigned char read8(const unsigned short where) const;
+	unsigned short read16(const unsigned short where) const;
+	void write8(const unsigned short where, const unsigned char val);
+	void copy(const unsigned short to, const unsigned short from, const unsigned int count);
+	void fill(const unsigned short to, const unsigned char val, const unsigned int count);
+
+	// the stores in order, the last one to an address is its value
+	const std::vector<std::pair<unsigned short, unsigned char> >& getWrites() const { return writes; }
+	// text the routine displayed, for headless runs
+	std::string output;
+
+private:
+	const CPU& cpu;
+	std::vector<std::pair<unsigned short, unsigned char> > writes;
+};
+
+typedef void (*NativeBCall)(BCallContext& call);
+
+struct NativeBCallEntry
+{
+	unsigned short address;	// the word after rst 28h
+	const char* name;
+	NativeBCall run;
+	unsigned char outputs;	// HLE_OUT_*
+	unsigned char flags;	// bits of F the routine defines
+};
+
+// the native implementation of the B_CALL to [address], NULL if there is none
+const NativeBCallEntry* findNativeBCall(const unsigned short address);
+
+#endif
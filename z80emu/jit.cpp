@@ -0,0 +1,919 @@
+#include "cpu.h"
+#include "cycles.h"
+
+// x86-64 dynamic recompiler: a cached block that ran JIT_THRESHOLD times is compiled to host code
+// The Z80 registers live in host registers for the whole block, F is kept materialized (lahf / seto after the x86 ALU op)
+// Loads, stores, 8 bit ALU, inc / dec, add hl, rr and the static jumps are native, everything else calls its interpreter handler
+// A block that is mostly handler calls runs faster in runBlocks and is never compiled
+// Static exits are linked straight to the compiled target block once it exists, the others return to runBlocks
+
+#ifdef Z80_JIT
+
+#include <cstring>
+#include <mutex>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// host registers, numbered as in the instruction encoding
+enum HostRegister { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// host register of each Z80 register in opcode order b, c, d, e, h, l, (hl), a
+static const int hostRegs[8] = { RSI, RDI, R8, R9, R10, R11, -1, RBX };
+#define HOST_F RBP		// F
+#define HOST_CPU R12	// this
+
+// x86 condition codes
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+
+// worst case size of the code for one Z80 instruction, and for the entry checks and exit stubs of a block
+#define JIT_MAX_OP_SIZE 384
+#define JIT_MAX_BLOCK_OVERHEAD 256
+
+// offsets of the CPU fields that compiled code reads and writes, relative to HOST_CPU
+struct JitLayout
+{
+	int regs[8];
+	int F, flagKind, PC, R;
+	int readBanks, writeBanks, cycles, remaining, cycleLimit, slowFetch, codePages, jitFlushed;
+};
+static JitLayout layout;
+static std::once_flag layoutFilled;	// the offsets are the same for every CPU, filled by the first one on any thread
+
+class Emitter
+{
+public:
+	explicit Emitter(unsigned char* code) : at(code) {}
+
+	unsigned char* at;
+
+	void byte(const unsigned int val) { *at++ = (unsigned char)val; }
+	void word(const unsigned int val) { byte(val); byte(val >> 8); }
+	void dword(const unsigned int val) { memcpy(at, &val, 4); at += 4; }
+	void qword(const unsigned long long val) { memcpy(at, &val, 8); at += 8; }
+
+	// [byteRegs] forces the prefix so that 4 - 7 select spl / bpl / sil / dil instead of ah / ch / dh / bh
+	void rex(const bool wide, const int reg, const int index, const int base, const bool byteRegs)
+	{
+		const unsigned int prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+		if (prefix != 0x40 || byteRegs)
+		{
+			byte(prefix);
+		}
+	}
+
+	void opcode(const unsigned int op)
+	{
+		if (op > 0xFF)
+		{
+			byte(op >> 8);
+		}
+		byte(op);
+	}
+
+	// op reg, rm on two registers, [size] is the operand size in bytes
+	void regReg(const unsigned int op, const int reg, const int rm, const int size)
+	{
+		rex(size == 8, reg, 0, rm, size == 1);
+		opcode(op);
+		byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	// op reg, [cpu + field], reg is the /digit for the immediate forms
+	void regCpu(const unsigned int op, const int reg, const int field, const int size)
+	{
+		if (size == 2)
+		{
+			byte(0x66);
+		}
+		rex(size == 8, reg, 0, HOST_CPU, size == 1);
+		opcode(op);
+		byte(0x84 | ((reg & 7) << 3));
+		byte(0x24);
+		dword(field);
+	}
+
+	// op reg8, [Z80 address in eax] through the page-pointer table at [banks], leaves eax alone
+	void regMem(const unsigned int op, const int reg, const int banks)
+	{
+		// rdx = banks[eax >> BANK_SHIFT], ecx = eax & (BANK_SIZE - 1)
+		regReg(0x89, RAX, RCX, 4);
+		byte(0xC1);
+		byte(0xE9);
+		byte(BANK_SHIFT);
+		byte(0x49);
+		byte(0x8B);
+		byte(0x94);
+		byte(0xCC);
+		dword(banks);
+		regReg(0x89, RAX, RCX, 4);
+		byte(0x81);
+		byte(0xE1);
+		dword(BANK_SIZE - 1);
+
+		// op reg8, [rdx + rcx]
+		rex(false, reg, RCX, RDX, true);
+		opcode(op);
+		byte(0x04 | ((reg & 7) << 3));
+		byte(0x0A);
+	}
+
+	// op r/m8, imm8 on a register, [digit] selects the operation of 0x80 / 0xC6 / 0xFE
+	void regImm8(const unsigned int op, const int digit, const int reg, const unsigned char val)
+	{
+		regReg(op, digit, reg, 1);
+		byte(val);
+	}
+
+	// jumps with a rel32 that is patched later, return where the rel32 is
+	unsigned char* jcc(const int cc)
+	{
+		byte(0x0F);
+		byte(0x80 | cc);
+		dword(0);
+		return at - 4;
+	}
+
+	unsigned char* jmp()
+	{
+		byte(0xE9);
+		dword(0);
+		return at - 4;
+	}
+
+	void jmp(const unsigned char* target)
+	{
+		patch(jmp(), target);
+	}
+
+	static void patch(unsigned char* rel, const unsigned char* target)
+	{
+		const int offset = (int)(target - (rel + 4));
+		memcpy(rel, &offset, 4);
+	}
+
+	// Z80 registers to and from the CPU, F included
+	void spill()
+	{
+		for (int reg = 0; reg < 8; reg++)
+		{
+			if (reg != 6)
+			{
+				regCpu(0x88, hostRegs[reg], layout.regs[reg], 1);
+			}
+		}
+		regCpu(0x88, HOST_F, layout.F, 1);
+		regCpu(0xC6, 0, layout.flagKind, 1);
+		byte(0);	// FLAGS_NONE, F is up to date
+	}
+
+	void reload()
+	{
+		for (int reg = 0; reg < 8; reg++)
+		{
+			if (reg != 6)
+			{
+				regCpu(0x8A, hostRegs[reg], layout.regs[reg], 1);
+			}
+		}
+		regCpu(0x8A, HOST_F, layout.F, 1);
+	}
+
+	void setPC(const unsigned short val)
+	{
+		regCpu(0xC7, 0, layout.PC, 2);
+		word(val);
+	}
+
+	// calls helper(this, arg) with the registers spilled, [arg] is in eax when [fromEax]
+	void call(void (*helper)(CPU*, unsigned int), const unsigned int arg, const bool fromEax)
+	{
+#ifdef _WIN32
+		regReg(0x89, HOST_CPU, RCX, 8);
+		if (fromEax)
+		{
+			regReg(0x89, RAX, RDX, 4);
+		}
+		else
+		{
+			byte(0xBA);
+			dword(arg);
+		}
+#else
+		regReg(0x89, HOST_CPU, RDI, 8);
+		if (fromEax)
+		{
+			regReg(0x89, RAX, RSI, 4);
+		}
+		else
+		{
+			byte(0xBE);
+			dword(arg);
+		}
+#endif
+		byte(0x48);
+		byte(0xB8);
+		qword((unsigned long long)helper);
+		byte(0xFF);
+		byte(0xD0);
+	}
+
+	// eax = hl
+	void loadHL()
+	{
+		regReg(0x0FB6, RAX, hostRegs[4], 1);
+		byte(0xC1);
+		byte(0xE0);
+		byte(8);
+		regReg(0x0FB6, RCX, hostRegs[5], 1);
+		regReg(0x09, RCX, RAX, 4);
+	}
+
+	// F from the host flags of the ALU op just emitted: S Z H C keep their Z80 positions in ah after lahf,
+	// [mask] picks the ones the op sets, OF goes to P/V for the arithmetic ops, edx holds the old F when carry is kept
+	void captureFlags(const unsigned char mask, const bool overflow, const unsigned char set, const bool keepCarry)
+	{
+		byte(0x9F);
+		if (overflow)
+		{
+			byte(0x0F);
+			byte(0x90);
+			byte(0xC0);
+		}
+		byte(0x0F);
+		byte(0xB6);
+		byte(0xEC);
+		regImm8(0x83, 4, HOST_F, mask);
+		if (overflow)
+		{
+			regReg(0x0FB6, RAX, RAX, 4);
+			byte(0xC1);
+			byte(0xE0);
+			byte(2);
+			regReg(0x09, RAX, HOST_F, 4);
+		}
+		if (set != 0)
+		{
+			regImm8(0x83, 1, HOST_F, set);
+		}
+		if (keepCarry)
+		{
+			regImm8(0x83, 4, RDX, FLAG_C);
+			regReg(0x09, RDX, HOST_F, 4);
+		}
+	}
+};
+
+// host code for the ALU ops a, src where src is a host register: add adc sub sbc and xor or cp
+static const unsigned char aluOpcodes[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+// the same ops with an immediate, /digit of 0x80
+static const unsigned char aluDigits[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+static void emitAlu(Emitter& out, const unsigned char operation, const int src, const bool immediate, const unsigned char val)
+{
+	if (operation == 1 || operation == 3)
+	{
+		// bt ebp, 0 puts the Z80 carry into CF for adc / sbb
+		out.byte(0x0F);
+		out.byte(0xBA);
+		out.byte(0xE5);
+		out.byte(0);
+	}
+	if (immediate)
+	{
+		out.regImm8(0x80, aluDigits[operation], hostRegs[7], val);
+	}
+	else
+	{
+		out.regReg(aluOpcodes[operation], src, hostRegs[7], 1);
+	}
+
+	switch (operation)
+	{
+		case 0: case 1: out.captureFlags(FLAG_S | FLAG_Z | FLAG_H | FLAG_C, true, 0, false); break;
+		case 2: case 3: case 7: out.captureFlags(FLAG_S | FLAG_Z | FLAG_H | FLAG_C, true, FLAG_N, false); break;
+		case 4: out.captureFlags(FLAG_S | FLAG_Z | FLAG_PV, false, FLAG_H, false); break;
+		default: out.captureFlags(FLAG_S | FLAG_Z | FLAG_PV, false, 0, false); break;
+	}
+}
+
+// CPU::jitFlushed as a flag check: jumps to the returned rel32 when it is set
+static unsigned char* emitFlushedCheck(Emitter& out)
+{
+	out.regCpu(0x80, 7, layout.jitFlushed, 1);
+	out.byte(0);
+	return out.jcc(CC_NE);
+}
+
+bool CPU::initJit()
+{
+#ifdef _WIN32
+	jitArena = (unsigned char*)VirtualAlloc(NULL, JIT_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void* arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	jitArena = (arena == MAP_FAILED) ? NULL : (unsigned char*)arena;
+#endif
+	if (jitArena == NULL)
+	{
+		jitUnavailable = true;
+		return false;
+	}
+
+	std::call_once(layoutFilled, [this]()
+	{
+		char* const base = (char*)this;
+		signed char* const regs[8] = { &B, &C, &D, &E, &H, &L, NULL, &A };
+		for (int reg = 0; reg < 8; reg++)
+		{
+			layout.regs[reg] = (reg == 6) ? 0 : (int)((char*)regs[reg] - base);
+		}
+		layout.F = (int)((char*)&F - base);
+		layout.flagKind = (int)((char*)&flagKind - base);
+		layout.PC = (int)((char*)&PC - base);
+		layout.R = (int)((char*)&R - base);
+		layout.readBanks = (int)((char*)readBanks - base);
+		layout.writeBanks = (int)((char*)writeBanks - base);
+		layout.cycles = (int)((char*)&cycles - base);
+		layout.remaining = (int)((char*)&remaining - base);
+		layout.cycleLimit = (int)((char*)&cycleLimit - base);
+		layout.slowFetch = (int)((char*)&slowFetch - base);
+		layout.codePages = (int)((char*)codePages - base);
+		layout.jitFlushed = (int)((char*)&jitFlushed - base);
+	});
+
+	// entry(cpu, code): saves the callee saved registers, loads the Z80 state and jumps to the block
+	Emitter out(jitArena);
+	jitEnter = out.at;
+	const unsigned char pushes[] = { 0x53, 0x55, 0x56, 0x57 };
+	for (unsigned int i = 0; i < sizeof(pushes); i++)
+	{
+		out.byte(pushes[i]);
+	}
+	out.byte(0x41);
+	out.byte(0x50 | (HOST_CPU & 7));
+	// keeps rsp 16 byte aligned for the calls and leaves the Win64 shadow space
+	out.byte(0x48);
+	out.byte(0x83);
+	out.byte(0xEC);
+	out.byte(32);
+#ifdef _WIN32
+	out.regReg(0x89, RCX, HOST_CPU, 8);
+	out.regReg(0x89, RDX, RAX, 8);
+#else
+	out.regReg(0x89, RDI, HOST_CPU, 8);
+	out.regReg(0x89, RSI, RAX, 8);
+#endif
+	out.reload();
+	out.byte(0xFF);
+	out.byte(0xE0);
+
+	// exit: PC and the accounting are already done, the Z80 registers are still in the host registers
+	jitLeave = out.at;
+	out.spill();
+	jitReturn = out.at;
+	out.byte(0x48);
+	out.byte(0x83);
+	out.byte(0xC4);
+	out.byte(32);
+	out.byte(0x41);
+	out.byte(0x58 | (HOST_CPU & 7));
+	for (int i = sizeof(pushes) - 1; i >= 0; i--)
+	{
+		out.byte(pushes[i] | 8);
+	}
+	out.byte(0xC3);
+
+	jitStart = (unsigned int)(out.at - jitArena);
+	jitUsed = jitStart;
+	return true;
+}
+
+void CPU::freeJit()
+{
+	if (jitArena == NULL)
+	{
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(jitArena, 0, MEM_RELEASE);
+#else
+	munmap(jitArena, JIT_ARENA_SIZE);
+#endif
+	jitArena = NULL;
+}
+
+// Drops all compiled code, called when the arena is full or the cached blocks are flushed
+// Code that is running keeps going until it checks jitFlushed, the arena is only reused by the next compileBlock
+void CPU::flushJit()
+{
+	if (jitArena == NULL || jitUsed == jitStart)
+	{
+		return;
+	}
+	jitUsed = jitStart;
+	jitLinks.clear();
+	for (unsigned int i = 0; i < BLOCK_CACHE_SIZE; i++)
+	{
+		blocks[i].native = NULL;
+	}
+	jitFlushed = true;
+}
+
+// Drops the code of [block] when a store or an eviction hits it, the exits of other blocks that jump into it go back
+// to leaving compiled code, its own are dead from now on. Its bytes in the arena are only reused after the next flushJit
+void CPU::dropNative(Block& block)
+{
+	block.native = NULL;
+	const std::unordered_map<unsigned short, std::vector<JitLink> >::iterator waiting = jitLinks.find((unsigned short)block.entry);
+	if (waiting != jitLinks.end())
+	{
+		std::vector<JitLink>& links = waiting->second;
+		for (size_t i = 0; i < links.size();)
+		{
+			if (isLinkLive(links[i]))
+			{
+				// the jump right after the rel32 is the exit to jitLeave
+				unsigned char* const rel = jitArena + links[i].offset;
+				Emitter::patch(rel, rel + 4);
+				i++;
+			}
+			else
+			{
+				links[i] = links.back();
+				links.pop_back();
+			}
+		}
+		if (links.empty())
+		{
+			jitLinks.erase(waiting);
+		}
+	}
+	// it may be the code that is running
+	jitFlushed = true;
+}
+
+bool CPU::isLinkLive(const JitLink& link) const
+{
+	return blocks[link.from].native == jitArena + link.fromCode;
+}
+
+// Called by compiled code for an instruction it does not compile, PC is at the instruction
+// op holds the opcode, plus 0x100 for CB and 0x200 for ED
+void CPU::jitFallback(CPU* cpu, const unsigned int op)
+{
+	switch (op >> 8)
+	{
+		case 0:
+		{
+			(cpu->*opTable[op & 0xFF])();
+			break;
+		}
+		case 1:
+		{
+			cpu->PC += 2;
+			(cpu->*cbTable[op & 0xFF])();
+			break;
+		}
+		default:
+		{
+			cpu->PC += 2;
+			(cpu->*edTable[op & 0xFF])();
+			break;
+		}
+	}
+	cpu->syncFlags();
+}
+
+// Called by compiled code after a store into a page that holds cached blocks
+void CPU::jitStore(CPU* cpu, const unsigned int address)
+{
+	cpu->invalidateCode(address, 1);
+}
+
+// Compiles [block] and links the exits that were waiting for it
+// Each instruction is either native or a call to its handler, instructions after [k] are refunded by an exit after k ops
+void CPU::compileBlock(Block& block)
+{
+	if (jitUsed + block.count * JIT_MAX_OP_SIZE + JIT_MAX_BLOCK_OVERHEAD > JIT_ARENA_SIZE)
+	{
+		flushJit();
+	}
+	jitFlushed = false;
+
+	unsigned char* const code = jitArena + jitUsed;
+	const unsigned short index = (unsigned short)(&block - blocks);
+	Emitter out(code);
+	std::vector<unsigned char*> entryExits;
+	std::vector<unsigned short> linked;	// targets of the links listed by exitTo
+
+	// the same checks as nextBlock, then the block is charged up front
+	out.regCpu(0x80, 7, layout.slowFetch, 1);
+	out.byte(0);
+	entryExits.push_back(out.jcc(CC_NE));
+	out.regCpu(0x81, 7, layout.remaining, 8);
+	out.dword(block.count);
+	entryExits.push_back(out.jcc(CC_B));
+	out.regCpu(0x8B, RAX, layout.cycles, 8);
+	out.byte(0x48);
+	out.byte(0x05);
+	out.dword(block.cyclesBeforeLast);
+	out.regCpu(0x3B, RAX, layout.cycleLimit, 8);
+	entryExits.push_back(out.jcc(CC_AE));
+	if (block.count > 1)
+	{
+		out.regCpu(0x81, 5, layout.remaining, 8);
+		out.dword(block.count - 1);
+	}
+	out.regCpu(0x81, 0, layout.cycles, 8);
+	out.dword(block.cycles);
+	out.regCpu(0x80, 0, layout.R, 1);
+	out.byte(block.refresh);
+
+	// what the ops from i on were charged
+	unsigned int refundCycles[BLOCK_MAX_OPS + 1];
+	unsigned int refundRefresh[BLOCK_MAX_OPS + 1];
+	refundCycles[block.count] = 0;
+	refundRefresh[block.count] = 0;
+	for (int i = block.count - 1; i >= 0; i--)
+	{
+		refundCycles[i] = refundCycles[i + 1] + block.ops[i].cycles;
+		refundRefresh[i] = refundRefresh[i + 1] + block.ops[i].refresh;
+	}
+
+	// exit with PC already set after [executed] ops
+	auto exitAfter = [&](const unsigned int executed)
+	{
+		const int unused = (int)block.count - 1 - (int)executed;
+		if (unused != 0)
+		{
+			out.regCpu(0x81, 0, layout.remaining, 8);
+			out.dword(unused);
+		}
+		if (refundCycles[executed] != 0)
+		{
+			out.regCpu(0x81, 5, layout.cycles, 8);
+			out.dword(refundCycles[executed]);
+		}
+		if (refundRefresh[executed] != 0)
+		{
+			out.regCpu(0x80, 5, layout.R, 1);
+			out.byte(refundRefresh[executed]);
+		}
+	};
+
+	// static exit at the end of the block, jumps to the compiled target block once there is one
+	auto exitTo = [&](const unsigned short target, const unsigned int extraCycles)
+	{
+		if (extraCycles != 0)
+		{
+			out.regCpu(0x81, 0, layout.cycles, 8);
+			out.dword(extraCycles);
+		}
+		exitAfter(block.count);
+		unsigned char* const link = out.jmp();
+		if (target == block.entry)
+		{
+			Emitter::patch(link, code);
+		}
+		else
+		{
+			const JitLink entry = { (unsigned int)(link - jitArena), (unsigned int)(code - jitArena), index };
+			jitLinks[target].push_back(entry);
+			linked.push_back(target);
+			const Block& other = blocks[target & (BLOCK_CACHE_SIZE - 1)];
+			if (other.entry == target && other.native != NULL)
+			{
+				Emitter::patch(link, other.native);
+			}
+		}
+		out.setPC(target);
+		out.jmp(jitLeave);
+	};
+
+	// taken when the F bits in [mask] are set (or clear when not [set])
+	auto exitIf = [&](const unsigned char mask, const bool set, const unsigned short target, const unsigned short next, const unsigned int extraCycles)
+	{
+		out.regImm8(0xF6, 0, HOST_F, mask);
+		unsigned char* const notTaken = out.jcc(set ? CC_E : CC_NE);
+		exitTo(target, extraCycles);
+		Emitter::patch(notTaken, out.at);
+		exitTo(next, 0);
+	};
+
+	static const unsigned char conditionMasks[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+
+	// exits taken when a handler flushed the compiled code, [executed] ops in with the registers spilled
+	struct FlushedExit
+	{
+		unsigned char* rel;
+		unsigned int executed;
+	};
+	std::vector<FlushedExit> flushedExits;
+
+	unsigned int fallbacks = 0;
+	bool ended = false;
+	bool spilled = false;	// by a run of handler calls, the registers are reloaded at the next native op
+	for (unsigned int i = 0; i < block.count; i++)
+	{
+		const MicroOp& op = block.ops[i];
+		const unsigned char opcode = read8(op.address);
+		const unsigned char byte1 = read8(op.address + 1);
+		const unsigned char byte2 = read8(op.address + 2);
+		const bool last = i + 1 == block.count;
+		const unsigned char y = (opcode >> 3) & 7;
+		const unsigned char z = opcode & 7;
+
+		// dropped again below when the op is not native after all
+		unsigned char* const beforeReload = out.at;
+		if (spilled)
+		{
+			out.reload();
+		}
+
+		bool native = op.skip == 0;
+		if (native)
+		{
+			if (opcode == 0x00)
+			{
+			}
+			else if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76)
+			{
+				// ld r, r' / ld r, (hl) / ld (hl), r
+				if (y == 6)
+				{
+					out.loadHL();
+					out.regMem(0x88, hostRegs[z], layout.writeBanks);
+				}
+				else if (z == 6)
+				{
+					out.loadHL();
+					out.regMem(0x8A, hostRegs[y], layout.readBanks);
+				}
+				else if (y != z)
+				{
+					out.regReg(0x88, hostRegs[z], hostRegs[y], 1);
+				}
+			}
+			else if (opcode < 0x40 && z == 6 && y != 6)
+			{
+				// ld r, n
+				out.rex(false, 0, 0, hostRegs[y], true);
+				out.byte(0xB0 | (hostRegs[y] & 7));
+				out.byte(byte1);
+			}
+			else if (opcode == 0x36)
+			{
+				// ld (hl), n
+				out.loadHL();
+				out.regMem(0xC6, 0, layout.writeBanks);
+				out.byte(byte1);
+			}
+			else if (opcode >= 0x80 && opcode < 0xC0)
+			{
+				if (z == 6)
+				{
+					out.loadHL();
+					out.regMem(0x8A, RCX, layout.readBanks);
+					emitAlu(out, y, RCX, false, 0);
+				}
+				else
+				{
+					emitAlu(out, y, hostRegs[z], false, 0);
+				}
+			}
+			else if (opcode >= 0xC0 && z == 6)
+			{
+				emitAlu(out, y, 0, true, byte1);
+			}
+			else if (opcode < 0x40 && (z == 4 || z == 5) && y != 6)
+			{
+				// inc r / dec r keep the carry
+				out.regReg(0x89, HOST_F, RDX, 4);
+				out.regReg(0xFE, z == 4 ? 0 : 1, hostRegs[y], 1);
+				out.captureFlags(FLAG_S | FLAG_Z | FLAG_H, true, z == 4 ? 0 : FLAG_N, true);
+			}
+			else if (opcode < 0x30 && (opcode & 0xF) == 0x03)
+			{
+				// inc rr, no flags
+				out.regImm8(0x80, 0, hostRegs[y + 1], 1);
+				out.regImm8(0x80, 2, hostRegs[y], 0);
+			}
+			else if (opcode < 0x30 && (opcode & 0xF) == 0x0B)
+			{
+				// dec rr
+				out.regImm8(0x80, 5, hostRegs[y], 1);
+				out.regImm8(0x80, 3, hostRegs[y - 1], 0);
+			}
+			else if (opcode < 0x30 && (opcode & 0xF) == 0x09)
+			{
+				// add hl, rr keeps S Z P/V, the half carry of the high byte is the one out of bit 11
+				out.regReg(0x89, HOST_F, RDX, 4);
+				out.regReg(0x00, hostRegs[y], hostRegs[5], 1);
+				out.regReg(0x10, hostRegs[y - 1], hostRegs[4], 1);
+				out.captureFlags(FLAG_H | FLAG_C, false, 0, false);
+				out.regImm8(0x83, 4, RDX, FLAG_S | FLAG_Z | FLAG_PV);
+				out.regReg(0x09, RDX, HOST_F, 4);
+			}
+			else if (opcode < 0x30 && (opcode & 0xF) == 0x01)
+			{
+				// ld rr, nn
+				out.regImm8(0xC6, 0, hostRegs[y + 1], byte1);
+				out.regImm8(0xC6, 0, hostRegs[y], byte2);
+			}
+			else if (opcode == 0xC3)
+			{
+				exitTo((unsigned short)(byte1 | (byte2 << 8)), 0);
+				ended = true;
+			}
+			else if (opcode >= 0xC0 && z == 2)
+			{
+				// jp cc, nn: nz z nc c po pe p m
+				exitIf(conditionMasks[y >> 1], (y & 1) != 0, (unsigned short)(byte1 | (byte2 << 8)), op.address + 3, 0);
+				ended = true;
+			}
+			else if (opcode == 0x18)
+			{
+				exitTo(op.address + 2 + (signed char)byte1, CYCLES_JR_TAKEN);
+				ended = true;
+			}
+			else if (opcode >= 0x20 && opcode < 0x40 && z == 0)
+			{
+				// jr nz / z / nc / c
+				exitIf(conditionMasks[(y >> 1) & 1], (y & 1) != 0, op.address + 2 + (signed char)byte1, op.address + 2, CYCLES_JR_TAKEN);
+				ended = true;
+			}
+			else if (opcode == 0x10)
+			{
+				// djnz
+				out.regReg(0xFE, 1, hostRegs[0], 1);
+				unsigned char* const notTaken = out.jcc(CC_E);
+				exitTo(op.address + 2 + (signed char)byte1, CYCLES_DJNZ_TAKEN);
+				Emitter::patch(notTaken, out.at);
+				exitTo(op.address + 2, 0);
+				ended = true;
+			}
+			else
+			{
+				native = false;
+			}
+
+			// a store into a code page goes through invalidateCode, the rest of the block is dropped if it was compiled
+			if (native && (opcode == 0x36 || (opcode >= 0x70 && opcode < 0x78 && opcode != 0x76)))
+			{
+				out.regReg(0x89, RAX, RCX, 4);
+				out.byte(0xC1);
+				out.byte(0xE9);
+				out.byte(CODE_PAGE_SHIFT);
+				// bt [cpu + codePages], ecx
+				out.regCpu(0x0FA3, RCX, layout.codePages, 4);
+				unsigned char* const clean = out.jcc(CC_AE);
+				out.spill();
+				out.setPC(opcode == 0x36 ? op.address + 2 : op.address + 1);
+				out.call(jitStore, 0, true);
+				out.reload();
+				unsigned char* const flushed = emitFlushedCheck(out);
+				Emitter::patch(clean, out.at);
+				unsigned char* const skip = out.jmp();
+				Emitter::patch(flushed, out.at);
+				exitAfter(i + 1);
+				out.jmp(jitLeave);
+				Emitter::patch(skip, out.at);
+			}
+		}
+
+		if (native)
+		{
+			spilled = false;
+		}
+		else
+		{
+			// the registers stay spilled across a run of handler calls, each handler leaves PC at the next op
+			out.at = beforeReload;
+			fallbacks++;
+			if (!spilled)
+			{
+				out.setPC(op.address);
+				out.spill();
+				spilled = true;
+			}
+			const unsigned int selector = (op.skip == 0) ? opcode : ((opcode == 0xCB) ? 0x100 : 0x200) | byte1;
+			out.call(jitFallback, selector, false);
+			if (last)
+			{
+				exitAfter(block.count);
+				out.jmp(jitReturn);
+				ended = true;
+			}
+			else
+			{
+				const FlushedExit flushed = { emitFlushedCheck(out), i + 1 };
+				flushedExits.push_back(flushed);
+			}
+		}
+	}
+
+	if (!ended)
+	{
+		// the block was cut at BLOCK_MAX_OPS or the end of memory
+		exitTo((unsigned short)block.end, 0);
+	}
+
+	// a handler call from compiled code costs more than the op does in runBlocks, it takes about three native ops to make up
+	// for it, the code of a block with fewer is dropped before anything links to it
+	if (block.count - fallbacks < fallbacks * 3)
+	{
+		// the next block compiled takes the same bytes, its links must not look like these
+		for (size_t i = linked.size(); i-- > 0;)
+		{
+			std::vector<JitLink>& links = jitLinks[linked[i]];
+			links.pop_back();
+			if (links.empty())
+			{
+				jitLinks.erase(linked[i]);
+			}
+		}
+		block.hits = JIT_DECLINED;
+		return;
+	}
+
+	// out of line, the checks after the handler calls fall through
+	for (size_t i = 0; i < flushedExits.size(); i++)
+	{
+		Emitter::patch(flushedExits[i].rel, out.at);
+		exitAfter(flushedExits[i].executed);
+		out.jmp(jitReturn);
+	}
+
+	unsigned char* const entryExit = out.at;
+	out.setPC(block.entry);
+	out.jmp(jitLeave);
+	for (size_t i = 0; i < entryExits.size(); i++)
+	{
+		Emitter::patch(entryExits[i], entryExit);
+	}
+
+	block.native = code;
+	jitUsed += (unsigned int)(out.at - code);
+
+	// the exits waiting for it, they stay listed for dropNative
+	const std::unordered_map<unsigned short, std::vector<JitLink> >::iterator waiting = jitLinks.find((unsigned short)block.entry);
+	if (waiting != jitLinks.end())
+	{
+		std::vector<JitLink>& links = waiting->second;
+		for (size_t i = 0; i < links.size();)
+		{
+			if (isLinkLive(links[i]))
+			{
+				Emitter::patch(jitArena + links[i].offset, code);
+				i++;
+			}
+			else
+			{
+				links[i] = links.back();
+				links.pop_back();
+			}
+		}
+	}
+}
+
+#endif
+
+// Blocks engine that hands the hot blocks to compiled code, the cold and the declined ones run as in runBlocks
+void CPU::runJit()
+{
+#ifdef Z80_JIT
+	if (jitArena == NULL && (jitUnavailable || !initJit()))
+	{
+		runBlocks(false);
+		return;
+	}
+	runBlocks(true);
+#else
+	runBlocks(false);
+#endif
+}
+
+#ifdef Z80_JIT
+// Called by runBlocks for each block it is about to run but the declined ones, false when the block has no compiled code
+bool CPU::runCompiled(Block& block)
+{
+	if (block.native == NULL && ++block.hits >= JIT_THRESHOLD)
+	{
+		compileBlock(block);
+	}
+	if (block.native == NULL)
+	{
+		return false;
+	}
+	syncFlags();
+	jitFlushed = false;
+	((void (*)(CPU*, const unsigned char*))jitEnter)(this, block.native);
+	return true;
+}
+#endif
@@ -0,0 +1,559 @@
+#include "lockstep.h"
+#include "cycles.h"
+#include "snapshot.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(LOCKSTEP_AVX2)
+#include <intrin.h>
+#endif
+
+// LOCKSTEP_WIDTH bytes, one per lane, masks are 0xFF / 0x00 per lane, the kernel for CPUs without AVX2
+struct Bytes
+{
+	unsigned char b[LOCKSTEP_WIDTH];
+};
+
+#define BYTES_LOOP(expression) Bytes out; for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++) { out.b[i] = (unsigned char)(expression); } return out;
+static inline Bytes loadBytes(const unsigned char* from) { Bytes out; memcpy(out.b, from, LOCKSTEP_WIDTH); return out; }
+static inline void storeBytes(unsigned char* to, const Bytes val) { memcpy(to, val.b, LOCKSTEP_WIDTH); }
+static inline Bytes splat(const unsigned char val) { BYTES_LOOP(val) }
+static inline Bytes add(const Bytes a, const Bytes b) { BYTES_LOOP(a.b[i] + b.b[i]) }
+static inline Bytes sub(const Bytes a, const Bytes b) { BYTES_LOOP(a.b[i] - b.b[i]) }
+static inline Bytes band(const Bytes a, const Bytes b) { BYTES_LOOP(a.b[i] & b.b[i]) }
+static inline Bytes bor(const Bytes a, const Bytes b) { BYTES_LOOP(a.b[i] | b.b[i]) }
+static inline Bytes bxor(const Bytes a, const Bytes b) { BYTES_LOOP(a.b[i] ^ b.b[i]) }
+static inline Bytes equal(const Bytes a, const Bytes b) { BYTES_LOOP((a.b[i] == b.b[i]) ? 0xFF : 0) }
+static inline Bytes below(const Bytes a, const Bytes b) { BYTES_LOOP((a.b[i] < b.b[i]) ? 0xFF : 0) }
+static inline Bytes select(const Bytes mask, const Bytes yes, const Bytes no) { BYTES_LOOP(mask.b[i] ? yes.b[i] : no.b[i]) }
+static inline Bytes parity(const Bytes val) { BYTES_LOOP(flagTables.szp[val.b[i]] & FLAG_PV) }
+#undef BYTES_LOOP
+
+static inline unsigned int countLanes(const Bytes mask)
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++)
+	{
+		count += mask.b[i] & 1;
+	}
+	return count;
+}
+
+static inline void stepPC(unsigned short* pc, const Bytes in, const Bytes taken, const unsigned short target, const unsigned short next)
+{
+	for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++)
+	{
+		pc[i] = in.b[i] ? (taken.b[i] ? target : next) : pc[i];
+	}
+}
+
+static inline void addCounts(unsigned long long* counts, const Bytes a, const unsigned char aVal, const Bytes b, const unsigned char bVal)
+{
+	for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++)
+	{
+		counts[i] += (a.b[i] & aVal) + (b.b[i] & bVal);
+	}
+}
+
+#define LOCKSTEP_KERNEL lockstepKernelScalar
+#include "lockstepkernel.inl"
+#undef LOCKSTEP_KERNEL
+
+// AVX2 in the CPU and its YMM registers saved by the OS
+static bool hasAVX2()
+{
+#if defined(_MSC_VER) && defined(LOCKSTEP_AVX2)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(LOCKSTEP_AVX2)
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+// bytes of an opcode that executeVector runs, 0 for the ones that go through the lane's own CPU
+static unsigned int vectorLength(const unsigned char opcode)
+{
+	const unsigned int y = (opcode >> 3) & 7;
+	const unsigned int z = opcode & 7;
+	switch (opcode >> 6)
+	{
+		case 0:
+		{
+			if (opcode == 0x00)
+			{
+				return 1;
+			}
+			if (opcode == 0x10 || opcode == 0x18 || (opcode >= 0x20 && z == 0))
+			{
+				return 2; // djnz, jr, jr cc
+			}
+			if (z == 3 && y < 6)
+			{
+				return 1; // inc / dec bc, de, hl
+			}
+			if ((z == 4 || z == 5) && y != 6)
+			{
+				return 1; // inc / dec r
+			}
+			if (z == 6 && y != 6)
+			{
+				return 2; // ld r, n
+			}
+			return 0;
+		}
+		case 1:
+		{
+			return (opcode == 0x76) ? 0 : 1; // ld r, r / ld r, (hl) / ld (hl), r, not halt
+		}
+		case 2:
+		{
+			return 1; // alu a, r / alu a, (hl)
+		}
+		default:
+		{
+			if (z == 6)
+			{
+				return 2; // alu a, n
+			}
+			if (opcode == 0xC3 || z == 2)
+			{
+				return 3; // jp, jp cc
+			}
+			return 0;
+		}
+	}
+}
+
+Lockstep::Lockstep(unsigned int lanes)
+{
+	kernel = lockstepKernelScalar;
+#ifdef LOCKSTEP_AVX2
+	if (hasAVX2())
+	{
+		kernel = lockstepKernelAVX2;
+	}
+#endif
+	this->lanes = lanes;
+	width = (lanes + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH * LOCKSTEP_WIDTH;
+	for (unsigned int i = 0; i < lanes; i++)
+	{
+		cpus.push_back(new CPU());
+	}
+	for (unsigned int reg = 0; reg < 8; reg++)
+	{
+		regs[reg].assign(width, 0);
+	}
+	flags.assign(width, 0);
+	refresh.assign(width, 0);
+	pc.assign(width, 0);
+	cycles.assign(width, 0);
+	executed.assign(width, 0);
+	live.assign(width, 0);
+	group.assign(width, 0);
+	fromHL.assign(width, 0);
+	chunkActive.assign(width / LOCKSTEP_WIDTH, 0);
+	reasons.assign(width, CPU::STOP_NONE);
+	unshared.assign(width, 0);
+	budget = 0;
+	untilCheck = 0;
+	memset(codeState, CODE_UNKNOWN, sizeof(codeState));
+	vectorInstructions = 0;
+	scalarInstructions = 0;
+}
+
+Lockstep::~Lockstep()
+{
+	for (unsigned int i = 0; i < lanes; i++)
+	{
+		delete cpus[i];
+	}
+}
+
+void Lockstep::run(unsigned long long budget, std::vector<CPU::RunResult>& results)
+{
+	this->budget = budget;
+
+	// A snapshot of each lane marks all of its RAM as shared, so its first store to a page goes through CPU::unsharePages.
+	// That is how a store into code is noticed without looking at every store
+	Snapshot armed;
+	std::vector<unsigned long long> startCycles(lanes);
+	for (unsigned int i = 0; i < lanes; i++)
+	{
+		cpus[i]->snapshot(armed);
+		load(i);
+		startCycles[i] = cycles[i];
+		executed[i] = 0;
+		live[i] = (budget != 0) ? 0xFF : 0;
+		reasons[i] = CPU::STOP_BUDGET;
+		unshared[i] = cpus[i]->unsharedPages;
+	}
+	memset(codeState, CODE_UNKNOWN, sizeof(codeState));
+	untilCheck = budget;
+
+	bool regroup = true;
+	unsigned int leader = 0;
+	unsigned int behind = 0;	// lowest PC of the live lanes outside the group, 0x10000 when there are none
+	unsigned int grouped = 0;
+	unsigned int first = 0;
+	for (;;)
+	{
+		if (regroup)
+		{
+			// the lanes furthest behind go first, lanes that branched ahead wait for them there
+			leader = 0xFFFF;
+			for (unsigned int c = 0; c < width; c += LOCKSTEP_WIDTH)
+			{
+				for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++)
+				{
+					const unsigned int at = live[c + i] ? pc[c + i] : 0xFFFF;
+					leader = (at < leader) ? at : leader;
+				}
+			}
+
+			grouped = 0;
+			behind = 0x10000;
+			first = width;
+			for (unsigned int c = 0; c < width; c += LOCKSTEP_WIDTH)
+			{
+				unsigned int inChunk = 0;
+				for (unsigned int i = 0; i < LOCKSTEP_WIDTH; i++)
+				{
+					group[c + i] = live[c + i] & ((pc[c + i] == leader) ? 0xFF : 0);
+					inChunk += group[c + i] & 1;
+					const unsigned int at = (live[c + i] && !group[c + i]) ? pc[c + i] : 0x10000;
+					behind = (at < behind) ? at : behind;
+				}
+				chunkActive[c / LOCKSTEP_WIDTH] = inChunk != 0;
+				grouped += inChunk;
+				if (inChunk != 0 && first == width)
+				{
+					for (first = c; !group[first]; first++)
+					{
+					}
+				}
+			}
+			if (grouped == 0)
+			{
+				break;
+			}
+		}
+
+		// a group that stays together keeps going without looking at the other lanes as long as it is still the lowest
+		// a lone lane runs on its own CPU until it gets to the next lane
+		unsigned long long steps = 1;
+		if (grouped == 1)
+		{
+			steps = stepScalar(first, (untilCheck < LOCKSTEP_ALONE) ? untilCheck : LOCKSTEP_ALONE, behind);
+			regroup = true;
+		}
+		else
+		{
+			const unsigned char opcode = cpus[first]->read8((unsigned short)leader);
+			const unsigned int length = vectorLength(opcode);
+			bool together = false;
+			if (length == 0)
+			{
+				for (unsigned int i = first; i < width; i++)
+				{
+					if (group[i])
+					{
+						stepScalar(i, 1, 0x10000);
+					}
+				}
+			}
+			else
+			{
+				const bool whole = checkCode((unsigned short)leader, length);
+				together = executeVector(opcode, (unsigned short)leader) && whole;
+			}
+			leader = pc[first];
+			regroup = !together || leader >= behind;
+		}
+		// no lane runs more instructions than there were steps
+		untilCheck -= steps;
+		if (untilCheck == 0)
+		{
+			checkBudget();
+			regroup = true;
+		}
+	}
+
+	results.resize(lanes);
+	for (unsigned int i = 0; i < lanes; i++)
+	{
+		store(i);
+		results[i].reason = reasons[i];
+		results[i].instructions = executed[i];
+		results[i].cycles = cycles[i] - startCycles[i];
+	}
+}
+
+void Lockstep::load(const unsigned int i)
+{
+	CPU& cpu = *cpus[i];
+	signed char* const from[8] = { &cpu.B, &cpu.C, &cpu.D, &cpu.E, &cpu.H, &cpu.L, NULL, &cpu.A };
+	for (unsigned int reg = 0; reg < 8; reg++)
+	{
+		if (from[reg] != NULL)
+		{
+			regs[reg][i] = *from[reg];
+		}
+	}
+	flags[i] = cpu.getF();
+	refresh[i] = cpu.R;
+	pc[i] = cpu.PC;
+	cycles[i] = cpu.cycles;
+}
+
+void Lockstep::store(const unsigned int i)
+{
+	CPU& cpu = *cpus[i];
+	signed char* const to[8] = { &cpu.B, &cpu.C, &cpu.D, &cpu.E, &cpu.H, &cpu.L, NULL, &cpu.A };
+	for (unsigned int reg = 0; reg < 8; reg++)
+	{
+		if (to[reg] != NULL)
+		{
+			*to[reg] = regs[reg][i];
+		}
+	}
+	cpu.setF(flags[i]);
+	cpu.R = refresh[i];
+	cpu.PC = pc[i];
+	cpu.cycles = cycles[i];
+}
+
+// Up to [count] instructions of lane [i] through its own CPU, stopping early when it gets to [until] (0x10000: nowhere)
+// returns the instructions it ran
+unsigned long long Lockstep::stepScalar(const unsigned int i, const unsigned long long count, const unsigned int until)
+{
+	CPU& cpu = *cpus[i];
+	store(i);
+	unsigned char banks[NUM_BANKS];
+	memcpy(banks, cpu.bankPages, NUM_BANKS);
+	// a breakpoint of the lane's own stops it the same way, it just carries on at the next step
+	const bool marks = until < 0x10000 && !cpu.isBreakpoint((unsigned short)until);
+	if (marks)
+	{
+		cpu.setBreakpoint((unsigned short)until);
+	}
+	const CPU::RunResult result = cpu.run(count, CPU::DISPATCH_SWITCH);
+	if (marks)
+	{
+		cpu.clearBreakpoint((unsigned short)until);
+	}
+	load(i);
+
+	executed[i] += result.instructions;
+	scalarInstructions += result.instructions;
+	if ((result.reason != CPU::STOP_BUDGET && result.reason != CPU::STOP_BREAKPOINT) || result.instructions == 0)
+	{
+		live[i] = 0;
+		reasons[i] = result.reason;
+	}
+
+	checkStores(i);
+	// a lane that switched a bank sees other code there
+	for (unsigned int bank = 0; bank < NUM_BANKS; bank++)
+	{
+		if (banks[bank] != cpu.bankPages[bank])
+		{
+			const unsigned int pagesPerBank = BANK_SIZE >> CODE_PAGE_SHIFT;
+			memset(codeState + bank * pagesPerBank, CODE_UNKNOWN, pagesPerBank);
+		}
+	}
+	return result.instructions;
+}
+
+// stops the lanes that used up the budget and sets how many steps the next one is away from it
+void Lockstep::checkBudget()
+{
+	untilCheck = ~0ULL;
+	for (unsigned int i = 0; i < lanes; i++)
+	{
+		if (executed[i] >= budget)
+		{
+			live[i] = 0;
+		}
+		else if (live[i] && budget - executed[i] < untilCheck)
+		{
+			untilCheck = budget - executed[i];
+		}
+	}
+}
+
+// a page lane [i] wrote for the first time since the run started may now hold other code than in the other lanes
+void Lockstep::checkStores(const unsigned int i)
+{
+	CPU& cpu = *cpus[i];
+	if (cpu.unsharedPages == unshared[i])
+	{
+		return;
+	}
+	unshared[i] = cpu.unsharedPages;
+	for (unsigned int page = 0; page < (0x10000 >> CODE_PAGE_SHIFT); page++)
+	{
+		const unsigned int index = cpu.ramPageAt(page);
+		if (codeState[page] == CODE_SAME && index < SNAPSHOT_PAGES && !cpu.savedPages[index])
+		{
+			codeState[page] = CODE_DIFFERENT;
+		}
+	}
+}
+
+// Makes sure every lane of the group has the same [length] bytes at [address] as the first one, the lanes that differ
+// leave the group and run later. Always leaves at least the first lane in the group, false when some lane left
+bool Lockstep::checkCode(const unsigned short address, const unsigned int length)
+{
+	unsigned int first = 0;
+	while (!group[first])
+	{
+		first++;
+	}
+
+	bool same = true;
+	for (unsigned int offset = 0; offset < length; offset++)
+	{
+		const unsigned int page = (unsigned short)(address + offset) >> CODE_PAGE_SHIFT;
+		if (codeState[page] == CODE_UNKNOWN)
+		{
+			// a page written since the run started cannot be watched for stores any more, it is checked on every fetch
+			const unsigned int bank = page / (BANK_SIZE >> CODE_PAGE_SHIFT);
+			const unsigned int start = (page << CODE_PAGE_SHIFT) & (BANK_SIZE - 1);
+			const char* const reference = cpus[first]->readBanks[bank] + start;
+			codeState[page] = CODE_SAME;
+			for (unsigned int i = 0; i < lanes && codeState[page] == CODE_SAME; i++)
+			{
+				const CPU& cpu = *cpus[i];
+				const unsigned int index = cpu.ramPageAt(page);
+				if (live[i] && ((index < SNAPSHOT_PAGES && !cpu.savedPages[index]) || memcmp(cpu.readBanks[bank] + start, reference, 1 << CODE_PAGE_SHIFT) != 0))
+				{
+					codeState[page] = CODE_DIFFERENT;
+				}
+			}
+		}
+		same &= codeState[page] == CODE_SAME;
+	}
+	if (same)
+	{
+		return true;
+	}
+
+	bool whole = true;
+	for (unsigned int i = first + 1; i < width; i++)
+	{
+		if (!chunkActive[i / LOCKSTEP_WIDTH])
+		{
+			i |= LOCKSTEP_WIDTH - 1;
+			continue;
+		}
+		for (unsigned int offset = 0; group[i] && offset < length; offset++)
+		{
+			const unsigned short at = (unsigned short)(address + offset);
+			if (cpus[i]->read8(at) != cpus[first]->read8(at))
+			{
+				group[i] = 0;
+				whole = false;
+			}
+		}
+	}
+	return whole;
+}
+
+// [opcode] at [address] for every lane of the group, see vectorLength for the opcodes
+// true when the group is still together: every lane went the same way
+bool Lockstep::executeVector(const unsigned char opcode, const unsigned short address)
+{
+	unsigned int first = 0;
+	while (!group[first])
+	{
+		first++;
+	}
+	const CPU& leader = *cpus[first];
+	const unsigned int y = (opcode >> 3) & 7;
+	const unsigned int z = opcode & 7;
+	const unsigned int length = vectorLength(opcode);
+	const unsigned char operand = leader.read8(address + 1);
+
+	// where the lanes that do not branch go, and where the others do
+	const unsigned short next = address + length;
+	unsigned short target = next;
+	unsigned int extraCycles = 0;
+	int cond = -1;	// see branches in lockstepkernel.inl
+	if (opcode == 0xC3 || ((opcode & 0xC7) == 0xC2))
+	{
+		target = operand | ((unsigned char)leader.read8(address + 2) << 8);
+		cond = (opcode == 0xC3) ? 8 : y;
+	}
+	else if (opcode == 0x18 || opcode == 0x10 || (opcode >= 0x20 && opcode < 0x40 && z == 0))
+	{
+		target = address + 2 + (signed char)operand;
+		cond = (opcode == 0x18) ? 8 : (opcode == 0x10) ? 9 : y - 4;
+		extraCycles = CYCLES_JR_TAKEN; // the same as CYCLES_DJNZ_TAKEN
+	}
+	LockstepInstruction instruction;
+	instruction.opcode = opcode;
+	instruction.operand = operand;
+	instruction.next = next;
+	instruction.target = target;
+	instruction.cond = cond;
+	instruction.baseCycles = cyclesMain[opcode];
+	instruction.extraCycles = (unsigned char)extraCycles;
+
+	// the reads and stores through (hl) go through each lane's CPU first, the kernel does the rest
+	const bool readsHL = (opcode >= 0x40 && opcode < 0xC0 && z == 6);
+	const bool storesHL = (opcode >= 0x70 && opcode < 0x78);
+	if (readsHL || storesHL)
+	{
+		for (unsigned int lane = 0; lane < width; lane++)
+		{
+			if (!group[lane])
+			{
+				continue;
+			}
+			const unsigned short hl = (unsigned short)((regs[4][lane] << 8) | regs[5][lane]);
+			if (readsHL)
+			{
+				fromHL[lane] = cpus[lane]->read8(hl);
+			}
+			else
+			{
+				cpus[lane]->write8(hl, regs[z][lane]);
+				checkStores(lane);
+			}
+		}
+	}
+
+	LockstepLanes lanesOf;
+	for (unsigned int reg = 0; reg < 8; reg++)
+	{
+		lanesOf.regs[reg] = &regs[reg][0];
+	}
+	lanesOf.flags = &flags[0];
+	lanesOf.refresh = &refresh[0];
+	lanesOf.pc = &pc[0];
+	lanesOf.cycles = &cycles[0];
+	lanesOf.executed = &executed[0];
+	lanesOf.group = &group[0];
+	lanesOf.chunkActive = &chunkActive[0];
+	lanesOf.fromHL = &fromHL[0];
+	lanesOf.chunks = width / LOCKSTEP_WIDTH;
+	unsigned int grouped;
+	unsigned int takers;
+	kernel(instruction, lanesOf, grouped, takers);
+	vectorInstructions += grouped;
+	return takers == 0 || takers == grouped;
+}
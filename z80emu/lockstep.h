@@ -0,0 +1,84 @@
+#ifndef Z80_LOCKSTEP_H
+#define Z80_LOCKSTEP_H
+
+#include <vector>
+
+#include "cpu.h"
+#include "lockstepkernel.h"
+
+// most instructions a lane that is on its own runs before the lanes are grouped again
+#define LOCKSTEP_ALONE 256
+
+// Runs many CPUs that execute the same program (same ROM, different inputs) in lockstep
+// The registers every lane has in common live in structure of arrays form, the lanes at the lowest PC execute next
+// (the others wait for them to catch up, which is where diverged lanes meet again) and the common opcodes
+// (8 bit loads, ALU, inc / dec, 16 bit inc / dec and jumps) are executed for all of them at once, 32 lanes per AVX2
+// vector on a CPU that has it and a plain loop per lane otherwise (see lockstepkernel.h).
+// Everything else is run through the lane's own CPU one lane at a time, and a lane that is on its own runs there
+// until it gets to the next lane
+class Lockstep
+{
+public:
+	explicit Lockstep(unsigned int lanes);
+	~Lockstep();
+
+	unsigned int getLanes() const { return lanes; }
+	// set up each lane (ROM, input, registers) before running, the lanes share nothing
+	CPU& lane(unsigned int i) { return *cpus[i]; }
+
+	// runs every lane for up to [budget] instructions, results[i] is what CPU::run would have returned for lane i
+	// a lane stops early on halt or an invalid opcode, breakpoints are ignored
+	void run(unsigned long long budget, std::vector<CPU::RunResult>& results);
+
+	// instructions of all lanes together that were executed in vectors / one lane at a time
+	unsigned long long getVectorInstructions() const { return vectorInstructions; }
+	unsigned long long getScalarInstructions() const { return scalarInstructions; }
+
+private:
+	Lockstep(const Lockstep&);
+	Lockstep& operator=(const Lockstep&);
+
+	void load(const unsigned int i);
+	void store(const unsigned int i);
+	unsigned long long stepScalar(const unsigned int i, const unsigned long long count, const unsigned int until);
+	void checkStores(const unsigned int i);
+	void checkBudget();
+	bool checkCode(const unsigned short address, const unsigned int length);
+	bool executeVector(const unsigned char opcode, const unsigned short address);
+
+	LockstepKernel kernel;
+	unsigned int lanes;
+	unsigned int width;		// lanes rounded up to LOCKSTEP_WIDTH, the extra lanes never run
+	std::vector<CPU*> cpus;
+
+	// one entry per lane
+	std::vector<unsigned char> regs[8];	// b, c, d, e, h, l, unused, a: indexed by the register field of the opcode
+	std::vector<unsigned char> flags;	// F, always materialized
+	std::vector<unsigned char> refresh;	// R
+	std::vector<unsigned short> pc;
+	std::vector<unsigned long long> cycles;
+	std::vector<unsigned long long> executed;	// instructions in the current run
+	std::vector<unsigned char> live;	// 0xFF while the lane still runs
+	std::vector<unsigned char> group;	// 0xFF for the lanes executing the current instruction
+	std::vector<unsigned char> fromHL;	// what the lanes of the group read through (hl) for the current instruction
+	std::vector<unsigned char> chunkActive;	// some lane of the chunk of LOCKSTEP_WIDTH lanes is in the group
+	std::vector<CPU::StopReason> reasons;
+	std::vector<unsigned int> unshared;	// CPU::unsharedPages when the lane was last checked for stores
+	unsigned long long budget;
+	unsigned long long untilCheck;	// steps before a lane can reach the budget
+
+	// whether the code on each page is the same in every live lane, so that an instruction fetched from one
+	// lane is the instruction of all of them
+	enum CodeState
+	{
+		CODE_UNKNOWN,
+		CODE_SAME,
+		CODE_DIFFERENT,	// checked per lane on every fetch
+	};
+	unsigned char codeState[0x10000 >> CODE_PAGE_SHIFT];
+
+	unsigned long long vectorInstructions;
+	unsigned long long scalarInstructions;
+};
+
+#endif
@@ -0,0 +1,87 @@
+// The AVX2 build of the lockstep kernel, only ever called once Lockstep has checked the CPU for AVX2
+// Nothing from the rest of the emulator is included but the constants of flags.h (see lockstepkernel.h)
+#include "lockstepkernel.h"
+
+#ifdef LOCKSTEP_AVX2
+#include "flags.h"
+
+#include <immintrin.h>
+
+// the project builds this file with /arch:AVX2, GCC and Clang get it for the functions below alone
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#endif
+
+// LOCKSTEP_WIDTH bytes, one per lane, masks are 0xFF / 0x00 per lane
+typedef __m256i Bytes;
+
+static inline Bytes loadBytes(const unsigned char* from) { return _mm256_loadu_si256((const __m256i*)from); }
+static inline void storeBytes(unsigned char* to, const Bytes val) { _mm256_storeu_si256((__m256i*)to, val); }
+static inline Bytes splat(const unsigned char val) { return _mm256_set1_epi8((char)val); }
+static inline Bytes add(const Bytes a, const Bytes b) { return _mm256_add_epi8(a, b); }
+static inline Bytes sub(const Bytes a, const Bytes b) { return _mm256_sub_epi8(a, b); }
+static inline Bytes band(const Bytes a, const Bytes b) { return _mm256_and_si256(a, b); }
+static inline Bytes bor(const Bytes a, const Bytes b) { return _mm256_or_si256(a, b); }
+static inline Bytes bxor(const Bytes a, const Bytes b) { return _mm256_xor_si256(a, b); }
+static inline Bytes equal(const Bytes a, const Bytes b) { return _mm256_cmpeq_epi8(a, b); }
+// unsigned a < b
+static inline Bytes below(const Bytes a, const Bytes b) { return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), _mm256_set1_epi8(-1)); }
+static inline Bytes select(const Bytes mask, const Bytes yes, const Bytes no) { return _mm256_blendv_epi8(no, yes, mask); }
+
+// FLAG_PV where an even number of bits is set, one table lookup per nibble
+static inline Bytes parity(const Bytes val)
+{
+	const __m256i odd = _mm256_setr_epi8(0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0);
+	const __m256i low = _mm256_and_si256(val, splat(0x0F));
+	const __m256i high = _mm256_and_si256(_mm256_srli_epi16(val, 4), splat(0x0F));
+	return bxor(bxor(_mm256_shuffle_epi8(odd, low), _mm256_shuffle_epi8(odd, high)), splat(FLAG_PV));
+}
+
+static inline unsigned int countBits(unsigned int bits)
+{
+	bits = bits - ((bits >> 1) & 0x55555555);
+	bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+	return (((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// lanes set in [mask]
+static inline unsigned int countLanes(const Bytes mask) { return countBits((unsigned int)_mm256_movemask_epi8(mask)); }
+
+// pc[i] of the lanes in [in] becomes [target] where [taken] is set and [next] elsewhere
+static inline void stepPC(unsigned short* pc, const Bytes in, const Bytes taken, const unsigned short target, const unsigned short next)
+{
+	const __m128i halvesIn[2] = { _mm256_castsi256_si128(in), _mm256_extracti128_si256(in, 1) };
+	const __m128i halvesTaken[2] = { _mm256_castsi256_si128(taken), _mm256_extracti128_si256(taken, 1) };
+	for (unsigned int half = 0; half < 2; half++)
+	{
+		const __m256i dest = _mm256_blendv_epi8(_mm256_set1_epi16((short)next), _mm256_set1_epi16((short)target), _mm256_cvtepi8_epi16(halvesTaken[half]));
+		__m256i* const at = (__m256i*)(pc + half * 16);
+		_mm256_storeu_si256(at, _mm256_blendv_epi8(_mm256_loadu_si256(at), dest, _mm256_cvtepi8_epi16(halvesIn[half])));
+	}
+}
+
+// counts[i] += (a[i] & aVal) + (b[i] & bVal), the sum has to fit a byte
+static inline void addCounts(unsigned long long* counts, const Bytes a, const unsigned char aVal, const Bytes b, const unsigned char bVal)
+{
+	const __m256i sum = add(band(a, splat(aVal)), band(b, splat(bVal)));
+	const __m128i low = _mm256_castsi256_si128(sum);
+	const __m128i high = _mm256_extracti128_si256(sum, 1);
+	const __m128i parts[8] = { low, _mm_srli_si128(low, 4), _mm_srli_si128(low, 8), _mm_srli_si128(low, 12),
+		high, _mm_srli_si128(high, 4), _mm_srli_si128(high, 8), _mm_srli_si128(high, 12) };
+	for (unsigned int part = 0; part < 8; part++)
+	{
+		__m256i* const at = (__m256i*)(counts + part * 4);
+		_mm256_storeu_si256(at, _mm256_add_epi64(_mm256_loadu_si256(at), _mm256_cvtepu8_epi64(parts[part])));
+	}
+}
+
+#define LOCKSTEP_KERNEL lockstepKernelAVX2
+#include "lockstepkernel.inl"
+#undef LOCKSTEP_KERNEL
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
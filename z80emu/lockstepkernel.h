@@ -0,0 +1,49 @@
+#ifndef Z80_LOCKSTEPKERNEL_H
+#define Z80_LOCKSTEPKERNEL_H
+
+// instances per vector, the lane count is rounded up to a multiple of it
+#define LOCKSTEP_WIDTH 32
+
+// The part of Lockstep::executeVector that only works on the registers of the lanes, LOCKSTEP_WIDTH lanes at a time.
+// lockstepkernel.inl is built twice: with a plain loop per lane in lockstep.cpp, and with AVX2 in lockstepavx2.cpp,
+// which includes nothing with inline functions (cpu.h would have them compiled for AVX2 there, and the linker may keep
+// that copy for the whole program). Lockstep runs the AVX2 one when CPUID says the CPU has it
+
+// an instruction the lanes of a group execute together
+struct LockstepInstruction
+{
+	unsigned char opcode;
+	unsigned char operand;		// the byte after the opcode
+	unsigned short next;		// where the lanes that do not branch go
+	unsigned short target;		// and the ones that do
+	int cond;					// see branches in lockstepkernel.inl
+	unsigned char baseCycles;
+	unsigned char extraCycles;	// when the branch is taken
+};
+
+// the arrays of Lockstep the kernel works on, one entry per lane
+struct LockstepLanes
+{
+	unsigned char* regs[8];		// as Lockstep::regs
+	unsigned char* flags;
+	unsigned char* refresh;
+	unsigned short* pc;
+	unsigned long long* cycles;
+	unsigned long long* executed;
+	const unsigned char* group;
+	const unsigned char* chunkActive;	// one per LOCKSTEP_WIDTH lanes
+	const unsigned char* fromHL;	// the byte each lane reads through (hl), for the opcodes that do
+	unsigned int chunks;
+};
+
+// executes [instruction] for the lanes of the group, ld (hl), r has done its stores already
+// [grouped] is set to the lanes that ran it and [takers] to the ones that took its branch
+typedef void (*LockstepKernel)(const LockstepInstruction& instruction, const LockstepLanes& lanes, unsigned int& grouped, unsigned int& takers);
+
+void lockstepKernelScalar(const LockstepInstruction& instruction, const LockstepLanes& lanes, unsigned int& grouped, unsigned int& takers);
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define LOCKSTEP_AVX2
+void lockstepKernelAVX2(const LockstepInstruction& instruction, const LockstepLanes& lanes, unsigned int& grouped, unsigned int& takers);
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+// The lockstep kernel (see lockstepkernel.h) on top of whatever Bytes is in the file that includes it
+// That file defines before the include:
+//	Bytes		LOCKSTEP_WIDTH bytes, one per lane, masks are 0xFF / 0x00 per lane
+//				and loadBytes, storeBytes, splat, add, sub, band, bor, bxor, equal, below, select, parity,
+//				countLanes, stepPC and addCounts on it
+//	LOCKSTEP_KERNEL	the name of the kernel function
+// Do not add a guard, this file is meant to be included more than once
+
+static inline Bytes signZero(const Bytes result)
+{
+	return bor(band(result, splat(FLAG_S)), band(equal(result, splat(0)), splat(FLAG_Z)));
+}
+
+// [flag] where bit 7 of [val] is set
+static inline Bytes bit7(const Bytes val, const unsigned char flag)
+{
+	return band(equal(band(val, splat(0x80)), splat(0x80)), splat(flag));
+}
+
+// add, adc, sub, sbc, and, xor, or, cp of every lane, F comes out the same as flagTables would give it
+static inline void alu(const unsigned int operation, const Bytes a, const Bytes val, const Bytes f, Bytes& result, Bytes& newFlags)
+{
+	const Bytes carryIn = (operation == 1 || operation == 3) ? band(f, splat(FLAG_C)) : splat(0);
+	switch (operation)
+	{
+		case 0:
+		case 1:
+		{
+			const Bytes sum = add(a, val);
+			result = add(sum, carryIn);
+			const Bytes carry = bor(below(sum, a), below(result, sum));
+			newFlags = bor(bor(signZero(result), band(bxor(bxor(a, val), result), splat(FLAG_H))),
+				bor(bit7(band(bxor(a, result), bxor(val, result)), FLAG_PV), band(carry, splat(FLAG_C))));
+			return;
+		}
+		case 2:
+		case 3:
+		case 7:
+		{
+			const Bytes diff = sub(a, val);
+			const Bytes full = sub(diff, carryIn);
+			const Bytes borrow = bor(below(a, val), below(diff, carryIn));
+			newFlags = bor(bor(signZero(full), band(bxor(bxor(a, val), full), splat(FLAG_H))),
+				bor(bit7(band(bxor(a, val), bxor(a, full)), FLAG_PV), bor(splat(FLAG_N), band(borrow, splat(FLAG_C)))));
+			result = (operation == 7) ? a : full;
+			return;
+		}
+		case 4:
+		{
+			result = band(a, val);
+			newFlags = bor(bor(signZero(result), parity(result)), splat(FLAG_H));
+			return;
+		}
+		case 5:
+		{
+			result = bxor(a, val);
+			newFlags = bor(signZero(result), parity(result));
+			return;
+		}
+		default:
+		{
+			result = bor(a, val);
+			newFlags = bor(signZero(result), parity(result));
+			return;
+		}
+	}
+}
+
+// the lanes that take a branch with condition [cond]: nz, z, nc, c, po, pe, p, m, then 8 for always, 9 for djnz (b != 0)
+// and -1 for no branch
+static inline Bytes branches(const int cond, const Bytes f, const Bytes b)
+{
+	static const unsigned char masks[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+	if (cond < 0)
+	{
+		return splat(0);
+	}
+	if (cond == 8)
+	{
+		return splat(0xFF);
+	}
+	const Bytes clear = (cond == 9) ? equal(b, splat(0)) : equal(band(f, splat(masks[cond >> 1])), splat(0));
+	return ((cond & 1) != 0) ? bxor(clear, splat(0xFF)) : clear;
+}
+
+// one chunk of LOCKSTEP_WIDTH lanes from [c]
+static inline void executeChunk(const LockstepInstruction& instruction, const LockstepLanes& lanes, const unsigned int c,
+	unsigned int& grouped, unsigned int& takers)
+{
+	const unsigned char opcode = instruction.opcode;
+	const unsigned int y = (opcode >> 3) & 7;
+	const unsigned int z = opcode & 7;
+	const bool readsHL = (opcode >= 0x40 && opcode < 0xC0 && z == 6);
+	unsigned char* regs[8];
+	for (unsigned int reg = 0; reg < 8; reg++)
+	{
+		regs[reg] = lanes.regs[reg] + c;
+	}
+	unsigned char* const flags = lanes.flags + c;
+	const unsigned char* const fromHL = lanes.fromHL + c;
+	const Bytes mask = loadBytes(lanes.group + c);
+
+	if (opcode >= 0x40 && opcode < 0x80)
+	{
+		// ld (hl), r (y = 6) has no register to write
+		if (y != 6)
+		{
+			const Bytes val = readsHL ? loadBytes(fromHL) : loadBytes(regs[z]);
+			storeBytes(regs[y], select(mask, val, loadBytes(regs[y])));
+		}
+	}
+	else if (opcode < 0x40 && z == 6)
+	{
+		// ld r, n
+		storeBytes(regs[y], select(mask, splat(instruction.operand), loadBytes(regs[y])));
+	}
+	else if (opcode >= 0x80 && (opcode < 0xC0 || z == 6))
+	{
+		const Bytes val = (opcode >= 0xC0) ? splat(instruction.operand) : readsHL ? loadBytes(fromHL) : loadBytes(regs[z]);
+		const Bytes a = loadBytes(regs[7]);
+		const Bytes f = loadBytes(flags);
+		Bytes result;
+		Bytes newFlags;
+		alu(y, a, val, f, result, newFlags);
+		storeBytes(regs[7], select(mask, result, a));
+		storeBytes(flags, select(mask, newFlags, f));
+	}
+	else if (opcode < 0x40 && (z == 4 || z == 5))
+	{
+		// inc / dec r, the carry stays
+		const Bytes val = loadBytes(regs[y]);
+		const Bytes f = loadBytes(flags);
+		Bytes result;
+		Bytes newFlags;
+		if (z == 4)
+		{
+			result = add(val, splat(1));
+			newFlags = bor(bor(signZero(result), band(equal(band(val, splat(0x0F)), splat(0x0F)), splat(FLAG_H))),
+				bor(band(equal(val, splat(0x7F)), splat(FLAG_PV)), band(f, splat(FLAG_C))));
+		}
+		else
+		{
+			result = sub(val, splat(1));
+			newFlags = bor(bor(signZero(result), band(equal(band(val, splat(0x0F)), splat(0)), splat(FLAG_H))),
+				bor(band(equal(val, splat(0x80)), splat(FLAG_PV)), bor(splat(FLAG_N), band(f, splat(FLAG_C)))));
+		}
+		storeBytes(regs[y], select(mask, result, val));
+		storeBytes(flags, select(mask, newFlags, f));
+	}
+	else if (opcode < 0x40 && z == 3)
+	{
+		// inc / dec bc, de, hl on the two halves, no flags
+		const unsigned int high = (opcode >> 4) * 2;
+		const Bytes hi = loadBytes(regs[high]);
+		const Bytes lo = loadBytes(regs[high + 1]);
+		Bytes newHi;
+		Bytes newLo;
+		if ((opcode & 0x08) == 0)
+		{
+			newLo = add(lo, splat(1));
+			newHi = add(hi, band(equal(newLo, splat(0)), splat(1)));
+		}
+		else
+		{
+			newLo = sub(lo, splat(1));
+			newHi = sub(hi, band(equal(lo, splat(0)), splat(1)));
+		}
+		storeBytes(regs[high], select(mask, newHi, hi));
+		storeBytes(regs[high + 1], select(mask, newLo, lo));
+	}
+	else if (opcode == 0x10)
+	{
+		const Bytes b = loadBytes(regs[0]);
+		storeBytes(regs[0], select(mask, sub(b, splat(1)), b));
+	}
+
+	// PC, cycles, R and the instruction count, the branch is decided per lane
+	const Bytes taken = band(mask, branches(instruction.cond, loadBytes(flags), loadBytes(regs[0])));
+	storeBytes(lanes.refresh + c, add(loadBytes(lanes.refresh + c), band(mask, splat(1))));
+	stepPC(lanes.pc + c, mask, taken, instruction.target, instruction.next);
+	addCounts(lanes.cycles + c, mask, instruction.baseCycles, taken, instruction.extraCycles);
+	addCounts(lanes.executed + c, mask, 1, taken, 0);
+	grouped += countLanes(mask);
+	takers += countLanes(taken);
+}
+
+void LOCKSTEP_KERNEL(const LockstepInstruction& instruction, const LockstepLanes& lanes, unsigned int& grouped, unsigned int& takers)
+{
+	grouped = 0;
+	takers = 0;
+	for (unsigned int chunk = 0; chunk < lanes.chunks; chunk++)
+	{
+		if (lanes.chunkActive[chunk])
+		{
+			executeChunk(instruction, lanes, chunk * LOCKSTEP_WIDTH, grouped, takers);
+		}
+	}
+}
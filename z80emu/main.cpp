@@ -1,8 +1,171 @@
 #include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
 #include "cpu.h"
+#include "bench.h"
+#include "batch.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "symbols.h"
+#include "trace.h"
+#include "verify.h"
 
 int main(int argc, char **argv)
 {
+	// z80emu -bench [rom] [instructions]
+	if (argc > 1 && std::string(argv[1]) == "-bench")
+	{
+		const std::string rom = (argc > 2) ? argv[2] : "";
+		const unsigned long instructions = (argc > 3) ? std::strtoul(argv[3], NULL, 10) : 50000000;
+		return benchmarkDispatch(rom, instructions) ? 0 : 1;
+	}
+
+	// z80emu -bench-opcodes [instructions]: JSON for tools that track regressions
+	if (argc > 1 && std::string(argv[1]) == "-bench-opcodes")
+	{
+		const unsigned long instructions = (argc > 2) ? std::strtoul(argv[2], NULL, 10) : 10000000;
+		return benchmarkOpcodes(instructions) ? 0 : 1;
+	}
+
+	// z80emu -verify-jit [seeds]: the exit status says whether the JIT matched the switch engine
+	if (argc > 1 && std::string(argv[1]) == "-verify-jit")
+	{
+		const unsigned long seeds = (argc > 2) ? std::strtoul(argv[2], NULL, 10) : 4;
+		return verifyJit(seeds) ? 0 : 1;
+	}
+
+	// z80emu -trace rom instructions file: runs [rom] and saves the last instructions it executed to [file]
+	if (argc > 4 && std::string(argv[1]) == "-trace")
+	{
+		CPU cpu;
+		TraceBuffer trace(1 << 16);
+		const CPU::LoadResult loaded = cpu.loadROM(argv[2]);
+		if (loaded != CPU::LOAD_OK)
+		{
+			std::cerr << "Unable to load ROM: " << argv[2] << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+			return 1;
+		}
+		cpu.setTrace(&trace);
+		cpu.run(std::strtoull(argv[3], NULL, 10));
+		return trace.save(argv[4]) ? 0 : 1;
+	}
+
+	// z80emu -profile rom instructions report stacks [symbols]: runs [rom] with the profiler on, writes the hot spots to [report]
+	// and the call stacks to [stacks] for flamegraph.pl, named after the equates in [symbols] (ti83plus.inc) when given
+	if (argc > 5 && std::string(argv[1]) == "-profile")
+	{
+		CPU cpu;
+		Profiler profiler;
+		SymbolTable symbols;
+		const CPU::LoadResult loaded = cpu.loadROM(argv[2]);
+		if (loaded != CPU::LOAD_OK)
+		{
+			std::cerr << "Unable to load ROM: " << argv[2] << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+			return 1;
+		}
+		if (argc > 6 && !symbols.load(argv[6]))
+		{
+			std::cerr << "Unable to read symbols: " << argv[6] << std::endl;
+			return 1;
+		}
+		cpu.setProfiler(&profiler);
+		cpu.run(std::strtoull(argv[3], NULL, 10));
+		const SymbolTable* names = (argc > 6) ? &symbols : NULL;
+		return (profiler.writeReport(argv[4], names, 100) && profiler.writeCollapsed(argv[5], names)) ? 0 : 1;
+	}
+
+	// z80emu -hle rom instructions [check]: runs [rom] with native B_CALLs (or compared with the ROM routines) and prints what they displayed
+	if (argc > 3 && std::string(argv[1]) == "-hle")
+	{
+		CPU cpu;
+		const CPU::LoadResult loaded = cpu.loadROM(argv[2]);
+		if (loaded != CPU::LOAD_OK)
+		{
+			std::cerr << "Unable to load ROM: " << argv[2] << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+			return 1;
+		}
+		cpu.setHle((argc > 4 && std::string(argv[4]) == "check") ? CPU::HLE_CHECK : CPU::HLE_NATIVE);
+		cpu.run(std::strtoull(argv[3], NULL, 10));
+		const CPU::HleStats& stats = cpu.getHleStats();
+		std::cout << cpu.getHleOutput() << std::endl;
+		std::cerr << stats.native << " native, " << stats.rom << " ROM, " << stats.checked << " checked, " << stats.mismatches << " mismatches";
+		if (stats.mismatches != 0)
+		{
+			std::cerr << " (last at " << std::hex << std::uppercase << stats.lastMismatch << std::dec << ")";
+		}
+		std::cerr << std::endl;
+		return (stats.mismatches == 0) ? 0 : 1;
+	}
+
+	// z80emu -timer rom cycles period: runs [rom] for [cycles] T-states with a timer requesting an interrupt (rst 38h on the bus)
+	// every [period] T-states, on the blocks engine with the JIT so that polling loops are passed over as well as halts
+	if (argc > 4 && std::string(argv[1]) == "-timer")
+	{
+		CPU cpu;
+		Scheduler scheduler;
+		const CPU::LoadResult loaded = cpu.loadROM(argv[2]);
+		if (loaded != CPU::LOAD_OK)
+		{
+			std::cerr << "Unable to load ROM: " << argv[2] << " (" << CPU::loadResultText(loaded) << ")" << std::endl;
+			return 1;
+		}
+		const unsigned long long period = std::strtoull(argv[4], NULL, 10);
+		if (period == 0)
+		{
+			std::cerr << "The timer period has to be at least one T-state" << std::endl;
+			return 1;
+		}
+		Scheduler::EventId timer = 0;
+		timer = scheduler.add([&](unsigned long long deadline)
+		{
+			cpu.requestInterrupt();
+			scheduler.schedule(timer, deadline + period);
+		});
+		scheduler.schedule(timer, period);
+		cpu.setScheduler(&scheduler);
+
+		const CPU::RunResult result = cpu.runCycles(std::strtoull(argv[3], NULL, 10), CPU::DISPATCH_JIT);
+		const CPU::Registers registers = cpu.getRegisters();
+		std::cout << result.instructions << " instructions (" << cpu.getIdleInstructions() << " idle), " << result.cycles << " T-states, "
+			<< scheduler.getFired() << " timer interrupts requested, PC " << std::hex << std::uppercase << registers.PC << std::dec
+			<< (cpu.isHalted() ? " halted" : "") << std::endl;
+		return 0;
+	}
+
+	// z80emu -batch rom instructions threads input...: runs [rom] once per input file (copied to 0x8000) on [threads] threads (0: one per core)
+	if (argc > 5 && std::string(argv[1]) == "-batch")
+	{
+		const std::vector<std::string> inputs(argv + 5, argv + argc);
+		return runBatchFiles(argv[2], std::strtoull(argv[3], NULL, 10), (unsigned int)std::strtoul(argv[4], NULL, 10), inputs) ? 0 : 1;
+	}
+
+	// z80emu -lockstep rom instructions input...: the same runs as -batch, side by side on one thread
+	if (argc > 4 && std::string(argv[1]) == "-lockstep")
+	{
+		const std::vector<std::string> inputs(argv + 4, argv + argc);
+		return runBatchFiles(argv[2], std::strtoull(argv[3], NULL, 10), 1, inputs, true) ? 0 : 1;
+	}
+
+	// z80emu -dump-trace file [symbols]: decodes a trace saved by -trace, naming the PCs after the equates in [symbols]
+	if (argc > 2 && std::string(argv[1]) == "-dump-trace")
+	{
+		TraceBuffer trace(1);
+		SymbolTable symbols;
+		if (!trace.load(argv[2]))
+		{
+			std::cerr << "Unable to read trace: " << argv[2] << std::endl;
+			return 1;
+		}
+		if (argc > 3 && !symbols.load(argv[3]))
+		{
+			std::cerr << "Unable to read symbols: " << argv[3] << std::endl;
+			return 1;
+		}
+		formatTrace(trace, std::cout, (argc > 3) ? &symbols : NULL);
+		return 0;
+	}
+
 	CPU cpu;
 	cpu.test();
 	std::cin.ignore();
@@ -0,0 +1,103 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	view = NULL;
+	length = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& fileName)
+{
+	close();
+
+#ifdef _WIN32
+	file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER fileSize;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		close();
+		return false;
+	}
+	view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		close();
+		return false;
+	}
+	length = (size_t)fileSize.QuadPart;
+#else
+	const int file = ::open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+	// the mapping keeps its own reference to the file
+	void* const mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (mapped == MAP_FAILED)
+	{
+		return false;
+	}
+	view = (const char*)mapped;
+	length = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (view != NULL)
+	{
+		UnmapViewOfFile(view);
+	}
+	if (mapping != NULL)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	if (view != NULL)
+	{
+		munmap((void*)view, length);
+	}
+#endif
+	view = NULL;
+	length = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef Z80_MAPPEDFILE_H
+#define Z80_MAPPEDFILE_H
+
+#include <string>
+
+// Read-only view of a whole file through mmap (a file mapping on Windows), nothing is copied
+// The pages are read in by the OS the first time they are touched
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// replaces the current view, false if the file could not be opened or mapped (an empty file cannot be mapped)
+	bool open(const std::string& fileName);
+	void close();
+
+	bool isOpen() const { return view != NULL; }
+	const char* data() const { return view; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* view;
+	size_t length;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+};
+
+#endif
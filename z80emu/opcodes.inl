@@ -0,0 +1,1802 @@
+// Opcode bodies for the main (unprefixed) instruction table
+// This file is included several times by cpu.cpp, once per dispatch engine:
+//	OPCODE(n)	starts the body of opcode n (a case label, a handler or a goto label)
+//	END_OPCODE	ends it (a break, nothing, or a jump to the next instruction)
+//	INDEX_REG	INDEX_HL, or INDEX_IX / INDEX_IY when the bodies are instantiated for a DD / FD prefix,
+//				the bodies go through regH / regL / regHL / addrHL wherever the prefix replaces hl by an index register
+// Every body must increment PC by size (in bytes) of opcode, PC points at the opcode after any DD / FD prefix
+// Do not add a guard, this file is meant to be included more than once
+
+OPCODE(0x00) // NOP
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x01) // ld BC, **
+{
+	//const short val = (read8(PC) << 8) | (read8(PC + 1) & 0xFF);
+	BC(load16());
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x02) // ld (BC), a
+{
+	write8(BC(), A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x03) // inc BC
+{
+	const short bc = BC();
+	BC(bc + 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x04) // inc b
+{
+	B = inc8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x05) // dec b
+{
+	B = dec8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x06) // ld b, *
+{
+	B = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x07) // rlca
+{
+	const unsigned char a = A;
+	A = (a << 1) | (a >> 7);
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | (a >> 7));
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x08) // ex af, af' (~!GB)
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x09) // add hl, bc
+{
+	add16<INDEX_REG>(BC());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x0A) // ld a, (BC)
+{
+	A = read8(BC());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x0B) // dec BC
+{
+	const short bc = BC();
+	BC(bc - 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x0C) // inc C
+{
+	C = inc8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x0D) // dec C
+{
+	C = dec8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x0E) // ld c, *
+{
+	C = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x0F) // rrca
+{
+	const unsigned char a = A;
+	A = (a >> 1) | (a << 7);
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | (a & FLAG_C));
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x10) // djnz *
+{
+	B--;
+	if (B != 0)
+	{
+		PC += (signed char)read8(PC + 1) + 2; // relative to the next instruction, like jr
+		cycles += CYCLES_DJNZ_TAKEN;
+	}
+	else
+	{ 
+		PC += 2;
+	}
+}
+END_OPCODE
+
+OPCODE(0x11) // ld de, **
+{
+	//const short val = (read8(PC) << 8) | (read8(PC + 1) & 0xFF);
+	DE(load16());
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x12) // ld (de), a
+{
+	write8(DE(), A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x13) // inc de
+{
+	const short de = DE();
+	DE(de + 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x14) // inc d
+{
+	D = inc8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x15) // dec d
+{
+	D = dec8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x16) // ld d, *
+{
+	D = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x17) // rla
+{
+	const unsigned char a = A;
+	A = (a << 1) | carry();
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | (a >> 7));
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x18) // jr *
+{
+	jr(true, read8(PC + 1), 2);
+}
+END_OPCODE
+
+OPCODE(0x19) // add hl, de
+{
+	add16<INDEX_REG>(DE());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x1A) // ld a, (de)
+{
+	A = read8(DE());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x1B) // dec de
+{
+	const short de = DE();
+	DE(de - 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x1C) // inc e
+{
+	E = inc8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x1D) // dec e
+{
+	E = dec8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x1E) // ld e, *
+{
+	E = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x1F) // rra
+{
+	const unsigned char a = A;
+	A = (a >> 1) | (carry() << 7);
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | (a & FLAG_C));
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x20) // jr nz, *
+{
+	jr(!zero(), read8(PC + 1), 2);
+}
+END_OPCODE
+
+OPCODE(0x21) // ld hl, **
+{
+	regHL<INDEX_REG>(load16());
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x22) // load (**), hl
+{
+	write16(get16(), regHL<INDEX_REG>());
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x23) // inc hl
+{
+	const short hl = regHL<INDEX_REG>();
+	regHL<INDEX_REG>(hl + 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x24) // inc h
+{
+	regH<INDEX_REG>() = inc8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x25) // dec h
+{
+	regH<INDEX_REG>() = dec8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x26) // ld h, *
+{
+	regH<INDEX_REG>() = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x27) // daa
+{
+	daa();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x28) // jr z, *
+{
+	jr(zero(), read8(PC + 1), 2);
+}
+END_OPCODE
+
+OPCODE(0x29) // add hl, hl
+{
+	add16<INDEX_REG>(regHL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x2A) // ld hl, (**) 
+{
+	regHL<INDEX_REG>(read16(get16()));
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x2B) // dec hl
+{
+	const short hl = regHL<INDEX_REG>();
+	regHL<INDEX_REG>(hl - 1);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x2C) // inc l
+{
+	regL<INDEX_REG>() = inc8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x2D) // dec l
+{
+	regL<INDEX_REG>() = dec8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x2E) // ld l, *
+{
+	regL<INDEX_REG>() = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x2F) // cpl
+{
+	A = ~A;
+	setF(getF() | FLAG_H | FLAG_N);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x30) // jr nc, *
+{
+	jr(!carry(), read8(PC + 1), 2);
+}
+END_OPCODE
+
+OPCODE(0x31) // ld sp, **
+{
+	SP = get16();
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x32) // ld (**), a
+{
+	write8(get16(), A);
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x33) // inc sp
+{
+	this->SP++;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x34) // inc (hl)
+{
+	const unsigned short address = addrHL<INDEX_REG>();
+	write8(address, inc8(read8(address)));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x35) // dec (hl)
+{
+	const unsigned short address = addrHL<INDEX_REG>();
+	write8(address, dec8(read8(address)));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x36) // ld (hl), *
+{
+	write8(addrHL<INDEX_REG>(), read8(PC + 1 + dispBytes<INDEX_REG>()));
+	PC += 2 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x37) // scf
+{
+	setF((getF() & (FLAG_S | FLAG_Z | FLAG_PV)) | FLAG_C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x38) // jr c, *
+{
+	jr(carry(), read8(PC + 1), 2);
+}
+END_OPCODE
+
+OPCODE(0x39) // add hl, sp
+{
+	add16<INDEX_REG>(SP);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x3A) // ld a, (**)
+{
+	A = read8(load16());
+	PC += 3;
+}
+END_OPCODE
+
+OPCODE(0x3B) // dec sp
+{
+	SP--;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x3C) // inc a
+{
+	A = inc8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x3D) // dec a
+{
+	A = dec8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x3E) // ld a, *
+{
+	A = read8(PC + 1);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0x3F) // ccf
+{
+	const unsigned char f = getF();
+	setF((f & (FLAG_S | FLAG_Z | FLAG_PV)) | ((f & FLAG_C) << 4) | ((f & FLAG_C) ^ FLAG_C)); // H gets the old carry
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x40) // ld b, b
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x41) // ld b, c
+{
+	B = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x42) // ld b, d
+{
+	B = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x43) // ld b, e
+{
+	B = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x44) // ld b, h
+{
+	B = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x45) // ld b, l
+{
+	B = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x46) // ld b, (hl)
+{
+	B = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x47) // ld b, a
+{
+	B = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x48) // ld c, b
+{
+	C = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x49) // ld c, c
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x4A) // ld c, d
+{
+	C = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x4B) // ld c, e
+{
+	C = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x4C) // ld c, h
+{
+	C = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x4D) // ld c, l
+{
+	C = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x4E) // ld c, (hl)
+{
+	C = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x4F) // ld c, a
+{
+	C = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x50) // ld d, b
+{
+	D = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x51) // ld d, c
+{
+	D = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x52) // ld d, d
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x53) // ld d, e
+{
+	D = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x54) // ld d, h
+{
+	D = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x55) // ld d, l
+{
+	D = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x56) // ld d, (hl)
+{
+	D = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x57) // ld d, a
+{
+	D = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x58) // ld e, b
+{
+	E = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x59) // ld e, c
+{
+	E = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x5A) // ld e, d
+{
+	E = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x5B) // ld e, e
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x5C) // ld e, h
+{
+	E = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x5D) // ld e, l
+{
+	E = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x5E) // ld e, (hl)
+{
+	E = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x5F) // ld e, a
+{
+	E = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x60) // ld h, b
+{
+	regH<INDEX_REG>() = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x61) // ld h, c
+{
+	regH<INDEX_REG>() = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x62) // ld h, d
+{
+	regH<INDEX_REG>() = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x63) // ld h, e
+{
+	regH<INDEX_REG>() = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x64) // ld h, h &&&
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x65) // ld h, l
+{
+	regH<INDEX_REG>() = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x66) // ld h, (hl)
+{
+	H = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x67) // ld h, a
+{
+	regH<INDEX_REG>() = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x68) // ld l, b
+{
+	regL<INDEX_REG>() = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x69) // ld l, c
+{
+	regL<INDEX_REG>() = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x6A) // ld l, d
+{
+	regL<INDEX_REG>() = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x6B) // ld l, e
+{
+	regL<INDEX_REG>() = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x6C) // ld l, h
+{
+	regL<INDEX_REG>() = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x6D) // ld l, l &&&
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x6E) // ld l, (hl)
+{
+	L = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x6F) // ld l, a
+{
+	regL<INDEX_REG>() = A;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x70) // ld (hl), b
+{
+	write8(addrHL<INDEX_REG>(), B);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x71) // ld (hl), c
+{
+	write8(addrHL<INDEX_REG>(), C);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x72) // ld (hl), d
+{
+	write8(addrHL<INDEX_REG>(), D);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x73) // ld (hl), e
+{
+	write8(addrHL<INDEX_REG>(), E);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x74) // ld (hl), h
+{
+	write8(addrHL<INDEX_REG>(), H);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x75) // ld (hl), l
+{
+	write8(addrHL<INDEX_REG>(), L);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x76) // halt ^^^
+{
+	halt();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x77) // ld (hl), a
+{
+	write8(addrHL<INDEX_REG>(), A);
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x78) // ld a, b
+{
+	A = B;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x79) // ld a, c
+{
+	A = C;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x7A) // ld a, d
+{
+	A = D;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x7B) // ld a, e
+{
+	A = E;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x7C) // ld a, h
+{
+	A = regH<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x7D) // ld a, l
+{
+	A = regL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x7E) // ld a, (hl)
+{
+	A = read8(addrHL<INDEX_REG>());
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x7F) // ld a, a &&&
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x80) // add a, b
+{
+	add8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x81) // add a, c
+{
+	add8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x82) // add a,d 
+{
+	add8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x83) // add a, e
+{
+	add8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x84) // add a, h
+{
+	add8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x85) // add a, l
+{
+	add8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x86) // add a, (hl)
+{
+	add8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x87) // add a, a
+{
+	add8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x88) // adc a, b
+{
+	adc8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x89) // adc a, c
+{
+	adc8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x8A) // adc a, d
+{
+	adc8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x8B) // adc a, e
+{
+	adc8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x8C) // adc a, h
+{
+	adc8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x8D) // adc a, l
+{
+	adc8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x8E) // adc a, (hl)
+{
+	adc8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x8F) // adc a, a
+{
+	adc8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x90) // sub b
+{
+	sub8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x91) // sub c
+{
+	sub8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x92) // sub d
+{
+	sub8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x93) // sub e
+{
+	sub8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x94) // sub h
+{
+	sub8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x95) // sub l
+{
+	sub8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x96) // sub (hl)
+{
+	sub8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x97) // sub a 
+{
+	sub8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x98) // sbc a, b
+{
+	sbc8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x99) // sbc a, c
+{
+	sbc8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x9A) // sbc a, d
+{
+	sbc8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x9B) // sbc a, e
+{
+	sbc8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x9C) // sbc a, h
+{
+	sbc8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x9D) // sbc a, l
+{
+	sbc8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0x9E) // sbc a, (hl)
+{
+	sbc8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0x9F) // sbc a, a
+{
+	sbc8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA0) // and b
+{
+	and8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA1) // and c
+{
+	and8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA2) // and d
+{
+	and8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA3) // and e
+{
+	and8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA4) // and h
+{
+	and8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA5) // and l
+{
+	and8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA6) // and (hl)
+{
+	and8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0xA7) // and a &&&
+{
+	and8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA8) // xor b
+{
+	xor8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xA9) // xor c
+{
+	xor8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xAA) // xor d
+{
+	xor8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xAB) // xor e
+{
+	xor8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xAC) // xor h
+{
+	xor8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xAD) // xor l
+{
+	xor8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xAE) // xor (hl)
+{
+	xor8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0xAF) // xor a &&& A = 0
+{
+	xor8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB0) // or b
+{
+	or8(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB1) // or c
+{
+	or8(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB2) // or d
+{
+	or8(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB3) // or e
+{
+	or8(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB4) // or h
+{
+	or8(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB5) // or l
+{
+	or8(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB6) // or (hl)
+{
+	or8(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0xB7) // or a &&&
+{
+	or8(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB8) // cp b
+{
+	cmp(B);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xB9) // cp c
+{
+	cmp(C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xBA) // cp d
+{
+	cmp(D);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xBB) // cp e
+{
+	cmp(E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xBC) // cp h
+{
+	cmp(regH<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xBD) // cp l
+{
+	cmp(regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xBE) // cp (hl)
+{
+	cmp(read8(addrHL<INDEX_REG>()));
+	PC += 1 + dispBytes<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0xBF) // cp a
+{
+	cmp(A);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xC0) // ret nz
+{
+	ret(!zero());
+}
+END_OPCODE
+
+OPCODE(0xC1) // pop bc
+{
+	C = read8(SP);
+	SP++;
+	B = read8(SP);
+	SP++;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xC2) // jp nz, ** ^^^ check get16
+{
+	jp(!zero(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xC3) // jp **
+{
+	jp(true, get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xC4) // call nz, ** ^^^
+{
+	call(!zero());
+}
+END_OPCODE
+
+OPCODE(0xC5) // push bc
+{
+	SP--;
+	write8(SP, B);
+	SP--;
+	write8(SP, C);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xC6) // add a, *
+{
+	add8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xC7) // rst 0x00
+{
+	rst(0x00);
+}
+END_OPCODE
+
+OPCODE(0xC8) // ret z
+{
+	ret(zero());
+}
+END_OPCODE
+
+OPCODE(0xC9) // ret
+{
+	ret(true);
+}
+END_OPCODE
+
+OPCODE(0xCA) // jp z, **
+{
+	jp(zero(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xCB) // BIT INSTRUCTIONS
+{
+	decodeBitInstruction<INDEX_REG>();
+}
+END_OPCODE
+
+OPCODE(0xCC) // call z, **
+{
+	call(zero());
+}
+END_OPCODE
+
+OPCODE(0xCD) // call **
+{
+	call(true);
+}
+END_OPCODE
+
+OPCODE(0xCE) // adc a, *
+{
+	adc8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xCF) // rst 0x08
+{
+	rst(0x08);
+}
+END_OPCODE
+
+OPCODE(0xD0) // ret nc
+{
+	ret(!carry());
+}
+END_OPCODE
+
+OPCODE(0xD1) // pop de
+{
+	E = read8(SP);
+	SP++;
+	D = read8(SP);
+	SP++;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xD2) // jp nc, **
+{
+	jp(!carry(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xD3) // out (*), a ~!GB
+{
+	writePort(read8(PC + 1), A);
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xD4) // call nc, **
+{
+	call(!carry());
+}
+END_OPCODE
+
+OPCODE(0xD5) // push de
+{
+	SP--;
+	write8(SP, D);
+	SP--;
+	write8(SP, E);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xD6) // sub *
+{
+	sub8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xD7) // rst 0x10
+{
+	rst(0x10);
+}
+END_OPCODE
+
+OPCODE(0xD8) // ret c
+{
+	ret(carry());
+}
+END_OPCODE
+
+OPCODE(0xD9) // exx ~!GB
+{
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xDA) // jp c, **
+{
+	jp(carry(), get16(), 3);
+
+}
+END_OPCODE
+
+OPCODE(0xDB) // in a, (*) ~!GB
+{
+	A = readPort(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xDC) // call c, **
+{
+	call(carry());
+}
+END_OPCODE
+
+OPCODE(0xDD) // IX INSTRUCTIONS ~!GB
+{
+	decodeIXInstruction(read8(PC + 1));
+}
+END_OPCODE
+
+OPCODE(0xDE) // sbc a, *
+{
+	sbc8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xDF) // rst 0x18
+{
+	rst(0x18);
+}
+END_OPCODE
+
+OPCODE(0xE0) // ret po
+{
+	ret(!overflow());
+}
+END_OPCODE
+
+OPCODE(0xE1) // pop hl
+{
+	regL<INDEX_REG>() = read8(SP);
+	SP++;
+	regH<INDEX_REG>() = read8(SP);
+	SP++;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xE2) // jp po, **
+{
+	jp(!overflow(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xE3) // ex (sp), hl ~!GB
+{
+	const unsigned short hl = regHL<INDEX_REG>();
+	regHL<INDEX_REG>(read16(SP));
+	write16(SP, hl);
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xE4) // call po, **
+{
+	call(!overflow());
+}
+END_OPCODE
+
+OPCODE(0xE5) // push hl
+{
+	SP--;
+	write8(SP, regH<INDEX_REG>());
+	SP--;
+	write8(SP, regL<INDEX_REG>());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xE6) // and *
+{
+	and8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xE7) // rst 0x20
+{
+	rst(0x20);
+}
+END_OPCODE
+
+OPCODE(0xE8) // ret pe
+{
+	ret(overflow());
+}
+END_OPCODE
+
+OPCODE(0xE9) // jp (hl)
+{
+	jp(true, regHL<INDEX_REG>(), 1);
+}
+END_OPCODE
+
+OPCODE(0xEA) // jp pe, **
+{
+	jp(overflow(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xEB) // ex de, hl ~!GB
+{
+	const short de = DE();
+	DE(HL()); // swap de = hl
+	HL(de); // hl = de
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xEC) // call pe, **
+{
+	call(overflow());
+}
+END_OPCODE
+
+OPCODE(0xED) // EXTENDED INSTRUCTIONS ~!GB
+{
+	decodeExtendedInstruction(read8(PC + 1));
+}
+END_OPCODE
+
+OPCODE(0xEE) // xor *
+{
+	xor8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xEF) // rst 0x28
+{
+	rst(0x28);
+}
+END_OPCODE
+
+OPCODE(0xF0) // ret p !~GB
+{
+	ret(!sign());
+}
+END_OPCODE
+
+OPCODE(0xF1) // pop af
+{
+	setF(read8(SP));
+	SP++;
+	A = read8(SP);
+	SP++;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xF2) // jp p, **
+{
+	jp(!sign(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xF3) // di ^^^
+{
+	IFF1 = IFF2 = false;
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xF4) // call p, **
+{
+	call(!sign());
+}
+END_OPCODE
+
+OPCODE(0xF5) // push af
+{
+	SP--;
+	write8(SP, A);
+	SP--;
+	write8(SP, getF());
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xF6) // or *
+{
+	or8(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xF7) // rst 0x30
+{
+	rst(0x30);
+}
+END_OPCODE
+
+OPCODE(0xF8) // ret m
+{
+	ret(sign());
+}
+END_OPCODE
+
+OPCODE(0xF9) // ld sp, hl
+{
+	SP = regHL<INDEX_REG>();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xFA) // jp m, **
+{
+	jp(sign(), get16(), 3);
+}
+END_OPCODE
+
+OPCODE(0xFB) // ei ^^^
+{
+	enableInterrupts();
+	PC++;
+}
+END_OPCODE
+
+OPCODE(0xFC) // call m, **
+{
+	call(sign());
+}
+END_OPCODE
+
+OPCODE(0xFD) // IY INSTRUCTIONS ~!GB
+{
+	decodeIYInstruction(read8(PC + 1));
+}
+END_OPCODE
+
+OPCODE(0xFE) // cp *
+{
+	cmp(read8(PC + 1));
+	PC += 2;
+}
+END_OPCODE
+
+OPCODE(0xFF) // rst 0x38
+{
+	rst(0x38);
+}
+END_OPCODE
@@ -0,0 +1,253 @@
+#include "profiler.h"
+#include "symbols.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// call **, call cc, **, rst
+static bool isCall(const unsigned char opcode)
+{
+	return opcode == 0xCD || (opcode & 0xC7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+}
+
+// ret, ret cc, retn / reti ([next] is the byte after the opcode)
+static bool isReturn(const unsigned char opcode, const unsigned char next)
+{
+	return opcode == 0xC9 || (opcode & 0xC7) == 0xC0 || (opcode == 0xED && (next == 0x45 || next == 0x4D));
+}
+
+Profiler::Profiler()
+{
+	memset(counters, 0, sizeof(counters));
+	clear();
+}
+
+Profiler::~Profiler()
+{
+	for (unsigned int i = 0; i < (NUM_BANKS << 8); i++)
+	{
+		delete[] counters[i];
+	}
+}
+
+void Profiler::clear()
+{
+	for (unsigned int i = 0; i < (NUM_BANKS << 8); i++)
+	{
+		if (counters[i])
+		{
+			memset(counters[i], 0, BANK_SIZE * sizeof(ProfileCounter));
+		}
+	}
+	nodes.assign(1, Node());
+	nodes[0].parent = 0;
+	nodes[0].address = 0;
+	nodes[0].cycles = 0;
+	children.clear();
+	acknowledges.executions = 0;
+	acknowledges.cycles = 0;
+	node = 0;
+	depth = 0;
+	lost = 0;
+	last = NULL;
+	lastCycles = 0;
+	lastSP = 0;
+	lastOpcode = 0;
+	lastNext = 0;
+}
+
+void Profiler::instruction(const unsigned char bank, const unsigned char page, const unsigned short PC, const unsigned short SP,
+	const unsigned char opcode, const unsigned char next, const unsigned long long cycles)
+{
+	finish(cycles);
+	follow(PC, SP);
+
+	ProfileCounter*& counter = counters[(bank << 8) | page];
+	if (counter == NULL)
+	{
+		counter = new ProfileCounter[BANK_SIZE]();
+	}
+	last = &counter[PC & (BANK_SIZE - 1)];
+	last->executions++;
+	lastCycles = cycles;
+	lastSP = SP;
+	lastOpcode = opcode;
+	lastNext = next;
+}
+
+// the interrupt is taken after the instruction that ran, before the one at [PC], SP is from before the push
+void Profiler::interrupt(const unsigned short PC, const unsigned short SP, const unsigned short handler, const unsigned long long cycles)
+{
+	finish(cycles);
+	follow(PC, SP);
+	enter(handler);
+
+	// the acknowledge T-states go to the handler, the first instruction there is not a call or a return
+	last = &acknowledges;
+	last->executions++;
+	lastCycles = cycles;
+	lastSP = SP - 2;
+	lastOpcode = 0;
+	lastNext = 0;
+}
+
+// the previous instruction decides whether [PC] starts or ends a routine
+void Profiler::follow(const unsigned short PC, const unsigned short SP)
+{
+	if (isCall(lastOpcode) && SP == (unsigned short)(lastSP - 2))
+	{
+		enter(PC);
+	}
+	else if (isReturn(lastOpcode, lastNext) && SP == (unsigned short)(lastSP + 2))
+	{
+		// a return with nothing on the stack (the program dropped a return address somewhere) stays in the root
+		if (lost > 0)
+		{
+			lost--;
+		}
+		else if (depth > 0)
+		{
+			node = nodes[node].parent;
+			depth--;
+		}
+	}
+}
+
+// a new routine at [address] below the current one
+void Profiler::enter(const unsigned short address)
+{
+	if (depth == PROFILE_MAX_DEPTH)
+	{
+		lost++;
+	}
+	else
+	{
+		const unsigned long long key = ((unsigned long long)node << 16) | address;
+		const std::unordered_map<unsigned long long, unsigned int>::const_iterator found = children.find(key);
+		if (found != children.end())
+		{
+			node = found->second;
+		}
+		else
+		{
+			Node child;
+			child.parent = node;
+			child.address = address;
+			child.cycles = 0;
+			nodes.push_back(child);
+			node = (unsigned int)nodes.size() - 1;
+			children[key] = node;
+		}
+		depth++;
+	}
+}
+
+void Profiler::finish(const unsigned long long cycles)
+{
+	if (last)
+	{
+		last->cycles += cycles - lastCycles;
+		nodes[node].cycles += cycles - lastCycles;
+		last = NULL;
+	}
+}
+
+struct HotSpot
+{
+	unsigned long long cycles;
+	unsigned long long executions;
+	unsigned char page;
+	unsigned short address;
+};
+
+static bool hotter(const HotSpot& a, const HotSpot& b)
+{
+	return a.cycles != b.cycles ? a.cycles > b.cycles : a.executions > b.executions;
+}
+
+bool Profiler::writeReport(const std::string& fileName, const SymbolTable* symbols, const unsigned int count) const
+{
+	std::ofstream file(fileName.c_str());
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::vector<HotSpot> spots;
+	unsigned long long total = 0;
+	for (unsigned int i = 0; i < (NUM_BANKS << 8); i++)
+	{
+		if (counters[i] == NULL)
+		{
+			continue;
+		}
+		for (unsigned int offset = 0; offset < BANK_SIZE; offset++)
+		{
+			const ProfileCounter& counter = counters[i][offset];
+			if (counter.executions != 0)
+			{
+				HotSpot spot;
+				spot.cycles = counter.cycles;
+				spot.executions = counter.executions;
+				spot.page = (unsigned char)i;
+				spot.address = (unsigned short)(((i >> 8) << BANK_SHIFT) | offset);
+				spots.push_back(spot);
+				total += counter.cycles;
+			}
+		}
+	}
+	const size_t shown = std::min(spots.size(), (size_t)count);
+	std::partial_sort(spots.begin(), spots.begin() + shown, spots.end(), hotter);
+
+	file << "cycles\tshare\texecutions\tpage\taddress\tsymbol" << std::endl;
+	for (size_t i = 0; i < shown; i++)
+	{
+		const HotSpot& spot = spots[i];
+		file << std::dec << spot.cycles << "\t" << std::fixed << std::setprecision(2) << (total ? 100.0 * spot.cycles / total : 0.0) << "%\t"
+			<< spot.executions << std::hex << std::uppercase << std::setfill('0') << "\t" << std::setw(2) << (int)spot.page
+			<< "\t" << std::setw(4) << spot.address << std::setfill(' ') << "\t";
+		if (symbols)
+		{
+			symbols->format(file, spot.address);
+		}
+		file << std::endl;
+	}
+	return file.good();
+}
+
+bool Profiler::writeCollapsed(const std::string& fileName, const SymbolTable* symbols) const
+{
+	std::ofstream file(fileName.c_str());
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// a parent always comes before its children, so every frame is named once from the root down
+	std::vector<std::string> stacks(nodes.size());
+	stacks[0] = "root";
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		std::ostringstream frame;
+		if (symbols)
+		{
+			symbols->format(frame, nodes[i].address);
+		}
+		else
+		{
+			frame << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << nodes[i].address;
+		}
+		stacks[i] = stacks[nodes[i].parent] + ";" + frame.str();
+	}
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (nodes[i].cycles != 0)
+		{
+			file << stacks[i] << " " << nodes[i].cycles << "\n";
+		}
+	}
+	return file.good();
+}
@@ -0,0 +1,79 @@
+#ifndef Z80_PROFILER_H
+#define Z80_PROFILER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.h"
+
+class SymbolTable;
+
+#define PROFILE_MAX_DEPTH 256	// calls nested deeper than this are counted in the deepest routine
+
+struct ProfileCounter
+{
+	unsigned long long executions;
+	unsigned long long cycles;	// T-states of those executions
+};
+
+// Execution counts and T-states per PC, kept apart for each page mapped into each bank, and T-states per call stack
+// Calls and returns are told apart from jumps by SP: a call that pushed is an entry, a ret that popped leaves the routine
+// An interrupt enters its handler like a call, the acknowledge T-states count in the handler's stack but at no PC
+// Block instructions count every iteration as an execution, as the profiler runs them one at a time
+class Profiler
+{
+public:
+	Profiler();
+	~Profiler();
+
+	void clear();
+
+	// called by the CPU before each instruction, [next] is the byte after [opcode] and [cycles] are the T-states before it
+	void instruction(const unsigned char bank, const unsigned char page, const unsigned short PC, const unsigned short SP,
+		const unsigned char opcode, const unsigned char next, const unsigned long long cycles);
+	// called by the CPU when it takes an interrupt before the instruction at [PC], [SP] is from before the return address
+	// was pushed and [cycles] are the T-states before the acknowledge
+	void interrupt(const unsigned short PC, const unsigned short SP, const unsigned short handler, const unsigned long long cycles);
+	// the last instruction is over, called by the CPU when a run ends
+	void finish(const unsigned long long cycles);
+
+	// the [count] PCs with the most T-states, most first, one line each: T-states, share, executions, page, address, symbol
+	bool writeReport(const std::string& fileName, const SymbolTable* symbols, const unsigned int count) const;
+	// one line per call stack with the T-states spent in its innermost routine, the collapsed format of flamegraph.pl
+	bool writeCollapsed(const std::string& fileName, const SymbolTable* symbols) const;
+
+private:
+	Profiler(const Profiler&);
+	Profiler& operator=(const Profiler&);
+
+	struct Node
+	{
+		unsigned int parent;
+		unsigned short address;	// where the routine was entered
+		unsigned long long cycles;
+	};
+
+	void follow(const unsigned short PC, const unsigned short SP);
+	void enter(const unsigned short address);
+
+	// BANK_SIZE counters for each bank and page number, allocated when something runs there
+	ProfileCounter* counters[NUM_BANKS << 8];
+	ProfileCounter acknowledges;	// interrupts taken and their acknowledge T-states
+
+	// call tree, node 0 is whatever runs outside of any call
+	std::vector<Node> nodes;
+	std::unordered_map<unsigned long long, unsigned int> children;	// parent << 16 | address to node
+	unsigned int node;
+	unsigned int depth;
+	unsigned int lost;	// calls deeper than PROFILE_MAX_DEPTH that have not returned
+
+	// the instruction that is running
+	ProfileCounter* last;
+	unsigned long long lastCycles;
+	unsigned short lastSP;
+	unsigned char lastOpcode;
+	unsigned char lastNext;
+};
+
+#endif
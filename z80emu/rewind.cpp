@@ -0,0 +1,249 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+Rewind::Rewind(CPU& cpu, size_t budget, unsigned long long interval, unsigned int keyframeInterval)
+	: cpu(cpu)
+{
+	this->budget = budget;
+	this->interval = interval ? interval : 1;
+	this->keyframeInterval = keyframeInterval ? keyframeInterval : 1;
+	instructions = 0;
+	sinceKeyframe = 0;
+	used = 0;
+}
+
+CPU::RunResult Rewind::run(unsigned long long budget, CPU::Dispatch engine)
+{
+	if (frames.empty())
+	{
+		record();
+	}
+
+	CPU::RunResult total;
+	total.reason = CPU::STOP_BUDGET;
+	total.instructions = 0;
+	total.cycles = 0;
+	while (total.instructions < budget)
+	{
+		// the run is cut at every frame so that the frame lands on its instruction
+		const unsigned long long next = frames.back().instructions + interval;
+		const CPU::RunResult result = cpu.run(std::min(budget - total.instructions, next - instructions), engine);
+		instructions += result.instructions;
+		total.instructions += result.instructions;
+		total.cycles += result.cycles;
+		if (instructions == next)
+		{
+			record();
+		}
+		if (result.reason != CPU::STOP_BUDGET)
+		{
+			total.reason = result.reason;
+			break;
+		}
+	}
+	return total;
+}
+
+bool Rewind::stepBack(unsigned long long count)
+{
+	if (count == 0)
+	{
+		return true;
+	}
+	if (frames.empty() || count > instructions - frames.front().instructions)
+	{
+		return false;
+	}
+	const unsigned long long target = instructions - count;
+	size_t frame = frames.size() - 1;
+	while (frames[frame].instructions > target)
+	{
+		frame--;
+	}
+
+	Snapshot state;
+	rebuild(frame, state);
+	if (!cpu.restore(state))
+	{
+		return false;
+	}
+
+	// the frames after it are recorded again when the CPU gets there
+	while (frames.size() > frame + 1)
+	{
+		used -= frames.back().data.size() + sizeof(Frame);
+		frames.pop_back();
+	}
+	sinceKeyframe = 0;
+	for (size_t i = frame; !frames[i].keyframe; i--)
+	{
+		sinceKeyframe++;
+	}
+	last = state;
+	instructions = frames[frame].instructions;
+
+	// same as an emulateCycle per instruction, a halt in the way only ends one run
+	while (instructions < target)
+	{
+		const CPU::RunResult result = cpu.run(target - instructions, CPU::DISPATCH_SWITCH);
+		if (result.instructions == 0)
+		{
+			break;
+		}
+		instructions += result.instructions;
+	}
+	return true;
+}
+
+void Rewind::clear()
+{
+	frames.clear();
+	last = Snapshot();
+	sinceKeyframe = 0;
+	used = 0;
+}
+
+unsigned long long Rewind::getHistory() const
+{
+	return frames.empty() ? 0 : instructions - frames.front().instructions;
+}
+
+// Frame layout: the state, the number of pages that follow, then each page as its index and its bytes
+// a keyframe is encoded against zeros and holds every page
+void Rewind::record()
+{
+	Snapshot next;
+	cpu.snapshot(next);
+
+	frames.push_back(Frame());
+	Frame& frame = frames.back();
+	frame.instructions = instructions;
+	frame.keyframe = frames.size() == 1 || sinceKeyframe + 1 >= keyframeInterval;
+	sinceKeyframe = frame.keyframe ? 0 : sinceKeyframe + 1;
+
+	std::vector<unsigned char>& data = frame.data;
+	encode(data, (const char*)&next.state, frame.keyframe ? NULL : (const char*)&last.state, sizeof(SnapshotState));
+	const size_t countAt = data.size();
+	data.push_back(0);
+	data.push_back(0);
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		// a page that was not written is still the same object as in the frame before
+		if (frame.keyframe || next.pages[i] != last.pages[i])
+		{
+			data.push_back((unsigned char)i);
+			data.push_back((unsigned char)(i >> 8));
+			encode(data, next.pages[i]->bytes, frame.keyframe ? NULL : last.pages[i]->bytes, sizeof(SnapshotPage));
+			count++;
+		}
+	}
+	data[countAt] = (unsigned char)count;
+	data[countAt + 1] = (unsigned char)(count >> 8);
+	used += data.size() + sizeof(Frame);
+	last = next;
+
+	// drops the oldest keyframe and its frames as long as there is a newer keyframe to go back to
+	while (used > budget)
+	{
+		size_t end = 1;
+		while (end < frames.size() && !frames[end].keyframe)
+		{
+			end++;
+		}
+		if (end == frames.size())
+		{
+			break;
+		}
+		for (size_t i = 0; i < end; i++)
+		{
+			used -= frames.front().data.size() + sizeof(Frame);
+			frames.pop_front();
+		}
+	}
+}
+
+// decodes the keyframe before [frame] and applies every frame after it up to [frame]
+void Rewind::rebuild(const size_t frame, Snapshot& out) const
+{
+	size_t first = frame;
+	while (!frames[first].keyframe)
+	{
+		first--;
+	}
+
+	SnapshotState state;
+	memset(&state, 0, sizeof(state));
+	std::vector<char> ram(SNAPSHOT_PAGES * sizeof(SnapshotPage), 0);
+	for (size_t i = first; i <= frame; i++)
+	{
+		const unsigned char* in = &frames[i].data[0];
+		in += decode(in, (char*)&state, sizeof(state));
+		const unsigned int count = in[0] | (in[1] << 8);
+		in += 2;
+		for (unsigned int j = 0; j < count; j++)
+		{
+			const unsigned int page = in[0] | (in[1] << 8);
+			in += 2;
+			in += decode(in, &ram[page * sizeof(SnapshotPage)], sizeof(SnapshotPage));
+		}
+	}
+
+	out.state = state;
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		std::shared_ptr<SnapshotPage> page = std::make_shared<SnapshotPage>();
+		memcpy(page->bytes, &ram[i * sizeof(SnapshotPage)], sizeof(SnapshotPage));
+		out.pages[i] = page;
+	}
+}
+
+// [bytes] XOR [previous] (or just [bytes] without one) as pairs of counts, unchanged bytes to skip and changed bytes that follow
+// counts are one byte, a longer run is split
+void Rewind::encode(std::vector<unsigned char>& out, const char* bytes, const char* previous, const size_t size)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		unsigned int skip = 0;
+		while (i + skip < size && skip < 255 && bytes[i + skip] == (previous ? previous[i + skip] : 0))
+		{
+			skip++;
+		}
+		i += skip;
+		unsigned int changed = 0;
+		while (i + changed < size && changed < 255 && bytes[i + changed] != (previous ? previous[i + changed] : 0))
+		{
+			changed++;
+		}
+		out.push_back((unsigned char)skip);
+		out.push_back((unsigned char)changed);
+		for (unsigned int j = 0; j < changed; j++)
+		{
+			out.push_back((unsigned char)(bytes[i + j] ^ (previous ? previous[i + j] : 0)));
+		}
+		i += changed;
+	}
+}
+
+// applies what encode wrote to [bytes] in place, returns the bytes of [in] it used
+size_t Rewind::decode(const unsigned char* in, char* bytes, const size_t size)
+{
+	const unsigned char* start = in;
+	size_t i = 0;
+	while (i < size)
+	{
+		i += in[0];
+		const unsigned int changed = in[1];
+		in += 2;
+		for (unsigned int j = 0; j < changed; j++)
+		{
+			bytes[i + j] ^= in[j];
+		}
+		in += changed;
+		i += changed;
+	}
+	return in - start;
+}
@@ -0,0 +1,61 @@
+#ifndef Z80_REWIND_H
+#define Z80_REWIND_H
+
+#include <deque>
+#include <vector>
+
+#include "cpu.h"
+#include "snapshot.h"
+
+// Rewind buffer of a CPU: runs it and records a frame every [interval] instructions
+// A keyframe holds the whole state, the frames after it only the bytes that changed since the frame before
+// (XOR with the previous frame, then runs of zeros squeezed out), so a frame costs about what the program wrote
+// Once the frames take more than [budget] bytes the oldest keyframe is dropped together with its frames
+class Rewind
+{
+public:
+	Rewind(CPU& cpu, size_t budget = 32 << 20, unsigned long long interval = 100000, unsigned int keyframeInterval = 64);
+
+	// runs like CPU::run, recording frames on the way
+	CPU::RunResult run(unsigned long long budget, CPU::Dispatch engine = CPU::DISPATCH_THREADED);
+	// Puts the CPU back to where it was [count] instructions ago, false (and nothing changed) if that is before the oldest frame
+	// the closest frame before is rebuilt and the instructions after it are executed again, one emulateCycle each
+	bool stepBack(unsigned long long count);
+	// forgets every frame, the next run starts with a keyframe
+	void clear();
+
+	// instructions run through this buffer, less the ones stepped back
+	unsigned long long getInstructions() const { return instructions; }
+	// the furthest stepBack can go
+	unsigned long long getHistory() const;
+	size_t getMemoryUsed() const { return used; }
+
+private:
+	Rewind(const Rewind&);
+	Rewind& operator=(const Rewind&);
+
+	struct Frame
+	{
+		unsigned long long instructions;	// position of the frame
+		bool keyframe;
+		std::vector<unsigned char> data;	// the state then the changed pages, XOR with the frame before and run length encoded
+	};
+
+	void record();
+	void rebuild(const size_t frame, Snapshot& out) const;
+	static void encode(std::vector<unsigned char>& out, const char* bytes, const char* previous, const size_t size);
+	static size_t decode(const unsigned char* in, char* bytes, const size_t size);
+
+	CPU& cpu;
+	size_t budget;
+	unsigned long long interval;
+	unsigned int keyframeInterval;
+
+	std::deque<Frame> frames;
+	Snapshot last;				// state of the newest frame, its pages tell which ones changed since
+	unsigned long long instructions;
+	unsigned int sinceKeyframe;	// frames recorded after the newest keyframe
+	size_t used;				// bytes of frame data
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() : scheduled(0), fired(0)
+{
+}
+
+Scheduler::EventId Scheduler::add(const Callback& callback)
+{
+	Event event;
+	event.callback = callback;
+	event.when = NO_DEADLINE;
+	event.order = 0;
+	event.position = NOT_SCHEDULED;
+	events.push_back(event);
+	return (EventId)events.size() - 1;
+}
+
+void Scheduler::schedule(const EventId event, const unsigned long long when)
+{
+	Event& entry = events[event];
+	entry.when = when;
+	entry.order = scheduled++;
+	if (entry.position == NOT_SCHEDULED)
+	{
+		heap.push_back(event);
+		entry.position = (unsigned int)heap.size() - 1;
+		siftUp(entry.position);
+	}
+	else
+	{
+		// moved either way
+		siftUp(entry.position);
+		siftDown(entry.position);
+	}
+}
+
+void Scheduler::cancel(const EventId event)
+{
+	if (events[event].position != NOT_SCHEDULED)
+	{
+		removeAt(events[event].position);
+	}
+}
+
+void Scheduler::fire(const unsigned long long now)
+{
+	while (!heap.empty() && events[heap[0]].when <= now)
+	{
+		const EventId event = heap[0];
+		removeAt(0);
+		fired++;
+		events[event].callback(events[event].when);
+	}
+}
+
+bool Scheduler::earlier(const EventId a, const EventId b) const
+{
+	return events[a].when != events[b].when ? events[a].when < events[b].when : events[a].order < events[b].order;
+}
+
+void Scheduler::place(const unsigned int position, const EventId event)
+{
+	heap[position] = event;
+	events[event].position = position;
+}
+
+void Scheduler::siftUp(unsigned int position)
+{
+	const EventId event = heap[position];
+	while (position > 0)
+	{
+		const unsigned int parent = (position - 1) / 2;
+		if (!earlier(event, heap[parent]))
+		{
+			break;
+		}
+		place(position, heap[parent]);
+		position = parent;
+	}
+	place(position, event);
+}
+
+void Scheduler::siftDown(unsigned int position)
+{
+	const EventId event = heap[position];
+	const unsigned int size = (unsigned int)heap.size();
+	for (;;)
+	{
+		unsigned int child = position * 2 + 1;
+		if (child >= size)
+		{
+			break;
+		}
+		if (child + 1 < size && earlier(heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+		if (!earlier(heap[child], event))
+		{
+			break;
+		}
+		place(position, heap[child]);
+		position = child;
+	}
+	place(position, event);
+}
+
+void Scheduler::removeAt(const unsigned int position)
+{
+	events[heap[position]].position = NOT_SCHEDULED;
+	const EventId last = heap.back();
+	heap.pop_back();
+	if (position < heap.size())
+	{
+		place(position, last);
+		siftUp(position);
+		siftDown(events[last].position);
+	}
+}
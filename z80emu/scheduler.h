@@ -0,0 +1,62 @@
+#ifndef Z80_SCHEDULER_H
+#define Z80_SCHEDULER_H
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#define NO_DEADLINE (~0ULL)
+
+// Events of the devices around the CPU, keyed on the T-state counter (CPU::getCycles) and kept in a binary min-heap
+// The CPU runs straight to the earliest deadline and calls fire() there, nothing is checked between instructions
+// An instruction is never split, so an event fires at the first instruction boundary at or after its deadline
+class Scheduler
+{
+public:
+	// called with the deadline the event was scheduled for, which may be a few T-states before the CPU's counter
+	// rescheduling relative to [deadline] instead of the counter keeps periodic events from drifting
+	typedef std::function<void(unsigned long long deadline)> Callback;
+	typedef unsigned int EventId;
+
+	Scheduler();
+
+	// a new event, not scheduled yet, callbacks may add events as well
+	EventId add(const Callback& callback);
+	// (re)schedules [event] at the absolute T-state [when], replacing its previous deadline
+	void schedule(const EventId event, const unsigned long long when);
+	void cancel(const EventId event);
+	bool isScheduled(const EventId event) const { return events[event].position != NOT_SCHEDULED; }
+	unsigned long long deadlineOf(const EventId event) const { return events[event].when; }
+
+	// the earliest deadline, NO_DEADLINE when nothing is scheduled
+	unsigned long long next() const { return heap.empty() ? NO_DEADLINE : events[heap[0]].when; }
+	// runs and unschedules every event due at [now] or earlier, earliest first and in the order they were scheduled on a tie
+	// callbacks may add, schedule and cancel events, a deadline that is still not after [now] fires in the same call
+	void fire(const unsigned long long now);
+	// callbacks run so far
+	unsigned long long getFired() const { return fired; }
+
+private:
+	static const unsigned int NOT_SCHEDULED = ~0U;
+
+	struct Event
+	{
+		Callback callback;
+		unsigned long long when;
+		unsigned long long order;	// when it was scheduled, breaks ties between equal deadlines
+		unsigned int position;		// in heap, NOT_SCHEDULED when it is not there
+	};
+
+	bool earlier(const EventId a, const EventId b) const;
+	void place(const unsigned int position, const EventId event);
+	void siftUp(unsigned int position);
+	void siftDown(unsigned int position);
+	void removeAt(const unsigned int position);
+
+	std::deque<Event> events;	// a deque keeps an event in place while a callback adds more
+	std::vector<EventId> heap;
+	unsigned long long scheduled;	// next Event::order
+	unsigned long long fired;
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+
+#define SNAPSHOT_MAGIC 0x5353385A // "Z8SS"
+#define SNAPSHOT_VERSION 2
+
+// Copy on write RAM
+// A snapshot holds the pages of the last one plus copies of the pages written since, so taking one costs O(dirty pages)
+// After a snapshot every RAM page is marked in codePages like a page holding code, the first store to it goes
+// through invalidateCode which forgets the saved copy, from then on stores to that page are not checked
+
+Snapshot::Snapshot()
+{
+	memset(&state, 0, sizeof(state));
+}
+
+void CPU::snapshot(Snapshot& out)
+{
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		if (!savedPages[i])
+		{
+			std::shared_ptr<SnapshotPage> page = std::make_shared<SnapshotPage>();
+			memcpy(page->bytes, ram + (i << CODE_PAGE_SHIFT), sizeof(page->bytes));
+			savedPages[i] = page;
+		}
+		out.pages[i] = savedPages[i];
+	}
+
+	SnapshotState& state = out.state;
+	state.cycles = cycles;
+	state.PC = PC;
+	state.SP = SP;
+	state.IX = IX();
+	state.IY = IY();
+	state.A = A;
+	state.F = computeFlags();
+	state.B = B;
+	state.C = C;
+	state.D = D;
+	state.E = E;
+	state.H = H;
+	state.L = L;
+	state.I = I;
+	state.R = refresh();
+	state.IFF1 = IFF1;
+	state.IFF2 = IFF2;
+	state.interruptMode = interruptMode;
+	state.halted = halted;
+	state.interruptPending = interruptPending;
+	state.nmiPending = nmiPending;
+	state.interruptBus = interruptBus;
+	state.eiCycles = eiCycles;
+	memcpy(state.bankPages, bankPages, NUM_BANKS);
+	state.ramPages = (unsigned char)ramPages;
+	state.flashPages = (unsigned char)flashPages;
+	memcpy(state.ports, ports, NUM_PORTS);
+
+	// every page is shared now
+	updateCodePages();
+}
+
+bool CPU::restore(const Snapshot& in)
+{
+	const SnapshotState& state = in.state;
+	if (in.isEmpty() || state.flashPages != flashPages)
+	{
+		return false;
+	}
+
+	// the blocks on a page that changes are dropped while the mapping they were decoded under is still in place
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		if (savedPages[i] != in.pages[i])
+		{
+			memcpy(ram + (i << CODE_PAGE_SHIFT), in.pages[i]->bytes, sizeof(in.pages[i]->bytes));
+			savedPages[i] = in.pages[i];
+			dropRAMBlocks(i);
+		}
+	}
+
+	// mapBank drops the blocks of the bank, so only the banks that change are mapped again
+	const bool remap = ramPages != state.ramPages;
+	ramPages = state.ramPages;
+	for (unsigned char bank = 0; bank < NUM_BANKS; bank++)
+	{
+		if (remap || bankPages[bank] != state.bankPages[bank])
+		{
+			mapBank(bank, state.bankPages[bank]);
+		}
+	}
+	memcpy(ports, state.ports, NUM_PORTS);
+
+	cycles = state.cycles;
+	PC = state.PC;
+	SP = state.SP;
+	IX(state.IX);
+	IY(state.IY);
+	A = state.A;
+	setF(state.F);
+	B = state.B;
+	C = state.C;
+	D = state.D;
+	E = state.E;
+	H = state.H;
+	L = state.L;
+	I = state.I;
+	R = state.R;
+	R7 = state.R & 0x80;
+	IFF1 = state.IFF1 != 0;
+	IFF2 = state.IFF2 != 0;
+	interruptMode = state.interruptMode;
+	halted = state.halted != 0;
+	interruptPending = state.interruptPending != 0;
+	nmiPending = state.nmiPending != 0;
+	interruptBus = state.interruptBus;
+	eiCycles = state.eiCycles;
+	// the B_CALL that was being checked is not running any more
+	dropBCallCheck();
+
+	updateCodePages();
+	return true;
+}
+
+// RAM page mapped at [page] of the address space, SNAPSHOT_PAGES when it maps flash
+unsigned int CPU::ramPageAt(const unsigned int page) const
+{
+	const unsigned int pagesPerBank = BANK_SIZE >> CODE_PAGE_SHIFT;
+	const unsigned int bank = page / pagesPerBank;
+	if (bankReadOnly[bank])
+	{
+		return SNAPSHOT_PAGES;
+	}
+	return (unsigned int)((readBanks[bank] - ram) >> CODE_PAGE_SHIFT) + page % pagesPerBank;
+}
+
+// [page] of the address space maps RAM whose saved copy is still the same as the RAM
+bool CPU::isSharedPage(const unsigned int page) const
+{
+	const unsigned int index = ramPageAt(page);
+	return index < SNAPSHOT_PAGES && savedPages[index];
+}
+
+// Called by invalidateCode for [size] bytes written from [address], wrapping at the end of memory
+// a page that has no blocks stops being marked, with aliased banks updateCodePages clears the mirrors later
+void CPU::unsharePages(const unsigned short address, const unsigned int size)
+{
+	const unsigned int last = address + size - 1;
+	for (unsigned int wrapped = address >> CODE_PAGE_SHIFT; wrapped <= last >> CODE_PAGE_SHIFT; wrapped++)
+	{
+		const unsigned int page = wrapped & ((0x10000 >> CODE_PAGE_SHIFT) - 1);
+		if (!isSharedPage(page))
+		{
+			continue;
+		}
+		savedPages[ramPageAt(page)].reset();
+		unsharedPages++;
+		if (pageBlocks[page].empty() && !banksAliased)
+		{
+			codePages[page >> 3] &= ~(1 << (page & 7));
+		}
+	}
+}
+
+// for the loaders, which write RAM behind the back of the store paths
+void CPU::dropSharedPages()
+{
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		savedPages[i].reset();
+	}
+	updateCodePages();
+}
+
+// drops the blocks on RAM page [index] at every address it is mapped at
+void CPU::dropRAMBlocks(const unsigned int index)
+{
+	const char* const memory = ram + (index << CODE_PAGE_SHIFT);
+	for (unsigned int bank = 0; bank < NUM_BANKS; bank++)
+	{
+		if (!bankReadOnly[bank] && memory >= readBanks[bank] && memory < readBanks[bank] + BANK_SIZE)
+		{
+			dropBlocks((unsigned short)((bank << BANK_SHIFT) + (memory - readBanks[bank])), 1 << CODE_PAGE_SHIFT);
+		}
+	}
+}
+
+// File layout: magic, version, state size, the state, then every RAM page in order
+bool Snapshot::save(const std::string& fileName) const
+{
+	if (isEmpty())
+	{
+		return false;
+	}
+	std::ofstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	const unsigned int header[] = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(SnapshotState) };
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&state, sizeof(state));
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		file.write(pages[i]->bytes, sizeof(pages[i]->bytes));
+	}
+	return file.good();
+}
+
+// a state CPU::snapshot could have written, anything else would map the banks outside of memory
+static bool isValidState(const SnapshotState& state)
+{
+	if (state.ramPages < 1 || state.ramPages > RAM_PAGES || state.flashPages > FLASH_PAGES || state.interruptMode > 2)
+	{
+		return false;
+	}
+	// without flash the ports do not page, every bank keeps its own RAM page
+	for (unsigned char bank = 0; bank < NUM_BANKS; bank++)
+	{
+		if (state.flashPages == 0 && state.bankPages[bank] != (PAGE_RAM | bank))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Snapshot::load(const std::string& fileName)
+{
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	unsigned int header[3];
+	SnapshotState loaded;
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&loaded, sizeof(loaded));
+	if (!file.good() || header[0] != SNAPSHOT_MAGIC || header[1] != SNAPSHOT_VERSION || header[2] != sizeof(SnapshotState) || !isValidState(loaded))
+	{
+		return false;
+	}
+
+	std::shared_ptr<const SnapshotPage> read[SNAPSHOT_PAGES];
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		std::shared_ptr<SnapshotPage> page = std::make_shared<SnapshotPage>();
+		file.read(page->bytes, sizeof(page->bytes));
+		read[i] = page;
+	}
+	if (!file.good())
+	{
+		return false;
+	}
+
+	state = loaded;
+	for (unsigned int i = 0; i < SNAPSHOT_PAGES; i++)
+	{
+		pages[i] = read[i];
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef Z80_SNAPSHOT_H
+#define Z80_SNAPSHOT_H
+
+#include <memory>
+#include <string>
+
+#include "cpu.h"
+
+// one page of RAM as it was when a snapshot was taken, never changed once it is shared
+struct SnapshotPage
+{
+	char bytes[1 << CODE_PAGE_SHIFT];
+};
+
+// Everything but RAM, written to the file as is
+struct SnapshotState
+{
+	unsigned long long cycles;
+	unsigned short PC;
+	unsigned short SP;
+	unsigned short IX;
+	unsigned short IY;
+	unsigned char A, F, B, C, D, E, H, L;
+	unsigned char I;
+	unsigned char R;
+	unsigned char IFF1, IFF2;
+	unsigned char interruptMode;
+	unsigned char halted;
+	unsigned char interruptPending, nmiPending;
+	unsigned char interruptBus;
+	unsigned long long eiCycles;
+	unsigned char bankPages[NUM_BANKS];
+	unsigned char ramPages;
+	unsigned char flashPages;	// the flash itself is read-only and not saved, a snapshot only restores into a CPU with the same flash
+	char ports[NUM_PORTS];
+};
+
+// Saved state of a CPU (see CPU::snapshot)
+// RAM is held per page, a page that did not change is shared with the CPU and every other snapshot that has it
+// Copying a snapshot only copies the page pointers
+class Snapshot
+{
+public:
+	Snapshot();
+
+	bool isEmpty() const { return !pages[0]; }
+	unsigned long long getCycles() const { return state.cycles; }
+
+	// a loaded snapshot shares no pages with anything until it is restored
+	bool save(const std::string& fileName) const;
+	// false for a file of another version or with a state no CPU could be in, such as more RAM pages than there are
+	bool load(const std::string& fileName);
+
+private:
+	friend class CPU;
+	friend class Rewind;
+
+	SnapshotState state;
+	std::shared_ptr<const SnapshotPage> pages[SNAPSHOT_PAGES];
+};
+
+#endif
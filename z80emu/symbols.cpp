@@ -0,0 +1,509 @@
+#include "symbols.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+static bool isNameChar(const char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+static void skipSpaces(const char*& at)
+{
+	while (*at == ' ' || *at == '\t')
+	{
+		at++;
+	}
+}
+
+// TASM notation: $hex, 0xhex, hexh, %binary, binaryb, decimal
+static bool parseNumber(std::string text, long& value)
+{
+	int base = 10;
+	if (text.size() > 1 && (text[0] == '$' || text[0] == '%'))
+	{
+		base = (text[0] == '$') ? 16 : 2;
+		text = text.substr(1);
+	}
+	else if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+	{
+		base = 16;
+		text = text.substr(2);
+	}
+	else if (text.size() > 1 && (text[text.size() - 1] == 'h' || text[text.size() - 1] == 'H'))
+	{
+		base = 16;
+		text.erase(text.size() - 1);
+	}
+	else if (text.size() > 1 && (text[text.size() - 1] == 'b' || text[text.size() - 1] == 'B') && text.find_first_not_of("01") == text.size() - 1)
+	{
+		base = 2;
+		text.erase(text.size() - 1);
+	}
+
+	char* end;
+	value = strtol(text.c_str(), &end, base);
+	return !text.empty() && *end == '\0';
+}
+
+static bool evaluate(const char*& at, const std::map<std::string, long>& known, long& value);
+
+static bool evaluateTerm(const char*& at, const std::map<std::string, long>& known, long& value)
+{
+	skipSpaces(at);
+	if (*at == '(')
+	{
+		at++;
+		if (!evaluate(at, known, value))
+		{
+			return false;
+		}
+		skipSpaces(at);
+		return *at++ == ')';
+	}
+	if (*at == '-')
+	{
+		at++;
+		if (!evaluateTerm(at, known, value))
+		{
+			return false;
+		}
+		value = -value;
+		return true;
+	}
+
+	const char* const start = at;
+	if (*at == '$' || *at == '%')
+	{
+		at++;
+	}
+	while (isNameChar(*at))
+	{
+		at++;
+	}
+	const std::string word(start, at);
+	if (word.empty())
+	{
+		return false;
+	}
+	if (!isalpha((unsigned char)word[0]) && word[0] != '_')
+	{
+		return parseNumber(word, value);
+	}
+	const std::map<std::string, long>::const_iterator found = known.find(word);
+	if (found == known.end())
+	{
+		return false;
+	}
+	value = found->second;
+	return true;
+}
+
+// TASM has no operator precedence, expressions are evaluated left to right
+// false when the expression is malformed or uses a symbol that is not known yet
+static bool evaluate(const char*& at, const std::map<std::string, long>& known, long& value)
+{
+	if (!evaluateTerm(at, known, value))
+	{
+		return false;
+	}
+	for (;;)
+	{
+		skipSpaces(at);
+		const char op = *at;
+		if (op == '<' || op == '>')
+		{
+			if (at[1] != op)
+			{
+				return false;
+			}
+			at++;
+		}
+		else if (op != '+' && op != '-' && op != '*' && op != '/' && op != '&' && op != '|')
+		{
+			return true;
+		}
+		at++;
+
+		long operand;
+		if (!evaluateTerm(at, known, operand))
+		{
+			return false;
+		}
+		switch (op)
+		{
+			case '+': value += operand; break;
+			case '-': value -= operand; break;
+			case '*': value *= operand; break;
+			case '/': value = operand ? value / operand : 0; break;
+			case '&': value &= operand; break;
+			case '|': value |= operand; break;
+			case '<': value <<= operand; break;
+			default: value >>= operand; break;
+		}
+	}
+}
+
+#define SYMBOL_CACHE_MAGIC 0x5953385A // "Z8SY"
+#define SYMBOL_CACHE_VERSION 1
+
+struct Equate
+{
+	std::string name;
+	std::string expression;
+};
+
+struct Resolved
+{
+	unsigned short value;
+	size_t equate;	// index in the file order
+};
+
+static const char* readName(const char* at, std::string& name)
+{
+	if (!isalpha((unsigned char)*at) && *at != '_')
+	{
+		return NULL;
+	}
+	const char* const start = at;
+	while (isNameChar(*at))
+	{
+		at++;
+	}
+	name.assign(start, at);
+	return at;
+}
+
+// NAME EQU expression, NAME .EQU expression or NAME = expression, comments already stripped
+static bool parseEquate(const std::string& line, Equate& equate)
+{
+	const char* at = readName(line.c_str(), equate.name);
+	if (at == NULL)
+	{
+		return false;
+	}
+
+	skipSpaces(at);
+	if (*at == '=')
+	{
+		at++;
+	}
+	else
+	{
+		if (*at == '.')
+		{
+			at++;
+		}
+		if (strncmp(at, "EQU", 3) != 0 && strncmp(at, "equ", 3) != 0)
+		{
+			return false;
+		}
+		at += 3;
+		if (*at != ' ' && *at != '\t')
+		{
+			return false;
+		}
+	}
+	skipSpaces(at);
+	equate.expression = at;
+	return !equate.expression.empty();
+}
+
+// NAME value as TASM writes label files, the value is hex unless it says otherwise, optionally NAME = value
+static bool parseLabel(const std::string& line, Equate& equate)
+{
+	const char* at = readName(line.c_str(), equate.name);
+	if (at == NULL)
+	{
+		return false;
+	}
+	skipSpaces(at);
+	if (*at == '=' || *at == ':')
+	{
+		at++;
+		skipSpaces(at);
+	}
+	const char* const start = at;
+	while (*at != '\0' && *at != ' ' && *at != '\t' && *at != '\r')
+	{
+		at++;
+	}
+	equate.expression.assign(start, at);
+	if (equate.expression.empty())
+	{
+		return false;
+	}
+	const char first = equate.expression[0];
+	const char last = equate.expression[equate.expression.size() - 1];
+	if (first != '$' && first != '%' && last != 'h' && last != 'H' && equate.expression.find_first_of("xX") == std::string::npos)
+	{
+		equate.expression = "$" + equate.expression;
+	}
+	return true;
+}
+
+static bool hasExtension(const std::string& fileName, const char* extension)
+{
+	const size_t length = strlen(extension);
+	if (fileName.size() < length)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		if (tolower((unsigned char)fileName[fileName.size() - length + i]) != extension[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// by value, then by where they were defined
+static bool resolvedBefore(const Resolved& a, const Resolved& b)
+{
+	return a.value != b.value ? a.value < b.value : a.equate < b.equate;
+}
+
+bool SymbolTable::load(const std::string& fileName)
+{
+	MappedFile file;
+	if (!file.open(fileName))
+	{
+		return false;
+	}
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < file.size(); i++)
+	{
+		hash = (hash ^ (unsigned char)file.data()[i]) * 1099511628211ULL;
+	}
+	if (loadCache(fileName + SYMBOL_CACHE_EXTENSION, hash))
+	{
+		return true;
+	}
+
+	const bool labels = hasExtension(fileName, ".lab");
+	std::vector<Equate> equates;
+	std::istringstream lines(std::string(file.data(), file.size()));
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		line = line.substr(0, line.find(';'));
+		Equate equate;
+		if (labels ? parseLabel(line, equate) : parseEquate(line, equate))
+		{
+			equates.push_back(equate);
+		}
+	}
+
+	// equates may use names defined further down, keep going over the rest while that resolves more of them
+	std::map<std::string, long> known;
+	std::vector<Resolved> resolved;
+	std::vector<size_t> pending;
+	for (size_t i = 0; i < equates.size(); i++)
+	{
+		pending.push_back(i);
+	}
+	for (bool progress = true; progress && !pending.empty(); )
+	{
+		progress = false;
+		std::vector<size_t> left;
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			const Equate& equate = equates[pending[i]];
+			const char* at = equate.expression.c_str();
+			long value;
+			if (evaluate(at, known, value))
+			{
+				skipSpaces(at);
+				if (*at == '\0' || *at == '\r')
+				{
+					known[equate.name] = value;
+					Resolved symbol;
+					symbol.value = (unsigned short)value;
+					symbol.equate = pending[i];
+					resolved.push_back(symbol);
+					progress = true;
+				}
+				continue;
+			}
+			left.push_back(pending[i]);
+		}
+		pending.swap(left);
+	}
+	std::sort(resolved.begin(), resolved.end(), resolvedBefore);
+
+	names.clear();
+	symbols.resize(resolved.size());
+	byName.resize(resolved.size());
+	for (size_t i = 0; i < resolved.size(); i++)
+	{
+		const std::string& name = equates[resolved[i].equate].name;
+		symbols[i].value = resolved[i].value;
+		symbols[i].name = (unsigned int)names.size();
+		names.insert(names.end(), name.c_str(), name.c_str() + name.size() + 1);
+		byName[i] = (unsigned int)i;
+	}
+	std::stable_sort(byName.begin(), byName.end(), [this](const unsigned int a, const unsigned int b) { return strcmp(nameOf(symbols[a]), nameOf(symbols[b])) < 0; });
+
+	saveCache(fileName + SYMBOL_CACHE_EXTENSION, hash);
+	return true;
+}
+
+// File layout: magic, version, entry size, hash of the source, symbol count, name bytes, then the three arrays
+bool SymbolTable::loadCache(const std::string& fileName, const unsigned long long hash)
+{
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	unsigned int header[3];
+	unsigned long long source;
+	unsigned int counts[2];
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&source, sizeof(source));
+	file.read((char*)counts, sizeof(counts));
+	if (!file.good() || header[0] != SYMBOL_CACHE_MAGIC || header[1] != SYMBOL_CACHE_VERSION || header[2] != sizeof(Entry) || source != hash)
+	{
+		return false;
+	}
+
+	std::vector<Entry> readSymbols(counts[0]);
+	std::vector<unsigned int> readByName(counts[0]);
+	std::vector<char> readNames(counts[1]);
+	if (counts[0] > 0)
+	{
+		file.read((char*)&readSymbols[0], counts[0] * sizeof(Entry));
+		file.read((char*)&readByName[0], counts[0] * sizeof(unsigned int));
+	}
+	if (counts[1] > 0)
+	{
+		file.read(&readNames[0], counts[1]);
+	}
+	if (!file.good())
+	{
+		return false;
+	}
+	// a cache that was cut short or overwritten must not send the lookups outside of the arrays
+	for (unsigned int i = 0; i < counts[0]; i++)
+	{
+		if (readSymbols[i].name >= counts[1] || readByName[i] >= counts[0])
+		{
+			return false;
+		}
+	}
+	if (counts[1] > 0 && readNames[counts[1] - 1] != '\0')
+	{
+		return false;
+	}
+
+	symbols.swap(readSymbols);
+	byName.swap(readByName);
+	names.swap(readNames);
+	return true;
+}
+
+// a cache that cannot be written only means the next load parses the source again
+void SymbolTable::saveCache(const std::string& fileName, const unsigned long long hash) const
+{
+	std::ofstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open())
+	{
+		return;
+	}
+	const unsigned int header[] = { SYMBOL_CACHE_MAGIC, SYMBOL_CACHE_VERSION, sizeof(Entry) };
+	const unsigned int counts[] = { (unsigned int)symbols.size(), (unsigned int)names.size() };
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&hash, sizeof(hash));
+	file.write((const char*)counts, sizeof(counts));
+	if (!symbols.empty())
+	{
+		file.write((const char*)&symbols[0], symbols.size() * sizeof(Entry));
+		file.write((const char*)&byName[0], byName.size() * sizeof(unsigned int));
+	}
+	if (!names.empty())
+	{
+		file.write(&names[0], names.size());
+	}
+}
+
+bool SymbolTable::nearest(const unsigned short address, Symbol& symbol) const
+{
+	// the first symbol above the address, the one before it is the highest at or below it
+	size_t low = 0;
+	size_t high = symbols.size();
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		if (symbols[middle].value <= address)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low == 0)
+	{
+		return false;
+	}
+	// back to the first of the symbols that share the value
+	size_t found = low - 1;
+	while (found > 0 && symbols[found - 1].value == symbols[found].value)
+	{
+		found--;
+	}
+	symbol.value = symbols[found].value;
+	symbol.name = nameOf(symbols[found]);
+	return true;
+}
+
+bool SymbolTable::find(const char* name, unsigned short& value) const
+{
+	size_t low = 0;
+	size_t high = byName.size();
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		const int order = strcmp(nameOf(symbols[byName[middle]]), name);
+		if (order == 0)
+		{
+			value = symbols[byName[middle]].value;
+			return true;
+		}
+		if (order < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return false;
+}
+
+void SymbolTable::format(std::ostream& out, const unsigned short address) const
+{
+	const std::ios::fmtflags flags = out.flags();
+	out << std::hex << std::uppercase;
+	Symbol symbol;
+	if (!nearest(address, symbol))
+	{
+		out << address;
+	}
+	else if (symbol.value == address)
+	{
+		out << symbol.name;
+	}
+	else
+	{
+		out << symbol.name << "+" << (address - symbol.value);
+	}
+	out.flags(flags);
+}
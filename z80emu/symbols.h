@@ -0,0 +1,53 @@
+#ifndef Z80_SYMBOLS_H
+#define Z80_SYMBOLS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define SYMBOL_CACHE_EXTENSION ".symcache"	// appended to the name of the file the cache was built from
+
+struct Symbol
+{
+	unsigned short value;
+	const char* name;	// owned by the table, valid until it is loaded again
+};
+
+// Names for addresses, read from the equates of a TASM include such as ti83plus.inc or the labels of a .lab file
+// All symbols live in three contiguous arrays: the names one after the other, the symbols sorted by value and an index
+// of them sorted by name, so lookups either way are a binary search that never allocates
+// The arrays are saved beside the source file and read back as they are while the source stays the same
+class SymbolTable
+{
+public:
+	// reads every NAME EQU expression / NAME = expression line of [fileName], or every NAME value line of a .lab file,
+	// from its cache when there is an up to date one, and writes the cache otherwise
+	// returns false if the file could not be read, equates that never resolve are left out
+	bool load(const std::string& fileName);
+
+	size_t size() const { return symbols.size(); }
+	// the symbol with the highest value at or below [address], the first one defined when several share it
+	// false when there is none
+	bool nearest(const unsigned short address, Symbol& symbol) const;
+	// the value of [name], false if there is no such symbol
+	bool find(const char* name, unsigned short& value) const;
+	// writes the name or name+offset (hex) of [address], the address in hex when no symbol is at or below it
+	void format(std::ostream& out, const unsigned short address) const;
+
+private:
+	struct Entry
+	{
+		unsigned short value;
+		unsigned int name;	// offset in names
+	};
+
+	bool loadCache(const std::string& fileName, const unsigned long long hash);
+	void saveCache(const std::string& fileName, const unsigned long long hash) const;
+	const char* nameOf(const Entry& entry) const { return &names[entry.name]; }
+
+	std::vector<char> names;		// every name with its terminating NUL
+	std::vector<Entry> symbols;		// by value, then by where they were defined
+	std::vector<unsigned int> byName;	// indices in symbols sorted by name
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "trace.h"
+#include "symbols.h"
+
+#include <fstream>
+#include <iomanip>
+
+#define TRACE_MAGIC 0x5452385A // "Z8RT"
+#define TRACE_VERSION 2
+
+TraceBuffer::TraceBuffer(unsigned int capacity)
+{
+	unsigned int size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+	records.resize(size);
+	mask = size - 1;
+	total = 0;
+}
+
+void TraceBuffer::clear()
+{
+	total = 0;
+}
+
+unsigned int TraceBuffer::size() const
+{
+	return (total < records.size()) ? (unsigned int)total : (unsigned int)records.size();
+}
+
+const TraceRecord& TraceBuffer::at(unsigned int i) const
+{
+	return records[(unsigned int)(total - size() + i) & mask];
+}
+
+// File layout: magic, version, record size, total, size, then [size] records oldest first
+bool TraceBuffer::save(const std::string& fileName) const
+{
+	std::ofstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	const unsigned int header[] = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord) };
+	const unsigned int count = size();
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&total, sizeof(total));
+	file.write((const char*)&count, sizeof(count));
+	for (unsigned int i = 0; i < count; i++)
+	{
+		file.write((const char*)&at(i), sizeof(TraceRecord));
+	}
+	return file.good();
+}
+
+bool TraceBuffer::load(const std::string& fileName)
+{
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	unsigned int header[3];
+	unsigned long long written;
+	unsigned int count;
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&written, sizeof(written));
+	file.read((char*)&count, sizeof(count));
+	if (!file.good() || header[0] != TRACE_MAGIC || header[1] != TRACE_VERSION || header[2] != sizeof(TraceRecord))
+	{
+		return false;
+	}
+
+	std::vector<TraceRecord> saved(count);
+	if (count > 0)
+	{
+		file.read((char*)&saved[0], count * sizeof(TraceRecord));
+	}
+	if (!file.good())
+	{
+		return false;
+	}
+
+	// keep the original numbering so records line up with the run that produced them
+	*this = TraceBuffer(count);
+	total = written;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		records[(unsigned int)(written - count + i) & mask] = saved[i];
+	}
+	return true;
+}
+
+void formatTrace(const TraceBuffer& trace, std::ostream& out, const SymbolTable* symbols)
+{
+	const unsigned int count = trace.size();
+	const unsigned long long first = trace.recorded() - count;
+	const std::ios::fmtflags flags = out.flags();
+	const char fill = out.fill('0');
+
+	out << std::hex << std::uppercase;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const TraceRecord& r = trace.at(i);
+		out << std::dec << std::setw(0) << (first + i) << "\t" << r.cycles << std::hex << "\t"
+			<< std::setw(4) << r.PC;
+		if (symbols)
+		{
+			out << " ";
+			symbols->format(out, r.PC);
+		}
+		out << ": " << std::setw(2) << (int)r.opcode
+			<< "\tAF=" << std::setw(4) << r.AF
+			<< " BC=" << std::setw(4) << r.BC
+			<< " DE=" << std::setw(4) << r.DE
+			<< " HL=" << std::setw(4) << r.HL
+			<< " IX=" << std::setw(4) << r.IX
+			<< " IY=" << std::setw(4) << r.IY
+			<< " SP=" << std::setw(4) << r.SP
+			<< " R=" << std::setw(2) << (int)r.R << "\n";
+	}
+
+	out.flags(flags);
+	out.fill(fill);
+}
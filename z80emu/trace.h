@@ -0,0 +1,57 @@
+#ifndef Z80_TRACE_H
+#define Z80_TRACE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class SymbolTable;
+
+// One executed instruction, captured before it runs
+struct TraceRecord
+{
+	unsigned long long cycles; // T-states executed before this instruction
+	unsigned short PC;
+	unsigned short SP;
+	unsigned short AF;
+	unsigned short BC;
+	unsigned short DE;
+	unsigned short HL;
+	unsigned short IX;
+	unsigned short IY;
+	unsigned char opcode;
+	unsigned char R;
+};
+
+// Fixed size ring buffer of binary trace records
+// Recording never allocates or formats anything, once the buffer is full the oldest records are overwritten
+class TraceBuffer
+{
+public:
+	TraceBuffer(unsigned int capacity); // rounded up to a power of two
+
+	inline TraceRecord& next()
+	{
+		return records[(unsigned int)(total++) & mask];
+	}
+
+	void clear();
+	unsigned int size() const;
+	unsigned long long recorded() const { return total; }
+	// [i] = 0 is the oldest record still in the buffer
+	const TraceRecord& at(unsigned int i) const;
+
+	bool save(const std::string& fileName) const;
+	bool load(const std::string& fileName);
+
+private:
+	std::vector<TraceRecord> records;
+	unsigned int mask;
+	unsigned long long total; // records ever written, including overwritten ones
+};
+
+// Decodes [trace] into one human readable line per instruction, oldest first
+// with [symbols] every PC is followed by the symbol it is in
+void formatTrace(const TraceBuffer& trace, std::ostream& out, const SymbolTable* symbols = NULL);
+
+#endif
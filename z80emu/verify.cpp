@@ -0,0 +1,451 @@
+#include "verify.h"
+#include "cpu.h"
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+// Programs are written to VERIFY_ORIGIN, every rst vector jumps there
+#define VERIFY_ORIGIN 0x100
+// (hl), (de), (ix + d) and (iy + d) point into the random bytes from VERIFY_DATA, the pointer registers are seeded
+// with 0x8000 - 0x83FF so that the stores stay out of the code
+#define VERIFY_DATA 0x7F00
+#define VERIFY_DATA_SIZE 0x600
+// filled with the address that follows the instruction under test, so that returns and pops come back to it
+#define VERIFY_STACK 0xF000
+#define VERIFY_STACK_SIZE 0x40
+#define VERIFY_RUNS (JIT_THRESHOLD * 3)	// of each opcode loop, compiled from JIT_THRESHOLD on
+#define VERIFY_SEED_INSTRUCTIONS 16		// in what putSeed writes
+#define VERIFY_STORE_INSTRUCTIONS 200000	// of the programs that store into code or share a cache slot
+// the programs that store into code count their rounds at VERIFY_ROUND, they store through the pointer of the round
+// at VERIFY_POINTERS: into code once every VERIFY_STORE_PERIOD rounds, which leaves them time to be compiled again
+#define VERIFY_ROUND 0x8000
+#define VERIFY_POINTERS 0x8100
+#define VERIFY_STORE_PERIOD 32
+#define VERIFY_SCRATCH 0x8200	// where they store the other rounds
+#define VERIFY_SOURCE 0x8020	// of the ldir
+#define VERIFY_REPORTED 20		// mismatches printed, the rest are only counted
+
+struct VerifyProgram
+{
+	std::string name;
+	std::string code;			// at VERIFY_ORIGIN
+	std::string data;			// at VERIFY_DATA
+	unsigned short next;		// what the stack is filled with
+	unsigned long long instructions;
+};
+
+static void put(std::string& code, const int b0, const int b1 = -1, const int b2 = -1, const int b3 = -1)
+{
+	const int bytes[] = { b0, b1, b2, b3 };
+	for (unsigned int i = 0; i < 4 && bytes[i] >= 0; i++)
+	{
+		code += (char)bytes[i];
+	}
+}
+
+static void putWord(std::string& code, const unsigned short val)
+{
+	put(code, val & 0xFF, val >> 8);
+}
+
+static void put16(std::string& code, const int opcode, const unsigned short val)
+{
+	put(code, opcode);
+	putWord(code, val);
+}
+
+static unsigned short here(const std::string& code)
+{
+	return (unsigned short)(VERIFY_ORIGIN + code.size());
+}
+
+// bytes of an unprefixed instruction, not for 0xCB
+static unsigned int mainLength(const unsigned char opcode)
+{
+	const unsigned int x = opcode >> 6;
+	const unsigned int y = (opcode >> 3) & 7;
+	const unsigned int z = opcode & 7;
+	if (x == 0)
+	{
+		if (z == 0)
+		{
+			return (y >= 2) ? 2 : 1; // djnz, jr, jr cc
+		}
+		if (z == 1)
+		{
+			return (y & 1) ? 1 : 3; // ld rr, nn
+		}
+		if (z == 2)
+		{
+			return (y >= 4) ? 3 : 1; // ld (nn), hl / a and back
+		}
+		return (z == 6) ? 2 : 1; // ld r, n
+	}
+	if (x == 3)
+	{
+		if (z == 2 || z == 4 || opcode == 0xC3 || opcode == 0xCD)
+		{
+			return 3; // jp, call
+		}
+		if (z == 6 || opcode == 0xD3 || opcode == 0xDB)
+		{
+			return 2; // alu n, out (n), a, in a, (n)
+		}
+	}
+	return 1;
+}
+
+// the opcodes that read or write (hl), (ix + d) behind a DD / FD prefix
+static bool usesHL(const unsigned char opcode)
+{
+	const unsigned int y = (opcode >> 3) & 7;
+	const unsigned int z = opcode & 7;
+	if (opcode == 0x34 || opcode == 0x35 || opcode == 0x36)
+	{
+		return true;
+	}
+	if (opcode >= 0x40 && opcode < 0x80)
+	{
+		return (z == 6 || y == 6) && opcode != 0x76;
+	}
+	return opcode >= 0x80 && opcode < 0xC0 && z == 6;
+}
+
+// jp, jp cc, call, call cc: their operand is where they go
+static bool isAbsoluteJump(const unsigned char opcode)
+{
+	return opcode == 0xC3 || opcode == 0xCD || (opcode >= 0xC0 && ((opcode & 7) == 2 || (opcode & 7) == 4));
+}
+
+// Loads the registers and F from [random], [jumpRegister] (0 none, 1 hl, 2 ix, 3 iy) is loaded with [next] instead
+// [counter] keeps the count of a block instruction low: 0 none, 1 BC (ldi, cpi), 2 B (ini, outi)
+// The block stays mostly native so that the JIT compiles it rather than running it through the handlers
+static void putSeed(std::string& code, std::mt19937& random, const int jumpRegister, const unsigned short next, const int counter)
+{
+	// F from an ALU operation on two random values, then A
+	put(code, 0x3E, random() & 0xFF);
+	put(code, 0xC6 | ((random() % 8) << 3), random() & 0xFF);
+	put(code, 0x3E, random() & 0xFF);
+	const unsigned char b = random() & 0xFF;
+	const unsigned char c = random() & 0xFF;
+	put(code, 0x06, (counter == 1) ? 0 : (counter == 2) ? 1 + (b & 3) : b);
+	put(code, 0x0E, (counter == 1) ? 1 + (c & 7) : c);
+	put(code, 0x16, 0x80 | (random() & 3));
+	put(code, 0x1E, random() & 0xFF);
+	const unsigned short hl = (jumpRegister == 1) ? next : (unsigned short)(0x8000 | (random() & 0x3FF));
+	put(code, 0x26, hl >> 8);
+	put(code, 0x2E, hl & 0xFF);
+	put(code, 0xDD);
+	put16(code, 0x21, (jumpRegister == 2) ? next : (unsigned short)(0x8000 | (random() & 0x3FF)));
+	put(code, 0xFD);
+	put16(code, 0x21, (jumpRegister == 3) ? next : (unsigned short)(0x8000 | (random() & 0x3FF)));
+	put16(code, 0x31, VERIFY_STACK);
+	put(code, 0x40, 0x49, 0x52, 0x5B);
+}
+
+// [prefix] (0 for none, 0xCB, 0xED, 0xDD, 0xFD) and [opcode], 0xDD / 0xFD with [indexCB] for DD CB / FD CB, looped as
+// putSeed / instruction / jp VERIFY_ORIGIN, every jump and call of the instruction goes to the jp. [seed] only names it
+static VerifyProgram opcodeProgram(const unsigned char prefix, const bool indexCB, const unsigned char opcode, const unsigned int seed, std::mt19937& random)
+{
+	// the instruction bytes, the operand that depends on where it ends is filled in below
+	std::string instruction;
+	bool absoluteJump = false;
+	if (prefix == 0xCB || indexCB)
+	{
+		if (indexCB)
+		{
+			put(instruction, prefix, 0xCB, random() & 0xFF);
+		}
+		else
+		{
+			put(instruction, prefix);
+		}
+		put(instruction, opcode);
+	}
+	else if (prefix == 0xED)
+	{
+		put(instruction, 0xED, opcode);
+		if ((opcode & 0xC7) == 0x43)
+		{
+			putWord(instruction, (unsigned short)(0x8000 | (random() & 0x3FE)));
+		}
+	}
+	else
+	{
+		if (prefix != 0)
+		{
+			put(instruction, prefix);
+		}
+		put(instruction, opcode);
+		if (prefix != 0 && usesHL(opcode))
+		{
+			put(instruction, random() & 0xFF);
+		}
+		const unsigned int operands = mainLength(opcode) - 1;
+		if (operands == 1)
+		{
+			// a relative jump goes to the next instruction either way, only the cycles tell
+			const bool relative = opcode < 0x40 && (opcode & 7) == 0;
+			put(instruction, relative ? 0 : (random() & 0xFF));
+		}
+		else if (operands == 2)
+		{
+			absoluteJump = isAbsoluteJump(opcode);
+			putWord(instruction, (unsigned short)(0x8000 | (random() & 0x3FE)));
+		}
+	}
+
+	// jp (hl), jp (ix), jp (iy) go to the next instruction as well
+	const int jumpRegister = (opcode != 0xE9 || indexCB) ? 0 : (prefix == 0) ? 1 : (prefix == 0xDD) ? 2 : (prefix == 0xFD) ? 3 : 0;
+	// the block instructions repeat BC or B times, a few at most so that the loop gets run often enough to be compiled
+	const int counter = (prefix != 0xED || opcode < 0xA0 || (opcode & 7) >= 4) ? 0 : ((opcode & 7) < 2) ? 1 : 2;
+
+	// the seed is as long whatever it loads, so the instruction's address is known before the jump register is
+	VerifyProgram program;
+	const std::mt19937 seedRandom = random;
+	std::string loads;
+	putSeed(loads, random, 0, 0, counter);
+	program.next = (unsigned short)(VERIFY_ORIGIN + loads.size() + instruction.size());
+	if (jumpRegister != 0)
+	{
+		std::mt19937 again = seedRandom;
+		loads.clear();
+		putSeed(loads, again, jumpRegister, program.next, counter);
+	}
+	if (absoluteJump)
+	{
+		instruction[instruction.size() - 2] = (char)(program.next & 0xFF);
+		instruction[instruction.size() - 1] = (char)(program.next >> 8);
+	}
+	program.code = loads + instruction;
+	put16(program.code, 0xC3, VERIFY_ORIGIN);
+	program.instructions = (unsigned long long)(VERIFY_SEED_INSTRUCTIONS + 2) * VERIFY_RUNS;
+
+	for (unsigned int i = 0; i < VERIFY_DATA_SIZE; i++)
+	{
+		program.data += (char)(random() & 0xFF);
+	}
+
+	std::stringstream name;
+	name << std::hex << std::uppercase << std::setfill('0');
+	if (prefix != 0)
+	{
+		name << std::setw(2) << (int)prefix << " ";
+	}
+	if (indexCB)
+	{
+		name << "CB ";
+	}
+	name << std::setw(2) << (int)opcode << std::dec << " seed " << seed;
+	program.name = name.str();
+	return program;
+}
+
+// DE = where the program stores in this round, A = the round
+static void putStorePointer(std::string& code)
+{
+	put16(code, 0x21, VERIFY_ROUND);	// ld hl, VERIFY_ROUND
+	put(code, 0x34, 0x7E);			// inc (hl) / ld a, (hl)
+	put(code, 0xE6, VERIFY_STORE_PERIOD - 1);	// and VERIFY_STORE_PERIOD - 1
+	put(code, 0x87, 0x6F);			// add a, a / ld l, a
+	put(code, 0x26, VERIFY_POINTERS >> 8);	// ld h, VERIFY_POINTERS >> 8
+	put(code, 0x5E, 0x2C, 0x56);	// ld e, (hl) / inc l / ld d, (hl)
+	put16(code, 0x3A, VERIFY_ROUND);	// ld a, (VERIFY_ROUND)
+}
+
+// the pointers of putStorePointer, [target] in the first round of VERIFY_STORE_PERIOD
+static std::string storeData(const unsigned short target)
+{
+	std::string data(VERIFY_DATA_SIZE, 0);
+	for (unsigned int i = 0; i < VERIFY_STORE_PERIOD; i++)
+	{
+		const unsigned short pointer = (i == 0) ? target : VERIFY_SCRATCH;
+		data[VERIFY_POINTERS - VERIFY_DATA + i * 2] = (char)(pointer & 0xFF);
+		data[VERIFY_POINTERS - VERIFY_DATA + i * 2 + 1] = (char)(pointer >> 8);
+	}
+	return data;
+}
+
+static void patchWord(std::string& code, const size_t offset, const unsigned short val)
+{
+	code[offset] = (char)(val & 0xFF);
+	code[offset + 1] = (char)(val >> 8);
+}
+
+// The programs that store into code that was compiled, and the ones whose blocks take each other's cache slot
+static void storePrograms(std::vector<VerifyProgram>& programs)
+{
+	VerifyProgram program;
+	program.next = VERIFY_ORIGIN;
+	program.instructions = VERIFY_STORE_INSTRUCTIONS;
+
+	// the operand of an instruction further on in the running block
+	{
+		std::string& code = program.code;
+		code.clear();
+		putStorePointer(code);
+		put(code, 0x12, 0x47);		// ld (de), a / ld b, a
+		const unsigned short patch = here(code);
+		put(code, 0xC6, 0x00);		// patch: add a, 0
+		put(code, 0xA8);			// xor b
+		put16(code, 0x32, 0x8001);	// ld (0x8001), a
+		put16(code, 0xC3, VERIFY_ORIGIN);
+		program.name = "store ahead in the running block";
+		program.data = storeData(patch + 1);
+		programs.push_back(program);
+	}
+
+	// the operand of the first instruction of a compiled block that the running block is linked to
+	{
+		std::string& code = program.code;
+		code.clear();
+		putStorePointer(code);
+		put(code, 0x12, 0x47);		// ld (de), a / ld b, a
+		const size_t jump = code.size();
+		put16(code, 0xC3, 0);		// jp target
+		const unsigned short target = here(code);
+		put(code, 0x0E, 0x00);		// target: ld c, 0
+		put(code, 0x81, 0xA8);		// add a, c / xor b
+		put16(code, 0x32, 0x8002);	// ld (0x8002), a
+		put(code, 0x1C, 0x53);		// inc e / ld d, e
+		put16(code, 0xC3, VERIFY_ORIGIN);
+		patchWord(code, jump + 1, target);
+		program.name = "store into a linked block";
+		program.data = storeData(target + 1);
+		programs.push_back(program);
+	}
+
+	// the operand of the first instruction of the running block, which already ran
+	{
+		std::string& code = program.code;
+		code.clear();
+		put(code, 0x0E, 0x00);		// ld c, 0
+		putStorePointer(code);
+		put(code, 0x12, 0x81);		// ld (de), a / add a, c
+		put16(code, 0x32, 0x8003);	// ld (0x8003), a
+		put16(code, 0xC3, VERIFY_ORIGIN);
+		program.name = "store behind PC in the running block";
+		program.data = storeData(VERIFY_ORIGIN + 1);
+		programs.push_back(program);
+	}
+
+	// ldir of ld a, round / inc a over the first instruction of a compiled block
+	{
+		std::string& code = program.code;
+		code.clear();
+		putStorePointer(code);
+		put16(code, 0x32, VERIFY_SOURCE + 1);	// ld (VERIFY_SOURCE + 1), a
+		put16(code, 0x21, VERIFY_SOURCE);	// ld hl, VERIFY_SOURCE
+		put16(code, 0x01, 3);		// ld bc, 3
+		put(code, 0xED, 0xB0);		// ldir
+		put(code, 0x06, 0x05);		// ld b, 5
+		const size_t jump = code.size();
+		put16(code, 0xC3, 0);		// jp target
+		const unsigned short target = here(code);
+		put(code, 0x3E, 0x00, 0x3D);	// target: ld a, 0 / dec a
+		put(code, 0x80);			// add a, b
+		put16(code, 0x32, 0x8004);	// ld (0x8004), a
+		put16(code, 0xC3, VERIFY_ORIGIN);
+		patchWord(code, jump + 1, target);
+		program.name = "ldir over a compiled block";
+		program.data = storeData(target);
+		program.data[VERIFY_SOURCE - VERIFY_DATA] = 0x3E;
+		program.data[VERIFY_SOURCE + 2 - VERIFY_DATA] = 0x3C;
+		programs.push_back(program);
+	}
+
+	// two loops at the same cache slot, each one compiled after JIT_THRESHOLD rounds and evicted by the other
+	{
+		const unsigned short first = 0x200;
+		const unsigned short second = first + BLOCK_CACHE_SIZE;
+		const unsigned char rounds = JIT_THRESHOLD + 4;
+		std::string& code = program.code;
+		code.clear();
+		put(code, 0x06, rounds);	// ld b, rounds
+		put16(code, 0xC3, first);
+		code.resize(first - VERIFY_ORIGIN, 0);
+		put(code, 0x80, 0xA9);		// first: add a, b / xor c
+		put(code, 0x0C, 0x57);		// inc c / ld d, a
+		put(code, 0x10, 0xFA);		// djnz first
+		put(code, 0x06, rounds);	// ld b, rounds
+		put16(code, 0xC3, second);
+		code.resize(second - VERIFY_ORIGIN, 0);
+		put(code, 0x90, 0xB1);		// second: sub b / or c
+		put(code, 0x0D, 0x5F);		// dec c / ld e, a
+		put(code, 0x10, 0xFA);		// djnz second
+		put16(code, 0xC3, VERIFY_ORIGIN);
+		program.name = "compiled blocks sharing a cache slot";
+		program.data = std::string(VERIFY_DATA_SIZE, 0);
+		programs.push_back(program);
+	}
+}
+
+static bool runBoth(const VerifyProgram& program)
+{
+	std::string stack;
+	for (unsigned int i = 0; i < VERIFY_STACK_SIZE; i += 2)
+	{
+		put(stack, program.next & 0xFF, program.next >> 8);
+	}
+
+	CPU compiled;
+	CPU reference;
+	CPU* const cpus[2] = { &compiled, &reference };
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		cpus[i]->writeMemory(VERIFY_DATA, program.data);
+		cpus[i]->writeMemory(VERIFY_STACK - VERIFY_STACK_SIZE / 2, stack);
+		// PC starts at 0 as well
+		for (unsigned int vector = 0; vector <= 0x38; vector += 8)
+		{
+			std::string jump;
+			put16(jump, 0xC3, VERIFY_ORIGIN);
+			cpus[i]->writeMemory(vector, jump);
+		}
+		cpus[i]->writeMemory(VERIFY_ORIGIN, program.code);
+	}
+	const CPU::RunResult a = compiled.run(program.instructions, CPU::DISPATCH_JIT);
+	const CPU::RunResult b = reference.run(program.instructions, CPU::DISPATCH_SWITCH);
+	return a.reason == b.reason && a.instructions == b.instructions && compiled.sameState(reference);
+}
+
+bool verifyJit(unsigned int seeds)
+{
+	std::vector<VerifyProgram> programs;
+	std::mt19937 random(1);
+	for (unsigned int seed = 0; seed < seeds; seed++)
+	{
+		for (unsigned int opcode = 0; opcode < 0x100; opcode++)
+		{
+			const bool prefixByte = opcode == 0xCB || opcode == 0xDD || opcode == 0xED || opcode == 0xFD;
+			if (!prefixByte)
+			{
+				programs.push_back(opcodeProgram(0, false, (unsigned char)opcode, seed, random));
+				programs.push_back(opcodeProgram(0xDD, false, (unsigned char)opcode, seed, random));
+				programs.push_back(opcodeProgram(0xFD, false, (unsigned char)opcode, seed, random));
+			}
+			programs.push_back(opcodeProgram(0xCB, false, (unsigned char)opcode, seed, random));
+			programs.push_back(opcodeProgram(0xED, false, (unsigned char)opcode, seed, random));
+			programs.push_back(opcodeProgram(0xDD, true, (unsigned char)opcode, seed, random));
+			programs.push_back(opcodeProgram(0xFD, true, (unsigned char)opcode, seed, random));
+		}
+	}
+	storePrograms(programs);
+
+	unsigned int mismatches = 0;
+	for (size_t i = 0; i < programs.size(); i++)
+	{
+		if (!runBoth(programs[i]))
+		{
+			if (mismatches < VERIFY_REPORTED)
+			{
+				std::cout << programs[i].name << " does not match the switch engine" << std::endl;
+			}
+			mismatches++;
+		}
+	}
+	std::cout << programs.size() << " programs, " << mismatches << " did not match" << std::endl;
+	return mismatches == 0;
+}
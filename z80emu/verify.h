@@ -0,0 +1,12 @@
+#ifndef Z80_VERIFY_H
+#define Z80_VERIFY_H
+
+// Differential check of the JIT against the switch engine
+// Every main, CB, ED, DD / FD and DD CB / FD CB opcode runs in a loop that seeds the registers and flags, for [seeds]
+// different seeds, long enough for the loop to be compiled (JIT_THRESHOLD) and then run as compiled code. Programs that
+// store into compiled blocks and that alternate between two blocks in the same cache slot run after them. Each one runs
+// on a fresh CPU with DISPATCH_JIT and one with DISPATCH_SWITCH and the two have to end in the same state (CPU::sameState)
+// Prints the programs that did not and returns false if there was any
+bool verifyJit(unsigned int seeds);
+
+#endif